@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "NLogger.hpp"
+#include "NPool.hpp"
+
+//对象池竞争基准：比较互斥锁保护的NObjectPool与无锁的NConcurrentObjectPool（concurrent不带线程缓存，cached带默认线程缓存）
+//local   : 每个线程从共享池取batch个对象再全部归还
+//handoff : 线程两两配对，一个线程取对象经单生产者单消费者环交给另一个线程归还（网络线程取帧、解码线程释放）
+//每个对象带占用标志，同一对象被同时借出时计为errors；结果以JSON输出
+//
+//  pool_bench [--threads 1,2,4,8,16,32,64] [--iterations 200000] [--batch 4] [--mode all|local|handoff] [--json file]
+
+namespace {
+
+	struct BenchObject {
+		std::atomic<bool>	inUse{ false };
+		uint8_t				data[64];
+	};
+
+	using Pool = NObjectPool<BenchObject>;
+
+	//用互斥锁保护的NObjectPool，即在线程间共享池的原有做法
+	class LockedPool : public Pool {
+	public:
+		LockedPool(const Pool::CreateType& creator) :Pool(creator) {}
+
+		virtual void put(std::unique_ptr<BenchObject> t) override {
+			std::lock_guard<std::mutex> lock(mutex_);
+			Pool::put(std::move(t));
+		}
+
+		virtual Pool::Unique get() override {
+			std::lock_guard<std::mutex> lock(mutex_);
+			return Pool::get();
+		}
+
+	private:
+		std::mutex		mutex_;
+	};
+
+	struct Result {
+		double		seconds = 0;
+		int64_t		ops = 0;			//取出并归还的次数
+		int64_t		errors = 0;
+	};
+
+	//借出时检查占用标志
+	inline void acquire(const Pool::Unique& obj, std::atomic<int64_t>& errors) {
+		if (obj->inUse.exchange(true, std::memory_order_acq_rel)) {
+			++errors;
+		}
+	}
+
+	inline void release(Pool::Unique& obj) {
+		obj->inUse.store(false, std::memory_order_release);
+		obj.reset();
+	}
+
+	Result runLocal(Pool& pool, int threads, int64_t iterations, int batch) {
+		std::atomic<bool> go{ false };
+		std::atomic<int64_t> errors{ 0 };
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; ++t) {
+			workers.emplace_back([&]() {
+				std::vector<Pool::Unique> objs;
+				objs.reserve(batch);
+				while (!go.load(std::memory_order_acquire)) {
+					std::this_thread::yield();
+				}
+				for (int64_t i = 0; i < iterations; i += batch) {
+					for (int k = 0; k < batch; ++k) {
+						objs.emplace_back(pool.get());
+						acquire(objs.back(), errors);
+					}
+					for (auto& obj : objs) {
+						release(obj);
+					}
+					objs.clear();
+				}
+			});
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		go = true;
+		for (auto& w : workers) {
+			w.join();
+		}
+		Result r;
+		r.seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count() / 1e9;
+		r.ops = (int64_t)threads * ((iterations + batch - 1) / batch) * batch;
+		r.errors = errors;
+		return r;
+	}
+
+	//单生产者单消费者环
+	struct Handoff {
+		static const size_t kSize = 256;
+		std::vector<Pool::Unique>	slots;
+		std::atomic<size_t>			head{ 0 };
+		std::atomic<size_t>			tail{ 0 };
+
+		Handoff() {
+			slots.reserve(kSize);
+			for (size_t i = 0; i < kSize; ++i) {
+				slots.emplace_back(Pool::MakeNullPtr());
+			}
+		}
+	};
+
+	Result runHandoff(Pool& pool, int threads, int64_t iterations) {
+		int pairs = threads / 2;
+		std::atomic<bool> go{ false };
+		std::atomic<int64_t> errors{ 0 };
+		std::vector<std::unique_ptr<Handoff>> rings;
+		std::vector<std::thread> workers;
+		for (int p = 0; p < pairs; ++p) {
+			rings.emplace_back(new Handoff());
+			Handoff* ring = rings.back().get();
+			workers.emplace_back([&, ring]() {
+				while (!go.load(std::memory_order_acquire)) {
+					std::this_thread::yield();
+				}
+				for (int64_t i = 0; i < iterations; ++i) {
+					Pool::Unique obj = pool.get();
+					acquire(obj, errors);
+					size_t tail = ring->tail.load(std::memory_order_relaxed);
+					while (tail - ring->head.load(std::memory_order_acquire) >= Handoff::kSize) {
+						std::this_thread::yield();
+					}
+					ring->slots[tail % Handoff::kSize] = std::move(obj);
+					ring->tail.store(tail + 1, std::memory_order_release);
+				}
+			});
+			workers.emplace_back([&, ring]() {
+				for (int64_t i = 0; i < iterations; ++i) {
+					size_t head = ring->head.load(std::memory_order_relaxed);
+					while (ring->tail.load(std::memory_order_acquire) == head) {
+						std::this_thread::yield();
+					}
+					Pool::Unique obj = std::move(ring->slots[head % Handoff::kSize]);
+					ring->head.store(head + 1, std::memory_order_release);
+					release(obj);
+				}
+			});
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		go = true;
+		for (auto& w : workers) {
+			w.join();
+		}
+		Result r;
+		r.seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count() / 1e9;
+		r.ops = (int64_t)pairs * iterations;
+		r.errors = errors;
+		return r;
+	}
+}
+
+static
+void print_usage(const NLogger::shared& logger, const char* name) {
+	logger->info("usage:");
+	logger->info("  {} [--threads 1,2,4,8,16,32,64] [--iterations 200000] [--batch 4] [--mode all|local|handoff] [--json file]", name);
+}
+
+int main(int argc, char* argv[]) {
+	NLogger::EnableSinks("", true);
+	NLogger::shared logger = NLogger::Get("pool-bench");
+
+	std::vector<int> threadCounts = { 1, 2, 4, 8, 16, 32, 64 };
+	int64_t iterations = 200000;
+	int batch = 4;
+	std::string mode = "all";
+	std::string json;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const char* opt = argv[i];
+		const char* val = argv[i + 1];
+		if (!strcmp(opt, "--threads")) {
+			threadCounts.clear();
+			for (const char* p = val; *p; ) {
+				threadCounts.push_back(atoi(p));
+				const char* comma = strchr(p, ',');
+				p = comma ? comma + 1 : p + strlen(p);
+			}
+		}
+		else if (!strcmp(opt, "--iterations")) {
+			iterations = atoll(val);
+		}
+		else if (!strcmp(opt, "--batch")) {
+			batch = atoi(val);
+		}
+		else if (!strcmp(opt, "--mode")) {
+			mode = val;
+		}
+		else if (!strcmp(opt, "--json")) {
+			json = val;
+		}
+		else {
+			print_usage(logger, argv[0]);
+			return -1;
+		}
+	}
+	if (iterations <= 0 || batch <= 0 || threadCounts.empty()) {
+		print_usage(logger, argv[0]);
+		return -1;
+	}
+
+	std::string result = "[\n";
+	bool first = true;
+	for (const char* m : { "local", "handoff" }) {
+		if (mode != "all" && mode != m) {
+			continue;
+		}
+		for (int threads : threadCounts) {
+			if (threads <= 0 || (!strcmp(m, "handoff") && threads < 2)) {
+				continue;
+			}
+			for (const char* kind : { "locked", "concurrent", "cached" }) {
+				std::atomic<int64_t> created{ 0 };
+				auto creator = [&created]()->BenchObject* {
+					++created;
+					return new BenchObject();
+				};
+				std::unique_ptr<Pool> pool;
+				if (!strcmp(kind, "locked")) {
+					pool.reset(new LockedPool(creator));
+				}
+				else if (!strcmp(kind, "concurrent")) {
+					pool.reset(new NConcurrentObjectPool<BenchObject>(creator, NConcurrentObjectPool<BenchObject>::DEFAULT_CAPACITY, 0));
+				}
+				else {
+					pool.reset(new NConcurrentObjectPool<BenchObject>(creator));
+				}
+
+				Result r = !strcmp(m, "local") ? runLocal(*pool, threads, iterations, batch) : runHandoff(*pool, threads, iterations);
+				std::string line = fmt::format("  {{\"mode\": \"{}\", \"pool\": \"{}\", \"threads\": {}, \"ops\": {}, \"seconds\": {:.3f}"
+					", \"mops\": {:.2f}, \"nsPerOp\": {:.1f}, \"created\": {}, \"errors\": {}}}"
+					, m, kind, threads, r.ops, r.seconds
+					, r.seconds > 0 ? r.ops / r.seconds / 1e6 : 0
+					, r.ops > 0 ? r.seconds * 1e9 * threads / r.ops : 0
+					, created.load(), r.errors);
+				dbgi(logger, "{}", line);
+				result += (first ? "" : ",\n") + line;
+				first = false;
+			}
+		}
+	}
+	result += "\n]\n";
+
+	if (json.empty()) {
+		fputs(result.c_str(), stdout);
+	}
+	else {
+		FILE* fp = fopen(json.c_str(), "w");
+		if (!fp) {
+			dbge(logger, "failed to open json file, [{}]", json);
+			return -1;
+		}
+		fputs(result.c_str(), fp);
+		fclose(fp);
+	}
+	return 0;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "NLogger.hpp"
+#include "NRtpPacketizer.hpp"
+#include "NRtpDepacketizer.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+//RTP打包基准：合成编码包，打包后经本机UDP回环发送，接收端解包重组并与原始帧逐字节比较
+//可以在发送端模拟乱序和丢包（百分比），检验解包的重排和丢帧处理
+//报告每秒包数、每个CPU核每秒包数（包数 / 进程CPU时间）以及打包、解包的耗时，结果以JSON输出
+//
+//  rtp_bench [--codec h264|vp8] [--frames 3000] [--size 20000] [--mtu 1200] [--reorder 0] [--loss 0] [--json file]
+
+namespace {
+
+	//合成的编码包，数据由bench持有
+	class BenchPacket : public nmedia::video::EncodedPacket {
+	public:
+		BenchPacket(NCodec::Type codec, const std::vector<uint8_t>* data, int64_t pts, bool keyframe)
+			:codec_(codec), data_(data), pts_(pts), keyframe_(keyframe) {}
+
+		virtual const uint8_t* data() const override { return data_->data(); }
+		virtual size_t size() const override { return data_->size(); }
+		virtual NCodec::Type codecType() const override { return codec_; }
+		virtual bool isKeyframe() const override { return keyframe_; }
+		virtual int64_t pts() const override { return pts_; }
+		virtual int64_t dts() const override { return pts_; }
+		virtual int64_t duration() const override { return 3600; }
+		virtual int timebaseNum() const override { return 1; }
+		virtual int timebaseDen() const override { return 90000; }
+		virtual int64_t gts() const override { return 0; }
+
+	private:
+		NCodec::Type					codec_;
+		const std::vector<uint8_t>*		data_;
+		int64_t							pts_;
+		bool							keyframe_;
+	};
+
+#ifndef _WIN32
+#ifndef __linux__
+	//没有sendmmsg的平台逐个发送
+	struct mmsghdr {
+		struct msghdr	msg_hdr;
+		unsigned int	msg_len;
+	};
+#endif
+
+	int sendMessages(int fd, struct mmsghdr* msgs, size_t count) {
+#ifdef __linux__
+		return sendmmsg(fd, msgs, (unsigned int)count, 0);
+#else
+		return sendmsg(fd, &msgs[0].msg_hdr, 0) < 0 ? -1 : 1;
+#endif
+	}
+#endif
+
+	int64_t processCpuNs() {
+#ifdef _WIN32
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+	}
+
+	//H264：SPS、PPS加一个IDR，其后为P帧；每帧的slice数据不含起始码模式
+	void makeH264Frame(size_t size, bool keyframe, uint32_t seed, std::vector<uint8_t>* out) {
+		static const uint8_t kSps[] = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe8 };
+		static const uint8_t kPps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80 };
+		out->clear();
+		if (keyframe) {
+			out->insert(out->end(), kSps, kSps + sizeof(kSps));
+			out->insert(out->end(), kPps, kPps + sizeof(kPps));
+		}
+		const uint8_t slice[] = { 0, 0, 0, 1, (uint8_t)(keyframe ? 0x65 : 0x41), 0x88 };
+		out->insert(out->end(), slice, slice + sizeof(slice));
+		while (out->size() < size) {
+			seed = seed * 1103515245 + 12345;
+			//避免生成起始码
+			out->push_back((uint8_t)((seed >> 16) | 0x01));
+		}
+	}
+
+	void makeVP8Frame(size_t size, bool keyframe, uint32_t seed, std::vector<uint8_t>* out) {
+		out->clear();
+		out->push_back(keyframe ? 0x10 : 0x11);
+		while (out->size() < size) {
+			seed = seed * 1103515245 + 12345;
+			out->push_back((uint8_t)(seed >> 16));
+		}
+	}
+}
+
+static
+void print_usage(const NLogger::shared& logger, const char* name) {
+	logger->info("usage:");
+	logger->info("  {} [--codec h264|vp8] [--frames 3000] [--size 20000] [--mtu 1200] [--reorder 0] [--loss 0] [--json file]", name);
+}
+
+int main(int argc, char* argv[]) {
+	NLogger::EnableSinks("", true);
+	NLogger::shared logger = NLogger::Get("rtp-bench");
+
+	NCodec::Type codec = NCodec::H264;
+	int frames = 3000;
+	size_t frameSize = 20000;
+	size_t mtu = 1200;
+	int reorderPercent = 0;
+	int lossPercent = 0;
+	std::string json;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const char* opt = argv[i];
+		const char* val = argv[i + 1];
+		if (!strcmp(opt, "--codec")) {
+			codec = !strcmp(val, "vp8") ? NCodec::VP8 : NCodec::H264;
+		}
+		else if (!strcmp(opt, "--frames")) {
+			frames = atoi(val);
+		}
+		else if (!strcmp(opt, "--size")) {
+			frameSize = (size_t)atoi(val);
+		}
+		else if (!strcmp(opt, "--mtu")) {
+			mtu = (size_t)atoi(val);
+		}
+		else if (!strcmp(opt, "--reorder")) {
+			reorderPercent = atoi(val);
+		}
+		else if (!strcmp(opt, "--loss")) {
+			lossPercent = atoi(val);
+		}
+		else if (!strcmp(opt, "--json")) {
+			json = val;
+		}
+		else {
+			print_usage(logger, argv[0]);
+			return -1;
+		}
+	}
+
+#ifdef _WIN32
+	dbge(logger, "rtp bench needs POSIX sockets.");
+	return -1;
+#else
+	nmedia::video::RtpPacketizer::Config cfg;
+	cfg.codec = codec;
+	cfg.ssrc = 0x12345678;
+	cfg.mtu = mtu;
+	nmedia::video::RtpPacketizer::shared packetizer = nmedia::video::RtpPacketizer::Create("rtp", cfg);
+	if (!packetizer || frames <= 0 || frameSize < 16) {
+		print_usage(logger, argv[0]);
+		return -1;
+	}
+
+	//合成一个GOP的帧，循环使用；关键帧为P帧的4倍大小
+	const int gop = 50;
+	std::vector<std::vector<uint8_t>> gopFrames(gop);
+	for (int n = 0; n < gop; ++n) {
+		size_t size = (0 == n) ? frameSize * 4 : frameSize / 2 + (n * 7919) % frameSize;
+		if (NCodec::H264 == codec) {
+			makeH264Frame(size, 0 == n, n, &gopFrames[n]);
+		}
+		else {
+			makeVP8Frame(size, 0 == n, n, &gopFrames[n]);
+		}
+	}
+
+	//本机UDP回环
+	int rx = socket(AF_INET, SOCK_DGRAM, 0);
+	int tx = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t addrLen = sizeof(addr);
+	int rcvbuf = 8 * 1024 * 1024;
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr*)&addr, sizeof(addr)) < 0
+		|| getsockname(rx, (struct sockaddr*)&addr, &addrLen) < 0
+		|| connect(tx, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		dbge(logger, "failed to set up udp loopback.");
+		return -1;
+	}
+
+	//接收端：解包重组，按pts找到原始帧比较
+	nmedia::video::RtpDepacketizer::Config depCfg;
+	depCfg.codec = codec;
+	nmedia::video::RtpDepacketizer::shared depacketizer = nmedia::video::RtpDepacketizer::Create("rtp-dep", depCfg);
+	std::atomic<bool> done{ false };
+	std::atomic<int64_t> received{ 0 };
+	int64_t matched = 0;
+	int64_t mismatched = 0;
+	int64_t depacketizeNs = 0;
+	depacketizer->output([&](NMediaFrame::Unique frame) {
+		const std::vector<uint8_t>& origin = gopFrames[(frame->getPts() / 3600) % gop];
+		if (frame->size() == origin.size() && 0 == memcmp(frame->data(), origin.data(), origin.size())) {
+			++matched;
+		}
+		else {
+			++mismatched;
+		}
+	});
+	std::thread receiver([&]() {
+		std::vector<uint8_t> buf(65536);
+		struct timeval tv = { 0, 100000 };
+		setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		while (true) {
+			ssize_t n = recv(rx, buf.data(), buf.size(), 0);
+			if (n < 0) {
+				if (done) {
+					break;
+				}
+				continue;
+			}
+			auto t0 = std::chrono::steady_clock::now();
+			depacketizer->input(buf.data(), n);
+			depacketizeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+			++received;
+		}
+		depacketizer->flush();
+	});
+
+	uint32_t seed = 1;
+	auto chance = [&seed](int percent) {
+		seed = seed * 1103515245 + 12345;
+		return (int)((seed >> 16) % 100) < percent;
+	};
+
+	nmedia::video::RtpFrame frame;
+	int64_t sent = 0;
+	int64_t sendErrors = 0;
+	int64_t packetizeNs = 0;
+	std::vector<struct mmsghdr> msgs;
+	auto begin = std::chrono::steady_clock::now();
+	int64_t cpuBegin = processCpuNs();
+	for (int n = 0; n < frames; ++n) {
+		auto pkt = std::make_shared<BenchPacket>(codec, &gopFrames[n % gop], (int64_t)n * 3600, 0 == n % gop);
+
+		auto t0 = std::chrono::steady_clock::now();
+		packetizer->packetize(pkt, &frame);
+		packetizeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+
+		//每个RTP包一个msghdr，iovec直接引用帧中的段，一帧的包一次系统调用发出
+		const auto& packets = frame.packets();
+		msgs.resize(packets.size());
+		for (size_t i = 0; i < packets.size(); ++i) {
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = const_cast<struct iovec*>(frame.iov(i));
+			msgs[i].msg_hdr.msg_iovlen = packets[i].iovcnt;
+		}
+		//模拟乱序（与下一个包交换）和丢包
+		for (size_t i = 0; reorderPercent > 0 && i + 1 < msgs.size(); ++i) {
+			if (chance(reorderPercent)) {
+				std::swap(msgs[i], msgs[i + 1]);
+				++i;
+			}
+		}
+		for (size_t i = 0; lossPercent > 0 && i < msgs.size(); ) {
+			if (chance(lossPercent)) {
+				msgs.erase(msgs.begin() + i);
+			}
+			else {
+				++i;
+			}
+		}
+		size_t offset = 0;
+		while (offset < msgs.size()) {
+			int n = sendMessages(tx, &msgs[offset], msgs.size() - offset);
+			if (n <= 0) {
+				++sendErrors;
+				++offset;
+				continue;
+			}
+			sent += n;
+			offset += n;
+		}
+
+		//回环没有流控，发送过快时接收缓冲区会溢出；每帧后让接收端追上
+		while (received < sent - 512) {
+			std::this_thread::yield();
+		}
+	}
+	double seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / 1000000.0;
+	double cpuSeconds = (processCpuNs() - cpuBegin) / 1000000000.0;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	done = true;
+	receiver.join();
+	close(rx);
+	close(tx);
+
+	nmedia::video::RtpPacketizer::Stats stats = packetizer->getStats();
+	nmedia::video::RtpDepacketizer::Stats depStats = depacketizer->getStats();
+	double pps = seconds > 0 ? sent / seconds : 0;
+	double ppsPerCore = cpuSeconds > 0 ? sent / cpuSeconds : 0;
+	std::string result = fmt::format("{{\"codec\": \"{}\", \"frames\": {}, \"frameSize\": {}, \"mtu\": {}, \"packets\": {}, \"received\": {}"
+		", \"sendErrors\": {}, \"seconds\": {:.3f}, \"pps\": {:.0f}, \"mbps\": {:.1f}"
+		", \"cpuSeconds\": {:.3f}, \"ppsPerCore\": {:.0f}, \"packetizeNsPerPacket\": {:.1f}, \"depacketizeNsPerPacket\": {:.1f}"
+		", \"single\": {}, \"stapA\": {}, \"fuA\": {}"
+		", \"framesOut\": {}, \"matched\": {}, \"mismatched\": {}, \"dropped\": {}, \"lost\": {}, \"late\": {}, \"reordered\": {}}}\n"
+		, NCodec::H264 == codec ? "h264" : "vp8", frames, frameSize, mtu, sent, received.load()
+		, sendErrors, seconds, pps, seconds > 0 ? stats.bytes * 8 / seconds / 1000000 : 0
+		, cpuSeconds, ppsPerCore, stats.packets > 0 ? (double)packetizeNs / stats.packets : 0
+		, depStats.packets > 0 ? (double)depacketizeNs / depStats.packets : 0
+		, stats.single, stats.stapA, stats.fuA
+		, depStats.frames, matched, mismatched, depStats.dropped, depStats.lost, depStats.late, depStats.reordered);
+
+	dbgi(logger, "packetizer {}", stats.dump());
+	dbgi(logger, "depacketizer {}", depStats.dump());
+	if (json.empty()) {
+		fputs(result.c_str(), stdout);
+	}
+	else {
+		FILE* fp = fopen(json.c_str(), "w");
+		if (!fp) {
+			dbge(logger, "failed to open json file, [{}]", json);
+			return -1;
+		}
+		fputs(result.c_str(), fp);
+		fclose(fp);
+	}
+	return 0;
+#endif
+}
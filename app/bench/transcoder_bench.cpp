@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "NLogger.hpp"
+#include "NVideoTranscoder.hpp"
+#include "NMediaFrame.hpp"
+#include "NTErrorDefined.hpp"
+#include "NFrameBufferPool.hpp"
+#include "NHugePageArena.hpp"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/opt.h"
+#include "libavutil/log.h"
+}
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+//Transcoder端到端吞吐基准
+//启动时用libavcodec编码器生成确定的合成输入流（运动的渐变图案），不依赖外部文件，
+//然后对每组 区域数 x 输入分辨率 x 输出配置 测量持续帧率、每帧延迟分位数和CPU时间，结果以JSON输出
+//
+//  transcoder_bench [options]
+//    --regions 1,4,9          区域数，每个区域一路独立的输入源
+//    --input 640x360,1280x720 输入分辨率
+//    --output 1280x720        输出分辨率
+//    --codec h264             输入编码 h264|vp8
+//    --out-codec h264         输出编码 h264|vp8
+//    --fps 25                 输入和输出帧率
+//    --bitrate 1800000        输出码率
+//    --frames 300             每组测量的输出帧数
+//    --hugepages off          池化帧缓冲区的内存 off|thp|hugetlb，hugetlb需预留vm.nr_hugepages
+//    --json result.json       结果写入文件，默认输出到stdout
+
+namespace {
+
+	struct BenchConfig {
+		std::vector<int>			regions = { 1, 4 };
+		std::vector<NVideoSize>		inputs = { NVideoSize(640, 360) };
+		std::vector<NVideoSize>		outputs = { NVideoSize(1280, 720) };
+		NCodec::Type				codec = NCodec::H264;
+		NCodec::Type				outCodec = NCodec::H264;
+		int							fps = 25;
+		int							bitrate = 1800000;
+		int							frames = 300;
+		std::string					hugepages = "off";
+		std::string					json;
+	};
+
+	struct BenchResult {
+		int				regions = 0;
+		NVideoSize		input;
+		NVideoSize		output;
+		int64_t			frames = 0;
+		int64_t			bytes = 0;
+		double			seconds = 0;
+		double			fps = 0;
+		double			cpuSeconds = 0;
+		double			latencyMs[4] = { 0 };	//p50 p90 p99 max
+		nmedia::video::Transcoder::Stats stats;
+	};
+
+	int64_t processCpuNs() {
+#ifdef _WIN32
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+	}
+
+	const char* codecName(NCodec::Type codec) {
+		return NCodec::H264 == codec ? "h264" : "vp8";
+	}
+
+	NCodec::Type codecOf(const char* name) {
+		if (!strcmp(name, "h264")) {
+			return NCodec::H264;
+		}
+		else if (!strcmp(name, "vp8")) {
+			return NCodec::VP8;
+		}
+		return NCodec::UNKNOWN;
+	}
+
+	bool parseSizes(const char* arg, std::vector<NVideoSize>* sizes) {
+		sizes->clear();
+		std::string s = arg;
+		size_t pos = 0;
+		while (pos <= s.size()) {
+			size_t end = s.find(',', pos);
+			if (end == std::string::npos) {
+				end = s.size();
+			}
+			int w = 0, h = 0;
+			if (sscanf(s.substr(pos, end - pos).c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+				return false;
+			}
+			sizes->push_back(NVideoSize(w, h));
+			pos = end + 1;
+		}
+		return !sizes->empty();
+	}
+
+	bool parseInts(const char* arg, std::vector<int>* values) {
+		values->clear();
+		std::string s = arg;
+		size_t pos = 0;
+		while (pos <= s.size()) {
+			size_t end = s.find(',', pos);
+			if (end == std::string::npos) {
+				end = s.size();
+			}
+			int v = atoi(s.substr(pos, end - pos).c_str());
+			if (v <= 0) {
+				return false;
+			}
+			values->push_back(v);
+			pos = end + 1;
+		}
+		return !values->empty();
+	}
+
+	//生成确定的合成输入流：每帧为按帧序号平移的渐变加一个移动方块
+	//生成的码流保存在内存中，测量时循环使用
+	int generateStream(const NLogger::shared& logger, NCodec::Type codec, const NVideoSize& size, int fps, int frames
+		, std::vector<std::vector<uint8_t>>* packets) {
+		AVCodec* pCodec = avcodec_find_encoder(NCodec::H264 == codec ? AV_CODEC_ID_H264 : AV_CODEC_ID_VP8);
+		if (!pCodec) {
+			dbge(logger, "can not find encoder for {}", codecName(codec));
+			return NOT_SUPPORT_CODEC_TYPE;
+		}
+
+		AVCodecContext* ctx = avcodec_alloc_context3(pCodec);
+		ctx->width = size.width;
+		ctx->height = size.height;
+		ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+		ctx->time_base.num = 1;
+		ctx->time_base.den = fps;
+		ctx->framerate.num = fps;
+		ctx->framerate.den = 1;
+		ctx->gop_size = fps * 2;
+		ctx->max_b_frames = 0;
+		ctx->bit_rate = (int64_t)size.width * size.height * fps / 10;
+		ctx->thread_count = 1;
+
+		AVDictionary* param = nullptr;
+		if (NCodec::H264 == codec) {
+			av_dict_set(&param, "preset", "ultrafast", 0);
+			av_dict_set(&param, "tune", "zerolatency", 0);
+		}
+		else {
+			av_dict_set(&param, "deadline", "realtime", 0);
+			av_dict_set(&param, "cpu-used", "8", 0);
+		}
+
+		int ret = avcodec_open2(ctx, pCodec, &param);
+		av_dict_free(&param);
+		if (ret < 0) {
+			dbge(logger, "failed to open {} encoder", codecName(codec));
+			avcodec_free_context(&ctx);
+			return FAILED_INIT_ENCODER;
+		}
+
+		AVFrame* frame = av_frame_alloc();
+		frame->width = size.width;
+		frame->height = size.height;
+		frame->format = AV_PIX_FMT_YUV420P;
+		av_frame_get_buffer(frame, 32);
+		AVPacket* pkt = av_packet_alloc();
+
+		for (int n = 0; n <= frames; ++n) {
+			//最后一轮送入空帧冲刷编码器
+			AVFrame* in = nullptr;
+			if (n < frames) {
+				av_frame_make_writable(frame);
+				for (int y = 0; y < size.height; ++y) {
+					uint8_t* row = frame->data[0] + y * frame->linesize[0];
+					for (int x = 0; x < size.width; ++x) {
+						row[x] = (uint8_t)(x + y + n * 3);
+					}
+				}
+				for (int y = 0; y < size.height / 2; ++y) {
+					memset(frame->data[1] + y * frame->linesize[1], (uint8_t)(128 + y / 4 + n), size.width / 2);
+					memset(frame->data[2] + y * frame->linesize[2], (uint8_t)(64 + n * 2), size.width / 2);
+				}
+				int box = std::max(16, size.height / 8);
+				int bx = (n * 8) % std::max(1, size.width - box);
+				int by = (n * 4) % std::max(1, size.height - box);
+				for (int y = by; y < by + box; ++y) {
+					memset(frame->data[0] + y * frame->linesize[0] + bx, 235, box);
+				}
+				frame->pts = n;
+				in = frame;
+			}
+
+			ret = avcodec_send_frame(ctx, in);
+			while (ret >= 0) {
+				ret = avcodec_receive_packet(ctx, pkt);
+				if (ret < 0) {
+					break;
+				}
+				packets->push_back(std::vector<uint8_t>(pkt->data, pkt->data + pkt->size));
+				av_packet_unref(pkt);
+			}
+		}
+
+		av_packet_free(&pkt);
+		av_frame_free(&frame);
+		avcodec_free_context(&ctx);
+		return packets->empty() ? ERROR_ENCODE_VIDEO : 0;
+	}
+
+	double percentile(const std::vector<int64_t>& sorted, double p) {
+		if (sorted.empty()) {
+			return 0;
+		}
+		size_t i = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+		return sorted[i] / 1000000.0;
+	}
+
+	int runOne(const NLogger::shared& logger, const BenchConfig& cfg, int regions, const NVideoSize& input, const NVideoSize& output
+		, const std::vector<std::vector<uint8_t>>& stream, BenchResult* result) {
+		nmedia::video::Transcoder::shared stc = nmedia::video::Transcoder::Create("bench");
+		nmedia::video::Transcoder::OutputConfig ocfg;
+		ocfg.width = output.width;
+		ocfg.height = output.height;
+		ocfg.backgroundColor = 0x0;
+		ocfg.framerate = cfg.fps;
+		ocfg.bitrate = cfg.bitrate;
+		ocfg.outCodecType = cfg.outCodec;
+		//测量合成路径，单路时也不走直通
+		ocfg.passthrough = false;
+
+		int ret = stc->init(ocfg);
+		if (ret < 0) {
+			dbge(logger, "failed to init transcoder, ret=[{}]", ret);
+			return ret;
+		}
+
+		//网格布局，每个区域引用自己的输入源
+		int cols = (int)ceil(sqrt((double)regions));
+		int rows = (regions + cols - 1) / cols;
+		std::vector<nmedia::video::RegionConfig> layout;
+		for (int i = 0; i < regions; ++i) {
+			nmedia::video::RegionConfig r;
+			r.index = i;
+			r.width = output.width / cols;
+			r.height = output.height / rows;
+			r.x = (i % cols) * r.width;
+			r.y = (i / cols) * r.height;
+			r.zOrder = 1;
+			r.scalinglMode = nmedia::video::ScalingMode::AspectFit;
+			r.source = i;
+			layout.push_back(r);
+		}
+		ret = stc->setRegions(layout);
+		if (ret) {
+			dbge(logger, "failed to set regions, ret=[{}]", ret);
+			stc->close();
+			return ret < 0 ? ret : EXTERNAL_PARAM_NOT_VAILD;
+		}
+
+		int64_t bytes = 0;
+		stc->outputPacket([&bytes](const nmedia::video::EncodedPacket::shared& pkt) {
+			bytes += pkt->size();
+		});
+
+		NVideoFrame::Pool framePool;
+		std::vector<int64_t> latencies;
+		latencies.reserve(cfg.frames);
+
+		//预热一个GOP之外的若干帧不计入，避免解码器和缩放器初始化影响结果
+		const int warmup = std::min<int>(cfg.fps, (int)stream.size());
+		auto begin = std::chrono::steady_clock::now();
+		int64_t cpuBegin = processCpuNs();
+		for (int n = 0; n < warmup + cfg.frames; ++n) {
+			if (n == warmup) {
+				begin = std::chrono::steady_clock::now();
+				cpuBegin = processCpuNs();
+				bytes = 0;
+			}
+
+			//码流循环使用时解码器会看到参考帧不连续，从关键帧（第0包）重新开始即可
+			const std::vector<uint8_t>& data = stream[n % stream.size()];
+			auto t0 = std::chrono::steady_clock::now();
+			for (int s = 0; s < regions; ++s) {
+				NMediaFrame::Unique pkt = framePool.get();
+				NVideoFrame* videoFrame = static_cast<NVideoFrame*>(pkt.get());
+				memcpy(videoFrame->resize(data.size()), data.data(), data.size());
+				videoFrame->setCodecType(cfg.codec, NMedia::Video);
+				videoFrame->setPts((int64_t)n * 90000 / cfg.fps);
+				stc->inputSource(s, std::move(pkt));
+			}
+			const AVFrame* frame = nullptr;
+			stc->transcode(&frame);
+			auto t1 = std::chrono::steady_clock::now();
+
+			if (n >= warmup) {
+				latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+			}
+		}
+
+		result->regions = regions;
+		result->input = input;
+		result->output = output;
+		result->frames = cfg.frames;
+		result->bytes = bytes;
+		result->seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / 1000000.0;
+		result->fps = result->seconds > 0 ? cfg.frames / result->seconds : 0;
+		result->cpuSeconds = (processCpuNs() - cpuBegin) / 1000000000.0;
+		std::sort(latencies.begin(), latencies.end());
+		result->latencyMs[0] = percentile(latencies, 0.50);
+		result->latencyMs[1] = percentile(latencies, 0.90);
+		result->latencyMs[2] = percentile(latencies, 0.99);
+		result->latencyMs[3] = latencies.empty() ? 0 : latencies.back() / 1000000.0;
+		result->stats = stc->getStats();
+
+		stc->close();
+		return 0;
+	}
+
+	std::string toJson(const BenchConfig& cfg, const std::vector<BenchResult>& results) {
+		std::string str = fmt::format("{{\n  \"codec\": \"{}\",\n  \"outCodec\": \"{}\",\n  \"fps\": {},\n  \"bitrate\": {},\n  \"hugepages\": \"{}\",\n  \"results\": [\n"
+			, codecName(cfg.codec), codecName(cfg.outCodec), cfg.fps, cfg.bitrate, cfg.hugepages);
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchResult& r = results[i];
+			str += fmt::format("    {{\"regions\": {}, \"input\": \"{}x{}\", \"output\": \"{}x{}\", \"frames\": {}, \"bytes\": {}"
+				", \"seconds\": {:.3f}, \"fps\": {:.2f}, \"realtime\": {:.2f}, \"cpuSeconds\": {:.3f}, \"cpuPerFrameMs\": {:.3f}"
+				", \"latencyMs\": {{\"p50\": {:.3f}, \"p90\": {:.3f}, \"p99\": {:.3f}, \"max\": {:.3f}}}"
+				", \"stageMs\": {{\"decode\": {}, \"scale\": {}, \"compose\": {}, \"encode\": {}}}}}{}\n"
+				, r.regions, r.input.width, r.input.height, r.output.width, r.output.height, r.frames, r.bytes
+				, r.seconds, r.fps, r.fps / cfg.fps, r.cpuSeconds, r.frames > 0 ? r.cpuSeconds * 1000 / r.frames : 0
+				, r.latencyMs[0], r.latencyMs[1], r.latencyMs[2], r.latencyMs[3]
+				, r.stats.decodeNs / 1000000, r.stats.scaleNs / 1000000, r.stats.composeNs / 1000000, r.stats.encodeNs / 1000000
+				, i + 1 < results.size() ? "," : "");
+		}
+		return str + "  ]\n}\n";
+	}
+}
+
+static
+void print_usage(const NLogger::shared& logger, const char* name) {
+	logger->info("usage:");
+	logger->info("  {} [--regions 1,4] [--input 640x360,...] [--output 1280x720,...] [--codec h264|vp8] [--out-codec h264|vp8]", name);
+	logger->info("     [--fps 25] [--bitrate 1800000] [--frames 300] [--hugepages off|thp|hugetlb] [--json file]");
+}
+
+int main(int argc, char* argv[]) {
+	NLogger::EnableSinks("", true);
+	NLogger::shared logger = NLogger::Get("bench");
+	av_log_set_level(AV_LOG_QUIET);
+
+	BenchConfig cfg;
+	for (int i = 1; i < argc; ++i) {
+		const char* opt = argv[i];
+		const char* val = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool ok = (nullptr != val);
+		if (!ok) {
+		}
+		else if (!strcmp(opt, "--regions")) {
+			ok = parseInts(val, &cfg.regions);
+		}
+		else if (!strcmp(opt, "--input")) {
+			ok = parseSizes(val, &cfg.inputs);
+		}
+		else if (!strcmp(opt, "--output")) {
+			ok = parseSizes(val, &cfg.outputs);
+		}
+		else if (!strcmp(opt, "--codec")) {
+			cfg.codec = codecOf(val);
+			ok = NCodec::UNKNOWN != cfg.codec;
+		}
+		else if (!strcmp(opt, "--out-codec")) {
+			cfg.outCodec = codecOf(val);
+			ok = NCodec::UNKNOWN != cfg.outCodec;
+		}
+		else if (!strcmp(opt, "--fps")) {
+			cfg.fps = atoi(val);
+			ok = cfg.fps > 0;
+		}
+		else if (!strcmp(opt, "--bitrate")) {
+			cfg.bitrate = atoi(val);
+			ok = cfg.bitrate > 0;
+		}
+		else if (!strcmp(opt, "--frames")) {
+			cfg.frames = atoi(val);
+			ok = cfg.frames > 0;
+		}
+		else if (!strcmp(opt, "--hugepages")) {
+			cfg.hugepages = val;
+			ok = cfg.hugepages == "off" || cfg.hugepages == "thp" || cfg.hugepages == "hugetlb";
+		}
+		else if (!strcmp(opt, "--json")) {
+			cfg.json = val;
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok) {
+			dbge(logger, "invalid option [{}]", opt);
+			print_usage(logger, argv[0]);
+			return -1;
+		}
+		++i;
+	}
+
+	if (cfg.hugepages != "off") {
+		nmedia::video::HugePageArena::Config arenaCfg;
+		arenaCfg.mode = cfg.hugepages == "hugetlb" ? nmedia::video::HugePageArena::Mode::HugeTlb : nmedia::video::HugePageArena::Mode::Transparent;
+		nmedia::video::FrameBufferPool::Get().setArena(nmedia::video::HugePageArena::Create("arena", arenaCfg));
+	}
+
+	std::vector<BenchResult> results;
+	for (auto& input : cfg.inputs) {
+		//每种输入分辨率生成一次，两个GOP，循环使用
+		std::vector<std::vector<uint8_t>> stream;
+		if (generateStream(logger, cfg.codec, input, cfg.fps, cfg.fps * 4, &stream) < 0) {
+			return -1;
+		}
+		dbgi(logger, "generated {} stream {}x{}, packets=[{}]", codecName(cfg.codec), input.width, input.height, stream.size());
+
+		for (auto& output : cfg.outputs) {
+			for (int regions : cfg.regions) {
+				BenchResult result;
+				if (runOne(logger, cfg, regions, input, output, stream, &result) < 0) {
+					return -1;
+				}
+				dbgi(logger, "regions=[{}], input=[{}x{}], output=[{}x{}], fps=[{:.1f}], p99=[{:.2f}ms], cpu=[{:.2f}s]"
+					, regions, input.width, input.height, output.width, output.height, result.fps, result.latencyMs[2], result.cpuSeconds);
+				results.push_back(result);
+			}
+		}
+	}
+
+	dbgi(logger, "frame buffers {}", nmedia::video::FrameBufferPool::Get().getStats().dump());
+
+	std::string json = toJson(cfg, results);
+	if (cfg.json.empty()) {
+		fputs(json.c_str(), stdout);
+	}
+	else {
+		FILE* fp = fopen(cfg.json.c_str(), "w");
+		if (!fp) {
+			dbge(logger, "failed to open json file, [{}]", cfg.json);
+			return -1;
+		}
+		fputs(json.c_str(), fp);
+		fclose(fp);
+	}
+	return 0;
+}
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "NLogger.hpp"
+#include "NVideoTranscoder.hpp"
+#include "NMediaFrame.hpp"
+#include "NInputCapture.hpp"
+#include "NTrackFileReader.hpp"
+#include "NOutputSink.hpp"
+#include "NMuxSink.hpp"
+#include "NFrameBufferPool.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+extern "C" {
+	int file_transcode_main(int argc, char* argv[]);
+}
+
+//离线转码：从文件读入各路录制的输入，按布局文件解码/合成/编码，不显示、不按实时节奏，尽可能快地输出
+//
+//布局文件，每行一条，#开头为注释：
+//  output <width> <height> <framerate> <bitrate> <h264|vp8> [backgroundColor]
+//  input  <source> <h264|vp8> <file> [framerate]
+//  region <index> <x> <y> <width> <height> <zOrder> <none|fit|fill|stretch> [source]
+//输入文件为长度前缀格式（每包为int类型的长度加数据，与old-transcoder的输入相同）、H264 Annex-B裸流或IVF，按文件内容自动识别，
+//文件整体映射到内存读取，IVF使用文件中的时间戳，其他格式第k个包的时间为 k / framerate，未指定帧率时与输出相同
+//输出H264写Annex-B裸流，VP8按输入相同的长度前缀格式写出；输出文件名以.mp4或.ivf结尾时封装为分片MP4或IVF
+//指定capture file时同时录制转码器的调用，可以用replay模块回放
+
+namespace {
+
+	struct InputFile {
+		int				source = -1;
+		NCodec::Type	codec = NCodec::UNKNOWN;
+		std::string		path;
+		int				framerate = -1;
+		NTrackFileReader::shared	reader = nullptr;
+		int64_t			packets = 0;
+		int64_t			firstMs = -1;		//IVF第一个包的时间，时间戳以它为起点
+		bool			eof = false;
+	};
+
+	struct Layout {
+		nmedia::video::Transcoder::OutputConfig		output;
+		std::vector<InputFile>						inputs;
+		std::vector<nmedia::video::RegionConfig>	regions;
+	};
+
+	NCodec::Type codecOf(const char* name) {
+		if (!strcmp(name, "h264")) {
+			return NCodec::H264;
+		}
+		else if (!strcmp(name, "vp8")) {
+			return NCodec::VP8;
+		}
+		return NCodec::UNKNOWN;
+	}
+
+	nmedia::video::ScalingMode scalingModeOf(const char* name) {
+		if (!strcmp(name, "none")) {
+			return nmedia::video::ScalingMode::None;
+		}
+		else if (!strcmp(name, "fit")) {
+			return nmedia::video::ScalingMode::AspectFit;
+		}
+		else if (!strcmp(name, "fill")) {
+			return nmedia::video::ScalingMode::AspectFill;
+		}
+		else if (!strcmp(name, "stretch")) {
+			return nmedia::video::ScalingMode::Fill;
+		}
+		return nmedia::video::ScalingMode::Unknown;
+	}
+
+	int loadLayout(const NLogger::shared& logger, const std::string& path, Layout* layout) {
+		FILE* fp = fopen(path.c_str(), "r");
+		if (!fp) {
+			dbge(logger, "failed to open layout file, [{}]", path);
+			return -1;
+		}
+
+		char line[1024];
+		int lineno = 0;
+		int ret = 0;
+		while (fgets(line, sizeof(line), fp)) {
+			++lineno;
+			char kind[32] = { 0 };
+			if (sscanf(line, "%31s", kind) != 1 || kind[0] == '#') {
+				continue;
+			}
+
+			char codec[32] = { 0 };
+			char file[512] = { 0 };
+			char mode[32] = { 0 };
+			int n = 0;
+			if (!strcmp(kind, "output")) {
+				unsigned int color = 0;
+				nmedia::video::Transcoder::OutputConfig& o = layout->output;
+				n = sscanf(line, "%*s %d %d %d %d %31s %x", &o.width, &o.height, &o.framerate, &o.bitrate, codec, &color);
+				o.outCodecType = codecOf(codec);
+				o.backgroundColor = (n >= 6) ? (int)color : 0x0;
+				ret = (n >= 5) ? 0 : -1;
+			}
+			else if (!strcmp(kind, "input")) {
+				InputFile in;
+				n = sscanf(line, "%*s %d %31s %511s %d", &in.source, codec, file, &in.framerate);
+				in.codec = codecOf(codec);
+				in.path = file;
+				layout->inputs.push_back(in);
+				ret = (n >= 3 && NCodec::UNKNOWN != in.codec) ? 0 : -1;
+			}
+			else if (!strcmp(kind, "region")) {
+				nmedia::video::RegionConfig r;
+				n = sscanf(line, "%*s %d %d %d %d %d %d %31s %d", &r.index, &r.x, &r.y, &r.width, &r.height, &r.zOrder, mode, &r.source);
+				r.scalinglMode = scalingModeOf(mode);
+				layout->regions.push_back(r);
+				ret = (n >= 7 && r.valid()) ? 0 : -1;
+			}
+			else {
+				ret = -1;
+			}
+
+			if (ret < 0) {
+				dbge(logger, "invalid layout line {}: {}", lineno, line);
+				break;
+			}
+		}
+		fclose(fp);
+
+		if (!ret && (layout->inputs.empty() || layout->regions.empty() || !layout->output.vaild())) {
+			dbge(logger, "layout needs output, input and region lines, [{}]", path);
+			ret = -1;
+		}
+		return ret;
+	}
+
+	//读取下一个包到池中的帧
+	// 0 : 成功
+	// -1 : 文件结束或出错
+	int readPacket(InputFile& in, NVideoFrame::Pool& pool, NMediaFrame::Unique* out) {
+		int size = in.reader->next();
+		if (size <= 0) {
+			return -1;
+		}
+
+		//从映射内存拷贝一次，池中的帧保证解码器需要的零填充
+		NMediaFrame::Unique frame = pool.get();
+		NVideoFrame* videoFrame = static_cast<NVideoFrame*>(frame.get());
+		memcpy(videoFrame->resize(size), in.reader->data(), size);
+		videoFrame->setCodecType(in.codec, NMedia::Video);
+		int64_t pts = in.packets * 90000 / in.framerate;
+		int64_t ms = in.reader->time();
+		if (NTrackFileReader::IVF == in.reader->format() && ms >= 0) {
+			if (in.firstMs < 0) {
+				in.firstMs = ms;
+			}
+			pts = (ms - in.firstMs) * 90;
+		}
+		videoFrame->setPts(pts);
+		++in.packets;
+		*out = std::move(frame);
+		return 0;
+	}
+
+	bool endsWith(const std::string& str, const char* suffix) {
+		size_t n = strlen(suffix);
+		return str.size() >= n && 0 == str.compare(str.size() - n, n, suffix);
+	}
+
+	int64_t peakRssKB() {
+#ifdef _WIN32
+		return -1;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+#else
+		return usage.ru_maxrss;
+#endif
+#endif
+	}
+}
+
+static
+void print_usage(const NLogger::shared& logger, const char* name) {
+	logger->info("usage:");
+	logger->info("  {} <layout file> <output file> [max frames] [capture file]", name);
+}
+
+int file_transcode_main(int argc, char* argv[]) {
+	NLogger::EnableSinks("", true);
+	NLogger::shared logger = NLogger::Get("file-transcode");
+
+	if (argc < 3) {
+		print_usage(logger, argv[0]);
+		return -1;
+	}
+
+	const std::string layoutPath = argv[1];
+	const std::string outPath = argv[2];
+	const int64_t maxFrames = (argc > 3) ? atoll(argv[3]) : -1;
+	const std::string capturePath = (argc > 4) ? argv[4] : "";
+
+	Layout layout;
+	if (loadLayout(logger, layoutPath, &layout) < 0) {
+		return -1;
+	}
+
+	nmedia::video::OutputSink::shared outSink = nmedia::video::OutputSink::Create("output");
+	nmedia::video::MuxSink::shared muxSink = nullptr;
+	if (endsWith(outPath, ".mp4") || endsWith(outPath, ".ivf")) {
+		nmedia::video::MuxSink::Config muxCfg = nmedia::video::MuxSink::Config::From(layout.output);
+		muxCfg.container = endsWith(outPath, ".mp4") ? nmedia::video::MuxSink::Container::FMP4 : nmedia::video::MuxSink::Container::IVF;
+		muxSink = nmedia::video::MuxSink::Create("mux");
+		if (muxSink->open(outPath, muxCfg) < 0) {
+			dbge(logger, "failed to open out file, [{}]", outPath);
+			return -1;
+		}
+	}
+	else {
+		nmedia::video::OutputSink::Config sinkCfg;
+		sinkCfg.framing = (NCodec::VP8 == layout.output.outCodecType)
+			? nmedia::video::OutputSink::Framing::LengthPrefixed : nmedia::video::OutputSink::Framing::Raw;
+		if (outSink->open(outPath, sinkCfg) < 0) {
+			dbge(logger, "failed to open out file, [{}]", outPath);
+			return -1;
+		}
+	}
+
+	int ret = 0;
+	for (auto& in : layout.inputs) {
+		if (in.framerate <= 0) {
+			in.framerate = layout.output.framerate;
+		}
+		in.reader = NTrackFileReader::Create();
+		if (in.reader->open(in.path, NTrackFileReader::Auto, in.framerate) < 0) {
+			dbge(logger, "failed to open input file, [{}]", in.path);
+			ret = -1;
+		}
+		else {
+			dbgi(logger, "input source=[{}], file=[{}], format=[{}], packets=[{}]"
+				, in.source, in.path, NTrackFileReader::GetNameFor(in.reader->format()), in.reader->frames());
+			if (NCodec::UNKNOWN != in.reader->codec() && in.codec != in.reader->codec()) {
+				dbgw(logger, "input file looks like {}, layout says {}, [{}]"
+					, NCodec::GetNameFor(in.reader->codec()), NCodec::GetNameFor(in.codec), in.path);
+			}
+		}
+	}
+
+	NVideoFrame::Pool framePool;
+	framePool.setName("file-input");
+	nmedia::video::Transcoder::shared stc = nmedia::video::Transcoder::Create("file-transcode");
+	nmedia::video::InputRecorder::shared recorder = nullptr;
+	int64_t outFrames = 0;
+	int64_t outBytes = 0;
+	int64_t inPackets = 0;
+
+	if (!ret && !capturePath.empty()) {
+		recorder = nmedia::video::InputRecorder::Create("capture");
+		ret = recorder->open(capturePath);
+		stc->capture(recorder);
+	}
+
+	if (!ret) {
+		ret = stc->init(layout.output);
+		if (ret < 0) {
+			dbge(logger, "failed to init transcoder, ret=[{}], cfg=[{}]", ret, layout.output.dump());
+		}
+	}
+
+	if (!ret) {
+		//失败时返回冲突或不可用的区域编号
+		ret = stc->setRegions(layout.regions);
+		if (ret) {
+			dbge(logger, "failed to set regions, ret=[{}]", ret);
+			ret = -1;
+		}
+	}
+
+	if (!ret) {
+		stc->outputPacket([&outSink, &muxSink, &outFrames, &outBytes](const nmedia::video::EncodedPacket::shared& pkt) {
+			if (muxSink) {
+				muxSink->write(pkt);
+			}
+			else {
+				outSink->write(pkt);
+			}
+			++outFrames;
+			outBytes += pkt->size();
+		});
+
+		std::vector<NMediaFrame::Unique> pending;
+		for (size_t i = 0; i < layout.inputs.size(); ++i) {
+			pending.emplace_back(NMediaFrame::MakeNullPtr());
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		int64_t tick = 0;
+		while (maxFrames < 0 || tick < maxFrames) {
+			//送入时间不晚于本输出帧的所有输入包
+			const int64_t tickPts = tick * 90000 / layout.output.framerate;
+			bool active = false;
+			for (auto& in : layout.inputs) {
+				//预读一个包，按包的pts判断是否已到送入时间
+				while (!in.eof) {
+					NMediaFrame::Unique& pkt = pending[&in - layout.inputs.data()];
+					if (!pkt && readPacket(in, framePool, &pkt) < 0) {
+						in.eof = true;
+						break;
+					}
+					if (pkt->getPts() > tickPts) {
+						break;
+					}
+					stc->inputSource(in.source, std::move(pkt));
+					++inPackets;
+				}
+				active = active || !in.eof;
+			}
+			if (!active) {
+				break;
+			}
+
+			const AVFrame* frame = nullptr;
+			stc->transcode(&frame);
+			++tick;
+		}
+
+		double seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / 1000000.0;
+		double fps = seconds > 0 ? tick / seconds : 0;
+		dbgi(logger, "done, frames=[{}], packets in=[{}], out=[{}], bytes out=[{}], time=[{:.3f}s], fps=[{:.1f}], realtime=[{:.2f}x]"
+			, tick, inPackets, outFrames, outBytes, seconds, fps, fps / layout.output.framerate);
+		dbgi(logger, "stages {}", stc->getStats().dump());
+		dbgi(logger, "frame buffers {}", nmedia::video::FrameBufferPool::Get().getStats().dump());
+		dbgi(logger, "peak memory=[{}KB]", peakRssKB());
+	}
+
+	stc->close();
+	if (recorder) {
+		recorder->close();
+		dbgi(logger, "capture {}", recorder->getStats().dump());
+	}
+
+	for (auto& in : layout.inputs) {
+		if (in.reader) {
+			in.reader->close();
+		}
+	}
+
+	if (muxSink) {
+		muxSink->close();
+		dbgi(logger, "output {}", muxSink->getStats().dump());
+	}
+	else {
+		outSink->close();
+		dbgi(logger, "output {}", outSink->getStats().dump());
+	}
+	return ret < 0 ? -1 : 0;
+}
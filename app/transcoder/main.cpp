@@ -2,6 +2,8 @@
 
 #define MODULE_OLD_TRANSCODER   "old-transcoder"
 #define MODULE_YUV_MIX			"yuv-mix"
+#define MODULE_FILE_TRANSCODE	"file-transcode"
+#define MODULE_REPLAY			"replay"
 
 static NLogger::shared mlogger = NLogger::Get("main");
 
@@ -12,11 +14,15 @@ void print_usage(int argc, char* argv[]) {
 	mlogger->info("modules:");
 	mlogger->info("  {}", MODULE_OLD_TRANSCODER);
 	mlogger->info("  {}", MODULE_YUV_MIX);
+	mlogger->info("  {}", MODULE_FILE_TRANSCODE);
+	mlogger->info("  {}", MODULE_REPLAY);
 }
 
 extern "C" {
 	int old_transcoder_main(int argc, char* argv[]);
 	int yuv_mix_main(int argc, char* argv[]);
+	int file_transcode_main(int argc, char* argv[]);
+	int replay_main(int argc, char* argv[]);
 }
 
 int main(int argc, char* argv[]) {
@@ -32,6 +38,12 @@ int main(int argc, char* argv[]) {
 	else if (module_name == MODULE_YUV_MIX) {
 		return yuv_mix_main(argc - 1, argv + 1);
 	}
+	else if (module_name == MODULE_FILE_TRANSCODE) {
+		return file_transcode_main(argc - 1, argv + 1);
+	}
+	else if (module_name == MODULE_REPLAY) {
+		return replay_main(argc - 1, argv + 1);
+	}
 	else {
 		dbge(mlogger, "unknown module [{}]", module_name);
 		print_usage(argc, argv);
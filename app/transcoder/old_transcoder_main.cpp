@@ -1,6 +1,7 @@
 #include "NLogger.hpp"
 #include "NVideoTranscoder.hpp"
 #include "NMediaFrame.hpp"
+#include "NOutputSink.hpp"
 #include "SDLDisplay.hpp"
 
 #define __STDC_CONSTANT_MACROS
@@ -25,14 +26,13 @@ int old_transcoder_main(int argc, char* argv[]) {
     std::string outfile_str("/tmp/output.h264");
 #endif
 	FILE* in_file = nullptr;
-	FILE* out_file = nullptr;
+	nmedia::video::OutputSink::shared out_sink = nmedia::video::OutputSink::Create("output");
 
 	std::shared_ptr<nmedia::video::Transcoder> stc = nmedia::video::Transcoder::Create("h264p");
 	nmedia::video::Transcoder::OutputConfig config;
 	std::vector<nmedia::video::RegionConfig> reCfg;
-	NVideoFrame* inFrame1 = nullptr;
+	NVideoFrame::Pool framePool;
 
-	uint8_t* in_buf = nullptr;
 	size_t packet_num = 0;
 	NSDLDisplay::shared monitor = NSDLDisplay::Create("display");
 
@@ -45,8 +45,7 @@ int old_transcoder_main(int argc, char* argv[]) {
 		goto END;
 	}
 
-	out_file = fopen(outfile_str.c_str(), "wb");
-	if (!out_file) {
+	if (out_sink->open(outfile_str, nmedia::video::OutputSink::Config()) < 0) {
 		dbge(logger, "failed to open out file, [{}]", outfile_str);
 		goto END;
 	}
@@ -61,25 +60,19 @@ int old_transcoder_main(int argc, char* argv[]) {
 
 	stc->init(config);
 	{
-		//区域配置
-		reCfg.push_back({ 0, 0, 0, 400, 800, 1, nmedia::video::ScalingMode::AspectFit });
-		reCfg.push_back({ 1, 400, 0, 400, 800, 1, nmedia::video::ScalingMode::AspectFit });
+		//区域配置，两个区域显示同一路输入源0
+		reCfg.push_back({ 0, 0, 0, 400, 800, 1, nmedia::video::ScalingMode::AspectFit, 0 });
+		reCfg.push_back({ 1, 400, 0, 400, 800, 1, nmedia::video::ScalingMode::AspectFit, 0 });
 		stc->setRegions(reCfg);
 	}
 
-	stc->output([&out_file, &packet_num, &logger](const uint8_t* data, const size_t size) {
-		if (out_file) {
-			dbgi(logger, "write to file, size=[{}], packet num=[{}]. ", size, packet_num);
-			fwrite(data, sizeof(uint8_t), size, out_file);
-			++packet_num;
-		}
+	//写文件在后台线程批量进行，不占用转码线程
+	stc->outputPacket([&out_sink, &packet_num](const nmedia::video::EncodedPacket::shared& pkt) {
+		out_sink->write(pkt);
+		++packet_num;
 	});
 
-	inFrame1 = new NVideoFrame();
-	inFrame1->setSize({ 640,480 });
-	inFrame1->setCodecType(NCodec::Type::H264, NMedia::Type::Video);
-
-	monitor->OnFrame([&stc, &in_file, &logger, &in_buf, &inFrame1]()->const AVFrame* {
+	monitor->OnFrame([&stc, &in_file, &logger, &framePool]()->const AVFrame* {
 		int ret = 0;
 		int read_size = 0;
 
@@ -89,22 +82,18 @@ int old_transcoder_main(int argc, char* argv[]) {
 			return nullptr;
 		}
 
-		in_buf = new uint8_t[read_size];
-		memset(in_buf, 0x00, read_size);
-		ret = fread(in_buf, sizeof(uint8_t), read_size, in_file);
+		//直接读入池中的帧，解码器引用该帧数据，用完后归还到池
+		NMediaFrame::Unique inFrame = framePool.get();
+		NVideoFrame* videoFrame = static_cast<NVideoFrame*>(inFrame.get());
+		videoFrame->setCodecType(NCodec::Type::H264, NMedia::Type::Video);
+		ret = fread(videoFrame->resize(read_size), sizeof(uint8_t), read_size, in_file);
 		if (!ret) {
 			dbge(logger, "read infile error! ret=[{}]", ret);
 			return nullptr;
 		}
+		videoFrame->resize(ret);
 
-		inFrame1->setData(in_buf, ret);
-		if (in_buf) {
-			delete[] in_buf;
-			in_buf = nullptr;
-		}
-
-		stc->input(0, inFrame1);
-		stc->input(1, inFrame1);
+		stc->inputSource(0, std::move(inFrame));
 
 		const AVFrame* frame = nullptr;
 		stc->transcode(&frame);
@@ -122,15 +111,8 @@ END:;
 		in_file = nullptr;
 	}
 
-	if (out_file) {
-		fclose(out_file);
-		out_file = nullptr;
-	}
-
-	if (inFrame1) {
-		delete inFrame1;
-		inFrame1 = nullptr;
-	}
+	out_sink->close();
+	dbgi(logger, "output packets=[{}], sink=[{}]", packet_num, out_sink->getStats().dump());
 
 	return 0;
 }
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include "NLogger.hpp"
+#include "NVideoTranscoder.hpp"
+#include "NInputCapture.hpp"
+#include "NMediaFrame.hpp"
+
+extern "C" {
+	int replay_main(int argc, char* argv[]);
+}
+
+//回放InputRecorder录制的文件：按录制的顺序重新调用init/setRegions/addRegion/input/inputSource/transcode
+//speed为1时按录制时的到达时间间隔回放，为N时加快N倍，为max时不等待，用于重现线上的负载峰值和性能回退
+//
+//  replay <capture file> [output file] [speed|max]
+
+static
+void print_usage(const NLogger::shared& logger, const char* name) {
+	logger->info("usage:");
+	logger->info("  {} <capture file> [output file] [speed|max]", name);
+}
+
+int replay_main(int argc, char* argv[]) {
+	NLogger::EnableSinks("", true);
+	NLogger::shared logger = NLogger::Get("replay");
+
+	if (argc < 2) {
+		print_usage(logger, argv[0]);
+		return -1;
+	}
+
+	const std::string capturePath = argv[1];
+	const std::string outPath = (argc > 2) ? argv[2] : "";
+	double speed = 1.0;
+	if (argc > 3) {
+		speed = strcmp(argv[3], "max") ? atof(argv[3]) : 0;
+		if (speed < 0) {
+			print_usage(logger, argv[0]);
+			return -1;
+		}
+	}
+
+	nmedia::video::InputReplayer::shared replayer = nmedia::video::InputReplayer::Create("replay");
+	if (replayer->open(capturePath) < 0) {
+		return -1;
+	}
+
+	FILE* outFile = nullptr;
+	if (!outPath.empty()) {
+		outFile = fopen(outPath.c_str(), "wb");
+		if (!outFile) {
+			dbge(logger, "failed to open out file, [{}]", outPath);
+			return -1;
+		}
+	}
+
+	nmedia::video::Transcoder::shared stc = nmedia::video::Transcoder::Create("replay");
+	int64_t outFrames = 0;
+	int64_t outBytes = 0;
+	bool lengthPrefixed = false;
+	auto onPacket = [&outFile, &lengthPrefixed, &outFrames, &outBytes](const nmedia::video::EncodedPacket::shared& pkt) {
+		if (outFile) {
+			if (lengthPrefixed) {
+				int size = (int)pkt->size();
+				fwrite(&size, sizeof(int), 1, outFile);
+			}
+			fwrite(pkt->data(), sizeof(uint8_t), pkt->size(), outFile);
+		}
+		++outFrames;
+		outBytes += pkt->size();
+	};
+
+	NVideoFrame videoFrame;
+	nmedia::video::CaptureRecord rec;
+	const uint8_t* data = nullptr;
+	int64_t records = 0;
+	int64_t ticks = 0;
+	int64_t errors = 0;
+	int64_t firstUs = -1;
+	int64_t lastUs = -1;
+	auto begin = std::chrono::steady_clock::now();
+
+	while (!replayer->next(&rec, &data)) {
+		++records;
+
+		//按录制时的相对到达时间节奏回放
+		if (firstUs < 0) {
+			firstUs = rec.arrivalUs;
+		}
+		lastUs = rec.arrivalUs;
+		if (speed > 0) {
+			auto due = begin + std::chrono::microseconds((int64_t)((rec.arrivalUs - firstUs) / speed));
+			std::this_thread::sleep_until(due);
+		}
+
+		int ret = 0;
+		switch (rec.type) {
+		case nmedia::video::CaptureRecord::Config: {
+			nmedia::video::Transcoder::OutputConfig cfg;
+			ret = nmedia::video::InputReplayer::ParseConfig(rec, data, &cfg);
+			if (!ret) {
+				//录制中重新初始化时，先关闭再按新参数打开
+				if (stc->isOpened()) {
+					stc->close();
+				}
+				ret = stc->init(cfg);
+				lengthPrefixed = (NCodec::VP8 == cfg.outCodecType);
+				stc->outputPacket(onPacket);
+				dbgi(logger, "init, ret=[{}], cfg=[{}]", ret, cfg.dump());
+			}
+			break;
+		}
+		case nmedia::video::CaptureRecord::Regions: {
+			std::vector<nmedia::video::RegionConfig> regions;
+			ret = nmedia::video::InputReplayer::ParseRegions(rec, data, &regions);
+			if (!ret) {
+				ret = stc->setRegions(regions);
+			}
+			break;
+		}
+		case nmedia::video::CaptureRecord::Region: {
+			std::vector<nmedia::video::RegionConfig> regions;
+			ret = nmedia::video::InputReplayer::ParseRegions(rec, data, &regions);
+			if (!ret && regions.size() == 1) {
+				ret = stc->addRegion(regions[0]);
+				ret = ret < 0 ? ret : 0;
+			}
+			break;
+		}
+		case nmedia::video::CaptureRecord::Input:
+		case nmedia::video::CaptureRecord::InputSource: {
+			videoFrame.setData(data, rec.size);
+			videoFrame.setCodecType((NCodec::Type)rec.codec, NMedia::Video);
+			videoFrame.setPts(rec.pts);
+			ret = (nmedia::video::CaptureRecord::Input == rec.type)
+				? stc->input(rec.index, &videoFrame)
+				: stc->inputSource(rec.index, &videoFrame);
+			break;
+		}
+		case nmedia::video::CaptureRecord::Tick: {
+			const AVFrame* frame = nullptr;
+			ret = stc->transcode(&frame);
+			++ticks;
+			break;
+		}
+		default:
+			dbge(logger, "unknown record type [{}] at record {}", rec.type, records);
+			break;
+		}
+
+		//录制的调用本身也可能失败，这里只计数
+		if (ret) {
+			++errors;
+		}
+	}
+
+	double seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / 1000000.0;
+	double capturedSeconds = (firstUs < 0) ? 0 : (lastUs - firstUs) / 1000000.0;
+	dbgi(logger, "done, records=[{}], ticks=[{}], errors=[{}], packets out=[{}], bytes out=[{}], time=[{:.3f}s], captured=[{:.3f}s], speed=[{:.2f}x]"
+		, records, ticks, errors, outFrames, outBytes, seconds, capturedSeconds, seconds > 0 ? capturedSeconds / seconds : 0);
+	dbgi(logger, "stages {}", stc->getStats().dump());
+
+	stc->close();
+	replayer->close();
+	if (outFile) {
+		fclose(outFile);
+	}
+	return 0;
+}
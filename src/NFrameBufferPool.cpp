@@ -0,0 +1,250 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include "NFrameBufferPool.hpp"
+#include "NTErrorDefined.hpp"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+};
+
+namespace nmedia {
+	namespace video {
+
+		class FrameBufferPoolImpl : public FrameBufferPool {
+		private:
+			static const size_t kMinBucketSize = 4096;
+
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+			using BufferSize = size_t;
+#else
+			using BufferSize = int;
+#endif
+
+			struct Bucket {
+				FrameBufferPoolImpl*	owner = nullptr;
+				AVBufferPool*			pool = nullptr;
+			};
+
+			//从arena分配的缓冲区，释放时归还arena
+			struct ArenaBlock {
+				HugePageArena::shared	arena;
+				size_t					size = 0;
+			};
+
+			mutable std::mutex							mutex_;
+			std::map<size_t, std::unique_ptr<Bucket>>	buckets_;
+			HugePageArena::shared						arena_ = nullptr;
+			std::atomic<int64_t>						gets_{ 0 };
+			std::atomic<int64_t>						allocations_{ 0 };
+			std::atomic<int64_t>						bytesAllocated_{ 0 };
+			std::atomic<int64_t>						arenaAllocations_{ 0 };
+			std::atomic<int64_t>						fallbacks_{ 0 };
+
+		public:
+			FrameBufferPoolImpl() {}
+
+			//只在进程退出时可能析构，桶中仍被引用的缓冲区由AVBufferPool在最后一个引用释放时回收
+			virtual ~FrameBufferPoolImpl() {
+				for (auto& b : buckets_) {
+					av_buffer_pool_uninit(&b.second->pool);
+				}
+			}
+
+			virtual AVBufferRef* alloc(size_t size) override {
+				Bucket* bucket = bucketFor(SizeClass(size));
+				if (!bucket) {
+					return nullptr;
+				}
+				AVBufferRef* buf = av_buffer_pool_get(bucket->pool);
+				if (buf) {
+					gets_.fetch_add(1, std::memory_order_relaxed);
+				}
+				return buf;
+			}
+
+			virtual int getFrameBuffer(AVFrame* frame, int align) override {
+				if (!frame || frame->width <= 0 || frame->height <= 0 || frame->format < 0 || align <= 0) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				int linesize[4] = { 0 };
+				if (av_image_fill_linesizes(linesize, (AVPixelFormat)frame->format, frame->width) < 0) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				for (int i = 0; i < 4; ++i) {
+					linesize[i] = (linesize[i] + align - 1) / align * align;
+				}
+				return fill(frame, frame->height, linesize);
+			}
+
+			virtual void setArena(const HugePageArena::shared& arena) override {
+				std::lock_guard<std::mutex> lock(mutex_);
+				arena_ = arena;
+			}
+
+			virtual Stats getStats() const override {
+				Stats stats;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					stats.buckets = (int)buckets_.size();
+				}
+				stats.gets = gets_.load(std::memory_order_relaxed);
+				stats.allocations = allocations_.load(std::memory_order_relaxed);
+				stats.bytesAllocated = bytesAllocated_.load(std::memory_order_relaxed);
+				stats.arenaAllocations = arenaAllocations_.load(std::memory_order_relaxed);
+				stats.fallbacks = fallbacks_.load(std::memory_order_relaxed);
+				return stats;
+			}
+
+			//按linesize为height行的所有平面分配一个缓冲区
+			int fill(AVFrame* frame, int height, const int linesize[4]) {
+				uint8_t* data[4] = { nullptr };
+				int size = av_image_fill_pointers(data, (AVPixelFormat)frame->format, height, nullptr, linesize);
+				if (size <= 0) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				AVBufferRef* buf = alloc((size_t)size + kPadding);
+				if (!buf) {
+					return FAILED_FILL_BUFFER;
+				}
+				av_image_fill_pointers(frame->data, (AVPixelFormat)frame->format, height, buf->data, linesize);
+				for (int i = 0; i < 4; ++i) {
+					frame->linesize[i] = linesize[i];
+				}
+				frame->buf[0] = buf;
+				frame->extended_data = frame->data;
+				return 0;
+			}
+
+			void fallback() {
+				fallbacks_.fetch_add(1, std::memory_order_relaxed);
+			}
+
+		private:
+			//2的幂之间按四分之一取整，同样大小的请求总是落在同一个桶
+			static size_t SizeClass(size_t size) {
+				if (size <= kMinBucketSize) {
+					return kMinBucketSize;
+				}
+				size_t power = kMinBucketSize;
+				while (power * 2 <= size) {
+					power *= 2;
+				}
+				size_t step = power / 4;
+				return (size + step - 1) / step * step;
+			}
+
+			Bucket* bucketFor(size_t size) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto search = buckets_.find(size);
+				if (search != buckets_.end()) {
+					return search->second.get();
+				}
+				std::unique_ptr<Bucket> bucket(new Bucket());
+				bucket->owner = this;
+				bucket->pool = av_buffer_pool_init2((BufferSize)size, bucket.get(), AllocBuffer, nullptr);
+				if (!bucket->pool) {
+					return nullptr;
+				}
+				Bucket* result = bucket.get();
+				buckets_[size] = std::move(bucket);
+				return result;
+			}
+
+			HugePageArena::shared getArena() const {
+				std::lock_guard<std::mutex> lock(mutex_);
+				return arena_;
+			}
+
+			//从arena分配，失败时返回nullptr
+			AVBufferRef* allocFromArena(size_t size) {
+				HugePageArena::shared arena = getArena();
+				if (!arena) {
+					return nullptr;
+				}
+				uint8_t* data = (uint8_t*)arena->alloc(size);
+				if (!data) {
+					return nullptr;
+				}
+				ArenaBlock* block = new ArenaBlock();
+				block->arena = arena;
+				block->size = size;
+				AVBufferRef* buf = av_buffer_create(data, (BufferSize)size, ArenaFree, block, 0);
+				if (!buf) {
+					arena->free(data, size);
+					delete block;
+					return nullptr;
+				}
+				arenaAllocations_.fetch_add(1, std::memory_order_relaxed);
+				return buf;
+			}
+
+			static void ArenaFree(void* opaque, uint8_t* data) {
+				ArenaBlock* block = static_cast<ArenaBlock*>(opaque);
+				block->arena->free(data, block->size);
+				delete block;
+			}
+
+			//池中没有空闲缓冲区时由AVBufferPool调用
+			static AVBufferRef* AllocBuffer(void* opaque, BufferSize size) {
+				Bucket* bucket = static_cast<Bucket*>(opaque);
+				AVBufferRef* buf = bucket->owner->allocFromArena((size_t)size);
+				if (!buf) {
+					buf = av_buffer_alloc(size);
+				}
+				if (buf) {
+					bucket->owner->allocations_.fetch_add(1, std::memory_order_relaxed);
+					bucket->owner->bytesAllocated_.fetch_add((int64_t)size, std::memory_order_relaxed);
+				}
+				return buf;
+			}
+		};
+
+		FrameBufferPool& FrameBufferPool::Get() {
+			static FrameBufferPoolImpl* pool = new FrameBufferPoolImpl();
+			return *pool;
+		}
+
+		int FrameBufferPool::GetBuffer2(AVCodecContext* ctx, AVFrame* frame, int flags) {
+			FrameBufferPoolImpl& pool = static_cast<FrameBufferPoolImpl&>(Get());
+			if (!ctx->codec || !(ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+				pool.fallback();
+				return avcodec_default_get_buffer2(ctx, frame, flags);
+			}
+
+			//与FFmpeg默认分配器相同：按解码器要求对齐宽高，加宽直到每个平面的行宽满足对齐
+			int width = frame->width;
+			int height = frame->height;
+			int align[AV_NUM_DATA_POINTERS] = { 0 };
+			avcodec_align_dimensions2(ctx, &width, &height, align);
+
+			int linesize[4] = { 0 };
+			bool unaligned = false;
+			do {
+				//硬件像素格式等无法计算行宽时交给默认分配器
+				if (av_image_fill_linesizes(linesize, (AVPixelFormat)frame->format, width) < 0) {
+					pool.fallback();
+					return avcodec_default_get_buffer2(ctx, frame, flags);
+				}
+				width += width & ~(width - 1);
+				unaligned = false;
+				for (int i = 0; i < 4; ++i) {
+					if (align[i] > 0 && linesize[i] % align[i]) {
+						unaligned = true;
+					}
+				}
+			} while (unaligned);
+
+			return pool.fill(frame, height, linesize) < 0 ? AVERROR(ENOMEM) : 0;
+		}
+
+		void FrameBufferPool::Attach(AVCodecContext* ctx) {
+			ctx->get_buffer2 = GetBuffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+			//帧级多线程时在解码线程中调用get_buffer2，池是线程安全的
+			ctx->thread_safe_callbacks = 1;
+#endif
+		}
+	}
+}
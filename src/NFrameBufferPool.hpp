@@ -0,0 +1,83 @@
+#ifndef NFrameBufferPool_hpp
+#define NFrameBufferPool_hpp
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+#include "fmt/fmt.h"
+#include "NHugePageArena.hpp"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+};
+
+namespace nmedia {
+	namespace video {
+
+		//进程内共享的图像缓冲池：按大小分桶，每个桶是一个AVBufferPool
+		//同样分辨率的会话落在同一个桶里，一个会话释放的缓冲区被下一个会话直接复用，稳态下每帧不再分配内存
+		//桶按2的幂之间的四分之一为步长取整，浪费不超过25%；桶在进程生命周期内不释放
+		//线程安全，解码器线程可以并发调用
+		class FrameBufferPool {
+		public:
+			//缓冲区末尾额外保留的字节，供SIMD越界读；平面之间不留填充，各平面紧接着排列（与av_image_fill_pointers相同）
+			static const int kPadding = 16 + 64 - 1;
+
+			struct Stats {
+				int buckets = 0;				//已创建的桶
+				int64_t gets = 0;				//分配的缓冲区
+				int64_t allocations = 0;		//池中没有空闲缓冲区而新分配的
+				int64_t bytesAllocated = 0;		//新分配的总字节数，即池占用的内存
+				int64_t arenaAllocations = 0;	//其中从大页内存区分配的
+				int64_t fallbacks = 0;			//解码器不支持而交给FFmpeg默认分配器的帧
+
+				const std::string dump() const {
+					return fmt::format("[buckets={}, gets={}, allocations={}, allocated={}KB, arena={}, fallbacks={}]"
+						, buckets
+						, gets
+						, allocations
+						, bytesAllocated / 1024
+						, arenaAllocations
+						, fallbacks);
+				}
+			};
+
+		public:
+			FrameBufferPool() {}
+
+			virtual ~FrameBufferPool() {}
+
+			//分配至少size字节的缓冲区，最后一个引用释放时回到所在的桶
+			// nullptr : 内存不足
+			virtual AVBufferRef* alloc(size_t size) = 0;
+
+			//按frame的width、height、format为所有平面分配一个池化缓冲区，填充data、linesize和buf[0]
+			//每行按align字节对齐，align为1时linesize等于图像宽度（见YUVMixer对平面布局的假设）
+			// 0 : 成功
+			// EXTERNAL_PARAM_NOT_VAILD : 尺寸或像素格式不可用
+			// FAILED_FILL_BUFFER : 内存不足
+			virtual int getFrameBuffer(AVFrame* frame, int align) = 0;
+
+			//之后新分配的缓冲区从arena切出，arena分配失败时退回av_buffer_alloc；nullptr恢复普通分配
+			//已在池中的缓冲区不受影响，arena由从其分配的缓冲区共同持有，直到最后一个释放
+			virtual void setArena(const HugePageArena::shared& arena) = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//进程内唯一的实例，永不析构，缓冲区可以晚于任何静态对象释放
+			static
+			FrameBufferPool& Get();
+
+			//AVCodecContext::get_buffer2的实现，解码器不支持AV_CODEC_CAP_DR1时使用FFmpeg默认分配器
+			static
+			int GetBuffer2(AVCodecContext* ctx, AVFrame* frame, int flags);
+
+			//让解码器从池中分配输出帧，须在avcodec_open2()之前调用
+			static
+			void Attach(AVCodecContext* ctx);
+		};
+	}
+}
+
+#endif //NFrameBufferPool_hpp
@@ -0,0 +1,192 @@
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "NHugePageArena.hpp"
+#include "NLogger.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace nmedia {
+	namespace video {
+
+		class HugePageArenaImpl : public HugePageArena {
+		private:
+			struct Chunk {
+				uint8_t*	base = nullptr;
+				size_t		size = 0;
+				size_t		used = 0;
+				bool		hugeTlb = false;
+			};
+
+			NLogger::shared								logger_ = nullptr;
+			Config										cfg_;
+			mutable std::mutex							mutex_;
+			std::vector<Chunk>							chunks_;
+			int											current_ = -1;		//正在切分的块
+			std::map<size_t, std::vector<void*>>		free_;
+			bool										warned_ = false;
+			Stats										stats_;
+
+		public:
+			HugePageArenaImpl(const std::string& name, const Config& cfg)
+				:logger_(NLogger::Get(name)), cfg_(cfg) {
+				cfg_.chunkSize = RoundUp(cfg_.chunkSize, kHugePageSize);
+			}
+
+			virtual ~HugePageArenaImpl() {
+				for (auto& c : chunks_) {
+					unmap(c);
+				}
+			}
+
+			virtual void* alloc(size_t size) override {
+				if (0 == size) {
+					return nullptr;
+				}
+				size = RoundUp(size, kAlign);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				++stats_.allocs;
+				auto search = free_.find(size);
+				if (search != free_.end() && !search->second.empty()) {
+					void* ptr = search->second.back();
+					search->second.pop_back();
+					++stats_.reuses;
+					stats_.freeBytes -= size;
+					stats_.usedBytes += size;
+					return ptr;
+				}
+
+				//超过半块的请求单独映射，避免浪费块的剩余部分
+				if (size > cfg_.chunkSize / 2) {
+					int index = map(RoundUp(size, kHugePageSize));
+					if (index < 0) {
+						return nullptr;
+					}
+					chunks_[index].used = size;
+					stats_.usedBytes += size;
+					return chunks_[index].base;
+				}
+
+				if (current_ < 0 || chunks_[current_].size - chunks_[current_].used < size) {
+					int index = map(cfg_.chunkSize);
+					if (index < 0) {
+						return nullptr;
+					}
+					current_ = index;
+				}
+				Chunk& c = chunks_[current_];
+				void* ptr = c.base + c.used;
+				c.used += size;
+				stats_.usedBytes += size;
+				return ptr;
+			}
+
+			virtual void free(void* ptr, size_t size) override {
+				if (!ptr) {
+					return;
+				}
+				size = RoundUp(size, kAlign);
+				std::lock_guard<std::mutex> lock(mutex_);
+				free_[size].push_back(ptr);
+				stats_.usedBytes -= size;
+				stats_.freeBytes += size;
+			}
+
+			virtual const Config& getConfig() const override {
+				return cfg_;
+			}
+
+			virtual Stats getStats() const override {
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+		private:
+			static size_t RoundUp(size_t size, size_t align) {
+				return (size + align - 1) / align * align;
+			}
+
+			//映射一个size字节（2MB的倍数）的块，返回块的下标
+			// -1 : 超过maxBytes、映射失败或平台不支持
+			int map(size_t size) {
+				if (cfg_.maxBytes > 0 && stats_.mappedBytes + (int64_t)size > (int64_t)cfg_.maxBytes) {
+					++stats_.failures;
+					return -1;
+				}
+
+				Chunk c;
+				c.size = size;
+#ifdef __linux__
+				if (Mode::HugeTlb == cfg_.mode) {
+					void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+					if (MAP_FAILED != p) {
+						c.base = (uint8_t*)p;
+						c.hugeTlb = true;
+					}
+					else if (!warned_) {
+						warned_ = true;
+						dbgw(logger_, "no reserved huge pages, fall back to transparent huge pages, size=[{}]", size);
+					}
+				}
+
+				if (!c.base) {
+					//多映射2MB，裁掉两端得到2MB对齐的区域，整块才能由大页承载
+					size_t mapped = size + kHugePageSize;
+					void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					if (MAP_FAILED == p) {
+						++stats_.failures;
+						dbge(logger_, "failed to map arena chunk, size=[{}]", size);
+						return -1;
+					}
+					uint8_t* raw = (uint8_t*)p;
+					uint8_t* base = (uint8_t*)RoundUp((uintptr_t)raw, kHugePageSize);
+					if (base > raw) {
+						munmap(raw, base - raw);
+					}
+					size_t tail = (raw + mapped) - (base + size);
+					if (tail > 0) {
+						munmap(base + size, tail);
+					}
+					//内核未开启透明大页时仍可作为普通内存使用
+					if (madvise(base, size, MADV_HUGEPAGE) < 0 && !warned_) {
+						warned_ = true;
+						dbgw(logger_, "transparent huge pages unavailable, arena uses normal pages");
+					}
+					c.base = base;
+				}
+#else
+				++stats_.failures;
+				return -1;
+#endif
+
+				chunks_.push_back(c);
+				++stats_.chunks;
+				if (c.hugeTlb) {
+					++stats_.hugeTlbChunks;
+				}
+				stats_.mappedBytes += size;
+				return (int)chunks_.size() - 1;
+			}
+
+			void unmap(Chunk& c) {
+#ifdef __linux__
+				if (c.base) {
+					munmap(c.base, c.size);
+				}
+#endif
+				c.base = nullptr;
+			}
+		};
+
+		HugePageArena::shared HugePageArena::Create(const std::string& name, const Config& cfg) {
+			if (!cfg.vaild()) {
+				return nullptr;
+			}
+			return std::make_shared<HugePageArenaImpl>(name, cfg);
+		}
+	}
+}
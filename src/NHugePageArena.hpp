@@ -0,0 +1,98 @@
+#ifndef NHugePageArena_hpp
+#define NHugePageArena_hpp
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//大页内存区：从按2MB对齐的大块映射中切出帧缓冲区
+		//几百路会话时画布、区域缩放图像和解码参考帧等多兆字节的平面会带来明显的TLB缺失（brushYUV420P、sws_scale）
+		//Transparent : 匿名映射按2MB对齐后madvise(MADV_HUGEPAGE)，由内核透明大页承载，不需要预留
+		//HugeTlb : MAP_HUGETLB从预留的大页（vm.nr_hugepages）映射，预留不足时退回Transparent
+		//平台不支持（非Linux）或映射失败时alloc()返回nullptr，调用者改用普通分配
+		//块在arena析构前不归还系统，释放的缓冲区按大小放入空闲表供同样大小的请求复用；线程安全
+		class HugePageArena {
+		public:
+			using shared = std::shared_ptr<HugePageArena>;
+
+			static const size_t kHugePageSize = 2 * 1024 * 1024;
+			//缓冲区起始地址的对齐
+			static const size_t kAlign = 64;
+
+			enum class Mode {
+				Transparent = 0,
+				HugeTlb
+			};
+
+			static const char* GetNameFor(Mode mode) {
+				switch (mode) {
+				case Mode::Transparent:		return "thp";
+				case Mode::HugeTlb:			return "hugetlb";
+				default:					return "unknown";
+				}
+			}
+
+			struct Config {
+				Mode mode = Mode::Transparent;
+				size_t chunkSize = 16 * kHugePageSize;		//每次映射的块大小，按2MB取整；更大的请求单独映射
+				size_t maxBytes = 0;						//映射总量上限，0为不限
+
+				bool vaild() const {
+					return (kHugePageSize <= chunkSize)
+						&& (0 == maxBytes || chunkSize <= maxBytes);
+				}
+			};
+
+			struct Stats {
+				int chunks = 0;					//映射的块
+				int hugeTlbChunks = 0;			//其中来自预留大页的块
+				int64_t mappedBytes = 0;
+				int64_t usedBytes = 0;			//已分配出去的
+				int64_t freeBytes = 0;			//空闲表中的
+				int64_t allocs = 0;
+				int64_t reuses = 0;				//由空闲表满足的分配
+				int64_t failures = 0;			//映射失败或超过maxBytes，返回nullptr
+
+				const std::string dump() const {
+					return fmt::format("[chunks={}, hugetlb={}, mapped={}KB, used={}KB, free={}KB, allocs={}, reuses={}, failures={}]"
+						, chunks
+						, hugeTlbChunks
+						, mappedBytes / 1024
+						, usedBytes / 1024
+						, freeBytes / 1024
+						, allocs
+						, reuses
+						, failures);
+				}
+			};
+
+		public:
+			HugePageArena() {}
+
+			virtual ~HugePageArena() {}
+
+			//分配size字节，起始地址按kAlign对齐
+			// nullptr : 映射失败、超过maxBytes或平台不支持
+			virtual void* alloc(size_t size) = 0;
+
+			//归还alloc()的缓冲区，size须与分配时相同
+			virtual void free(void* ptr, size_t size) = 0;
+
+			virtual const Config& getConfig() const = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//创建一个HugePageArena实例
+			// nullptr : cfg参数不可用
+			static
+			shared Create(const std::string& name, const Config& cfg);
+		};
+	}
+}
+
+#endif //NHugePageArena_hpp
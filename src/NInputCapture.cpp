@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <condition_variable>
+
+#include "NInputCapture.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+namespace nmedia {
+	namespace video {
+
+		//OutputConfig和RegionConfig按int32数组记录，字段顺序不能改变
+		static const size_t kConfigFields = 7;
+		static const size_t kRegionFields = 8;
+
+		static
+		inline int64_t nowUs() {
+			return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		static
+		void packRegion(const RegionConfig& r, int32_t* fields) {
+			fields[0] = r.index;
+			fields[1] = r.x;
+			fields[2] = r.y;
+			fields[3] = r.width;
+			fields[4] = r.height;
+			fields[5] = r.zOrder;
+			fields[6] = (int32_t)r.scalinglMode;
+			fields[7] = r.source;
+		}
+
+		static
+		void unpackRegion(const int32_t* fields, RegionConfig* r) {
+			r->index = fields[0];
+			r->x = fields[1];
+			r->y = fields[2];
+			r->width = fields[3];
+			r->height = fields[4];
+			r->zOrder = fields[5];
+			r->scalinglMode = (ScalingMode)fields[6];
+			r->source = fields[7];
+		}
+
+		class InputRecorderImpl : public InputRecorder {
+		private:
+			using Buffer = std::vector<uint8_t>;
+			//单个缓冲区写满这么多后交给写线程
+			static const size_t kChunkSize = 1024 * 1024;
+
+			NLogger::shared				logger_ = nullptr;
+			const size_t				bufferLimit_;
+			FILE*						file_ = nullptr;
+			std::atomic<bool>			running_{ false };
+			std::thread					thread_;
+
+			mutable std::mutex			mutex_;
+			std::condition_variable		cond_;
+			Buffer						current_;		//调用线程追加的缓冲区
+			std::deque<Buffer>			full_;			//等待写入的缓冲区
+			std::vector<Buffer>			spare_;			//写完回收的缓冲区
+			size_t						pendingBytes_ = 0;
+			Stats						stats_;
+
+		public:
+			InputRecorderImpl(const std::string& name, size_t bufferLimit)
+				:logger_(NLogger::Get(name)), bufferLimit_(bufferLimit) {}
+
+			virtual ~InputRecorderImpl() {
+				close();
+			}
+
+			virtual int open(const std::string& path) override {
+				if (running_) {
+					return ALREADY_OPENED_TRANSCODER;
+				}
+
+				file_ = fopen(path.c_str(), "wb");
+				if (!file_) {
+					dbge(logger_, "failed to open capture file, [{}]", path);
+					return FAILED_OPEN_FILE;
+				}
+				fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), file_);
+
+				stats_ = Stats();
+				current_.reserve(kChunkSize);
+				running_ = true;
+				thread_ = std::thread(&InputRecorderImpl::writeLoop, this);
+				dbgi(logger_, "capture started, file=[{}].", path);
+				return 0;
+			}
+
+			virtual void close() override {
+				if (!running_) {
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					running_ = false;
+					if (!current_.empty()) {
+						pendingBytes_ += current_.size();
+						full_.push_back(std::move(current_));
+						current_ = Buffer();
+					}
+				}
+				cond_.notify_all();
+				if (thread_.joinable()) {
+					thread_.join();
+				}
+
+				fclose(file_);
+				file_ = nullptr;
+				dbgi(logger_, "capture stopped, stats=[{}].", stats_.dump());
+			}
+
+			virtual bool isOpened() const override {
+				return running_;
+			}
+
+			virtual void recordConfig(const Transcoder::OutputConfig& cfg) override {
+				int32_t fields[kConfigFields] = {
+					cfg.width,
+					cfg.height,
+					cfg.backgroundColor,
+					cfg.framerate,
+					cfg.bitrate,
+					(int32_t)cfg.outCodecType,
+					cfg.passthrough ? 1 : 0
+				};
+				CaptureRecord rec;
+				rec.type = CaptureRecord::Config;
+				append(rec, (const uint8_t*)fields, sizeof(fields));
+			}
+
+			virtual void recordRegions(const std::vector<RegionConfig>& regions) override {
+				std::vector<int32_t> fields(regions.size() * kRegionFields);
+				for (size_t i = 0; i < regions.size(); ++i) {
+					packRegion(regions[i], &fields[i * kRegionFields]);
+				}
+				CaptureRecord rec;
+				rec.type = CaptureRecord::Regions;
+				append(rec, (const uint8_t*)fields.data(), fields.size() * sizeof(int32_t));
+			}
+
+			virtual void recordRegion(const RegionConfig& region) override {
+				int32_t fields[kRegionFields];
+				packRegion(region, fields);
+				CaptureRecord rec;
+				rec.type = CaptureRecord::Region;
+				rec.index = region.index;
+				append(rec, (const uint8_t*)fields, sizeof(fields));
+			}
+
+			virtual void recordInput(CaptureRecord::Type type, int index, const NVideoFrame* pkt) override {
+				if (!pkt) {
+					return;
+				}
+				CaptureRecord rec;
+				rec.type = type;
+				rec.index = index;
+				rec.codec = pkt->getCodecType();
+				rec.pts = pkt->getPts();
+				append(rec, pkt->data(), pkt->size());
+			}
+
+			virtual void recordTick() override {
+				CaptureRecord rec;
+				rec.type = CaptureRecord::Tick;
+				append(rec, nullptr, 0);
+			}
+
+			virtual Stats getStats() const override {
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+		private:
+			void append(CaptureRecord& rec, const uint8_t* data, size_t size) {
+				if (!running_) {
+					return;
+				}
+
+				rec.arrivalUs = nowUs();
+				rec.size = (uint32_t)size;
+
+				bool wake = false;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (pendingBytes_ + current_.size() + sizeof(rec) + size > bufferLimit_) {
+						++stats_.dropped;
+						return;
+					}
+
+					const uint8_t* head = (const uint8_t*)&rec;
+					current_.insert(current_.end(), head, head + sizeof(rec));
+					if (size > 0) {
+						current_.insert(current_.end(), data, data + size);
+					}
+					++stats_.records;
+
+					if (current_.size() >= kChunkSize) {
+						pendingBytes_ += current_.size();
+						full_.push_back(std::move(current_));
+						if (spare_.empty()) {
+							current_ = Buffer();
+							current_.reserve(kChunkSize);
+						}
+						else {
+							current_ = std::move(spare_.back());
+							spare_.pop_back();
+						}
+						wake = true;
+					}
+				}
+				if (wake) {
+					cond_.notify_one();
+				}
+			}
+
+			void writeLoop() {
+				while (true) {
+					Buffer buf;
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						cond_.wait(lock, [this]() { return !running_ || !full_.empty(); });
+						if (full_.empty()) {
+							break;
+						}
+						buf = std::move(full_.front());
+						full_.pop_front();
+					}
+
+					size_t written = fwrite(buf.data(), 1, buf.size(), file_);
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						pendingBytes_ -= buf.size();
+						stats_.bytes += written;
+						buf.clear();
+						//只保留少量缓冲区复用
+						if (spare_.size() < 4) {
+							spare_.push_back(std::move(buf));
+						}
+					}
+				}
+			}
+		};
+
+		class InputReplayerImpl : public InputReplayer {
+		private:
+			NLogger::shared				logger_ = nullptr;
+			FILE*						file_ = nullptr;
+			std::vector<uint8_t>		data_;
+
+		public:
+			InputReplayerImpl(const std::string& name) :logger_(NLogger::Get(name)) {}
+
+			virtual ~InputReplayerImpl() {
+				close();
+			}
+
+			virtual int open(const std::string& path) override {
+				close();
+
+				file_ = fopen(path.c_str(), "rb");
+				if (!file_) {
+					dbge(logger_, "failed to open capture file, [{}]", path);
+					return FAILED_OPEN_FILE;
+				}
+
+				char magic[sizeof(CAPTURE_MAGIC)] = { 0 };
+				if (fread(magic, 1, sizeof(magic), file_) != sizeof(magic)
+					|| memcmp(magic, CAPTURE_MAGIC, sizeof(magic))) {
+					dbge(logger_, "not a capture file, [{}]", path);
+					close();
+					return FAILED_OPEN_FILE;
+				}
+				return 0;
+			}
+
+			virtual void close() override {
+				if (file_) {
+					fclose(file_);
+					file_ = nullptr;
+				}
+			}
+
+			virtual int next(CaptureRecord* record, const uint8_t** data) override {
+				if (!file_ || fread(record, sizeof(CaptureRecord), 1, file_) != 1) {
+					return -1;
+				}
+
+				//保留解码器读取越界所需的填充
+				data_.resize(record->size + NVideoFrame::kPaddingSize);
+				if (record->size > 0 && fread(data_.data(), 1, record->size, file_) != record->size) {
+					return -1;
+				}
+				memset(data_.data() + record->size, 0, NVideoFrame::kPaddingSize);
+				*data = data_.data();
+				return 0;
+			}
+		};
+
+		int InputReplayer::ParseConfig(const CaptureRecord& record, const uint8_t* data, Transcoder::OutputConfig* cfg) {
+			if (record.size != kConfigFields * sizeof(int32_t)) {
+				return EXTERNAL_PARAM_NOT_VAILD;
+			}
+
+			int32_t fields[kConfigFields];
+			memcpy(fields, data, sizeof(fields));
+			cfg->width = fields[0];
+			cfg->height = fields[1];
+			cfg->backgroundColor = fields[2];
+			cfg->framerate = fields[3];
+			cfg->bitrate = fields[4];
+			cfg->outCodecType = (NCodec::Type)fields[5];
+			cfg->passthrough = (0 != fields[6]);
+			return 0;
+		}
+
+		int InputReplayer::ParseRegions(const CaptureRecord& record, const uint8_t* data, std::vector<RegionConfig>* regions) {
+			const size_t regionSize = kRegionFields * sizeof(int32_t);
+			if (record.size % regionSize) {
+				return EXTERNAL_PARAM_NOT_VAILD;
+			}
+
+			regions->clear();
+			int32_t fields[kRegionFields];
+			for (size_t off = 0; off < record.size; off += regionSize) {
+				memcpy(fields, data + off, regionSize);
+				RegionConfig r;
+				unpackRegion(fields, &r);
+				regions->push_back(r);
+			}
+			return 0;
+		}
+
+		InputRecorder::shared InputRecorder::Create(const std::string& name, size_t bufferLimit) {
+			return std::make_shared<InputRecorderImpl>(name, bufferLimit);
+		}
+
+		InputReplayer::shared InputReplayer::Create(const std::string& name) {
+			return std::make_shared<InputReplayerImpl>(name);
+		}
+	}
+}
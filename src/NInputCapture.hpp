@@ -0,0 +1,130 @@
+#ifndef NInputCapture_hpp
+#define NInputCapture_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "NVideoTranscoder.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//输入录制文件格式
+		//文件头为8字节的CAPTURE_MAGIC，之后是连续的记录，每条记录为CaptureRecord加size字节的数据，字段按本机字节序
+		//除输入包外还记录init/setRegions/addRegion/transcode调用，回放时按原来的调用顺序重现，不需要额外的布局文件
+		static const char CAPTURE_MAGIC[8] = { 'N', 'T', 'C', 'A', 'P', 0, 0, 1 };
+
+		struct CaptureRecord {
+			enum Type : uint32_t {
+				Config = 1,			//init()，数据为OutputConfig
+				Regions,			//setRegions()，数据为RegionConfig数组
+				Region,				//addRegion()，数据为一个RegionConfig
+				Input,				//input()，index为区域编号，数据为输入包
+				InputSource,		//inputSource()，index为源编号，数据为输入包
+				Tick				//transcode()，没有数据
+			};
+
+			uint32_t	type = 0;
+			int32_t		index = -1;
+			int32_t		codec = NCodec::UNKNOWN;
+			uint32_t	size = 0;			//数据长度
+			int64_t		arrivalUs = 0;		//调用时刻，steady_clock，单位微秒
+			int64_t		pts = -1;			//输入包的pts
+		};
+
+		//输入录制：把对Transcoder的调用和输入包写到文件
+		//调用线程只把记录追加到内存缓冲区，写文件在后台线程进行；写文件跟不上时丢弃记录并计数，不阻塞调用线程
+		//通过Transcoder::capture()挂到转码器上，也可以直接调用record*()
+		class InputRecorder {
+		public:
+			using shared = std::shared_ptr<InputRecorder>;
+
+			struct Stats {
+				int64_t records = 0;		//已写入的记录数
+				int64_t bytes = 0;			//已写入的字节数
+				int64_t dropped = 0;		//缓冲区满时丢弃的记录数
+
+				const std::string dump() const {
+					return fmt::format("[records={}, bytes={}, dropped={}]"
+						, records
+						, bytes
+						, dropped);
+				}
+			};
+
+		public:
+			InputRecorder() {}
+
+			virtual ~InputRecorder() {}
+
+			//打开录制文件并启动写线程
+			// 0 : 成功
+			// ALREADY_OPENED_TRANSCODER : 已打开
+			// FAILED_OPEN_FILE : 文件打开失败
+			virtual int open(const std::string& path) = 0;
+
+			//写完缓冲区中的记录并关闭文件
+			virtual void close() = 0;
+
+			virtual bool isOpened() const = 0;
+
+			virtual void recordConfig(const Transcoder::OutputConfig& cfg) = 0;
+
+			virtual void recordRegions(const std::vector<RegionConfig>& regions) = 0;
+
+			virtual void recordRegion(const RegionConfig& region) = 0;
+
+			//type为CaptureRecord::Input或CaptureRecord::InputSource
+			virtual void recordInput(CaptureRecord::Type type, int index, const NVideoFrame* pkt) = 0;
+
+			virtual void recordTick() = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//创建一个InputRecorder实例
+			//bufferLimit : 等待写入的数据上限，超过后丢弃新记录
+			static
+			shared Create(const std::string& name, size_t bufferLimit = 64 * 1024 * 1024);
+		};
+
+		//录制文件读取
+		class InputReplayer {
+		public:
+			using shared = std::shared_ptr<InputReplayer>;
+
+		public:
+			InputReplayer() {}
+
+			virtual ~InputReplayer() {}
+
+			// 0 : 成功
+			// FAILED_OPEN_FILE : 文件打开失败或不是录制文件
+			virtual int open(const std::string& path) = 0;
+
+			virtual void close() = 0;
+
+			//读取下一条记录，数据在下一次调用next()之前有效
+			// 0 : 成功
+			// -1 : 文件结束或记录不完整
+			virtual int next(CaptureRecord* record, const uint8_t** data) = 0;
+
+			//解析Config和Regions/Region记录的数据
+			// 0 : 成功
+			// EXTERNAL_PARAM_NOT_VAILD : 数据长度不符
+			static
+			int ParseConfig(const CaptureRecord& record, const uint8_t* data, Transcoder::OutputConfig* cfg);
+
+			static
+			int ParseRegions(const CaptureRecord& record, const uint8_t* data, std::vector<RegionConfig>* regions);
+
+			//创建一个InputReplayer实例
+			static
+			shared Create(const std::string& name);
+		};
+	}
+}
+
+#endif //NInputCapture_hpp
@@ -0,0 +1,244 @@
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "NJitterBuffer.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+namespace nmedia {
+	namespace video {
+
+		class JitterBufferImpl : public JitterBuffer {
+		private:
+			static const int kJitterGain = 16;		//RFC 3550的抖动平滑系数 1/16
+			static const int kJitterFactor = 3;		//期望延迟为抖动的倍数
+			static const int kShrinkRate = 64;		//目标延迟下降时每帧接近期望值的比例 1/64，上升时立即生效
+			static const int kOffsetDrift = 512;	//最小传输时间向上跟踪的比例，适应时钟漂移和路径变化
+			static const int64_t kNoMediaTime = INT64_MIN;
+
+			struct Entry {
+				NMediaFrame::Unique		frame = NMediaFrame::MakeNullPtr();
+				int64_t					key = 0;
+				int64_t					mediaUs = 0;	//相对第一帧的媒体时间，kNoMediaTime表示没有pts
+			};
+
+			NLogger::shared				logger_ = nullptr;
+			Config						cfg_;
+			FrameFunc					func_ = nullptr;
+			std::vector<Entry>			ring_;
+			int							head_ = 0;
+			int							count_ = 0;
+
+			bool						started_ = false;
+			TimePoint					epoch_;				//第一帧的到达时刻
+			bool						hasBase_ = false;
+			int64_t						basePts_ = 0;		//第一个有pts的帧
+
+			//传输时间 = 到达时间 - 媒体时间
+			bool						hasTransit_ = false;
+			int64_t						lastTransitUs_ = 0;
+			int64_t						offsetUs_ = 0;		//最小传输时间
+			int64_t						jitterUs_ = 0;
+			int64_t						targetUs_ = 0;		//目标延迟
+
+			bool						hasLast_ = false;
+			int64_t						lastKey_ = 0;		//最近释放的键
+			Stats						stats_;
+
+		public:
+			JitterBufferImpl(const std::string& name, const Config& cfg)
+				:logger_(NLogger::Get(name)), cfg_(cfg), ring_(cfg.capacity), targetUs_((int64_t)cfg.minDelayMs * 1000) {}
+
+			virtual ~JitterBufferImpl() {}
+
+			virtual void output(const FrameFunc& func) override {
+				func_ = func;
+			}
+
+			virtual int push(NMediaFrame::Unique frame, int64_t key, TimePoint arrival) override {
+				if (!frame) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				++stats_.frames;
+				if (!started_) {
+					started_ = true;
+					epoch_ = arrival;
+				}
+				int64_t arrivalUs = std::chrono::duration_cast<std::chrono::microseconds>(arrival - epoch_).count();
+
+				int64_t mediaUs = kNoMediaTime;
+				int64_t pts = frame->getPts();
+				if (pts >= 0) {
+					if (!hasBase_) {
+						hasBase_ = true;
+						basePts_ = pts;
+					}
+					mediaUs = (pts - basePts_) * 1000000 / cfg_.clockRate;
+					updateDelay(arrivalUs - mediaUs);
+				}
+
+				if (contains(key)) {
+					++stats_.late;
+					return 0;
+				}
+
+				if (hasLast_ && key <= lastKey_) {
+					++stats_.late;
+					//目标延迟不够，加上这一帧晚到的时间
+					if (kNoMediaTime != mediaUs) {
+						int64_t lateUs = arrivalUs - (mediaUs + offsetUs_ + targetUs_);
+						if (lateUs > 0) {
+							targetUs_ = std::min(targetUs_ + lateUs, (int64_t)cfg_.maxDelayMs * 1000);
+						}
+					}
+					return 0;
+				}
+
+				//确定插入后才提前释放，晚到的帧不会挤掉缓存中的帧
+				//环满时新帧比缓存中的都早，就直接释放它自己
+				if (count_ == cfg_.capacity) {
+					++stats_.overflow;
+					if (key < ring_[head_].key) {
+						emit(std::move(frame), key);
+						return 0;
+					}
+					releaseHead();
+				}
+
+				insert(std::move(frame), key, mediaUs);
+				return 0;
+			}
+
+			virtual int release(TimePoint now) override {
+				int64_t nowUs = started_ ? std::chrono::duration_cast<std::chrono::microseconds>(now - epoch_).count() : 0;
+				int released = 0;
+				while (count_ > 0) {
+					const Entry& e = ring_[head_];
+					if (kNoMediaTime != e.mediaUs && e.mediaUs + offsetUs_ + targetUs_ > nowUs) {
+						break;
+					}
+					releaseHead();
+					++released;
+				}
+				return released;
+			}
+
+			virtual void flush() override {
+				while (count_ > 0) {
+					releaseHead();
+				}
+			}
+
+			virtual const Config& getConfig() const override {
+				return cfg_;
+			}
+
+			virtual Stats getStats() const override {
+				Stats stats = stats_;
+				stats.buffered = count_;
+				stats.delayMs = (int)(targetUs_ / 1000);
+				stats.jitterMs = (int)(jitterUs_ / 1000);
+				return stats;
+			}
+
+		private:
+			Entry& at(int i) {
+				return ring_[(head_ + i) % cfg_.capacity];
+			}
+
+			bool contains(int64_t key) {
+				for (int i = 0; i < count_; ++i) {
+					if (at(i).key == key) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			//按键有序插入，从尾部向前移动，按序到达时不移动
+			void insert(NMediaFrame::Unique frame, int64_t key, int64_t mediaUs) {
+				int pos = count_;
+				while (pos > 0 && at(pos - 1).key > key) {
+					at(pos) = std::move(at(pos - 1));
+					--pos;
+				}
+				Entry& e = at(pos);
+				e.frame = std::move(frame);
+				e.key = key;
+				e.mediaUs = mediaUs;
+				++count_;
+			}
+
+			void releaseHead() {
+				Entry& e = ring_[head_];
+				NMediaFrame::Unique frame = std::move(e.frame);
+				int64_t key = e.key;
+				head_ = (head_ + 1) % cfg_.capacity;
+				--count_;
+				emit(std::move(frame), key);
+			}
+
+			void emit(NMediaFrame::Unique frame, int64_t key) {
+				if (hasLast_) {
+					stats_.lost += missing(lastKey_, key);
+				}
+				hasLast_ = true;
+				lastKey_ = key;
+
+				++stats_.released;
+				if (func_) {
+					func_(std::move(frame));
+				}
+			}
+
+			//两个相邻释放的键之间缺失的帧数
+			int64_t missing(int64_t from, int64_t to) const {
+				if (Key::Sequence == cfg_.key) {
+					return std::max<int64_t>(to - from - 1, 0);
+				}
+				if (0 == cfg_.framerate) {
+					return 0;
+				}
+				double frames = (double)(to - from) * cfg_.framerate / cfg_.clockRate;
+				return std::max<int64_t>(llround(frames) - 1, 0);
+			}
+
+			//用一帧的传输时间更新抖动估计和目标延迟
+			void updateDelay(int64_t transitUs) {
+				if (!hasTransit_) {
+					hasTransit_ = true;
+					lastTransitUs_ = transitUs;
+					offsetUs_ = transitUs;
+				}
+
+				int64_t d = transitUs - lastTransitUs_;
+				jitterUs_ += ((d < 0 ? -d : d) - jitterUs_) / kJitterGain;
+				lastTransitUs_ = transitUs;
+
+				if (transitUs < offsetUs_) {
+					offsetUs_ = transitUs;
+				}
+				else {
+					offsetUs_ += (transitUs - offsetUs_) / kOffsetDrift;
+				}
+
+				int64_t desired = std::min(std::max(kJitterFactor * jitterUs_, (int64_t)cfg_.minDelayMs * 1000), (int64_t)cfg_.maxDelayMs * 1000);
+				if (desired > targetUs_) {
+					targetUs_ = desired;
+				}
+				else {
+					targetUs_ -= (targetUs_ - desired) / kShrinkRate;
+				}
+			}
+		};
+
+		JitterBuffer::shared JitterBuffer::Create(const std::string& name, const Config& cfg) {
+			if (!cfg.vaild()) {
+				return nullptr;
+			}
+			return std::make_shared<JitterBufferImpl>(name, cfg);
+		}
+	}
+}
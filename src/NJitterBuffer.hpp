@@ -0,0 +1,114 @@
+#ifndef NJitterBuffer_hpp
+#define NJitterBuffer_hpp
+
+#include <memory>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include "NMediaFrame.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//抖动缓冲：按键（帧序号或pts）重排输入帧，按播放时间释放，吸收乱序和突发到达
+		//播放时间 = 帧的媒体时间 + 最小传输时间 + 目标延迟，目标延迟按到达抖动自适应，在[minDelayMs, maxDelayMs]内调整
+		//帧存放在固定容量的环中，只移动Unique指针，缓冲期间不分配内存；环满时提前释放最早的帧
+		//不是线程安全的，push()和release()应在同一线程调用（转码器中为调用transcode()的线程）
+		class JitterBuffer {
+		public:
+			using shared = std::shared_ptr<JitterBuffer>;
+			using Clock = std::chrono::steady_clock;
+			using TimePoint = Clock::time_point;
+			//按键的顺序输出释放的帧
+			using FrameFunc = std::function<void(NMediaFrame::Unique frame)>;
+
+			//键的含义，决定如何判断缺失的帧
+			enum class Key {
+				Pts = 0,		//键为pts，按framerate推算缺失的帧数，framerate为0时不统计丢失
+				Sequence		//键为连续递增的帧序号，缺口即丢失
+			};
+
+			static const char* GetNameFor(Key key) {
+				switch (key) {
+				case Key::Pts:			return "pts";
+				case Key::Sequence:		return "sequence";
+				default:				return "unknown";
+				}
+			}
+
+			struct Config {
+				Key key = Key::Pts;
+				int capacity = 32;				//环中最多缓存的帧数
+				int minDelayMs = 0;
+				int maxDelayMs = 200;			//0表示不使用抖动缓冲（见Transcoder::setJitterBuffer()）
+				int framerate = 0;				//输入帧率，Key::Pts时用于统计丢失
+				int clockRate = 90000;			//pts的时钟频率
+
+				bool vaild() const {
+					return (0 < capacity && capacity <= 1024)
+						&& (0 <= minDelayMs && minDelayMs <= maxDelayMs)
+						&& (0 < maxDelayMs)
+						&& (0 <= framerate)
+						&& (0 < clockRate);
+				}
+			};
+
+			struct Stats {
+				int64_t frames = 0;			//输入的帧
+				int64_t released = 0;		//释放的帧
+				int64_t late = 0;			//晚于已释放的帧或与缓存中的帧重复，丢弃
+				int64_t lost = 0;			//释放时跳过的缺失帧
+				int64_t overflow = 0;		//环满而提前释放的帧
+				int buffered = 0;			//当前缓存的帧数
+				int delayMs = 0;			//当前目标延迟
+				int jitterMs = 0;			//到达抖动估计（RFC 3550）
+
+				const std::string dump() const {
+					return fmt::format("[frames={}, released={}, late={}, lost={}, overflow={}, buffered={}, delay={}ms, jitter={}ms]"
+						, frames
+						, released
+						, late
+						, lost
+						, overflow
+						, buffered
+						, delayMs
+						, jitterMs);
+				}
+			};
+
+		public:
+			JitterBuffer() {}
+
+			virtual ~JitterBuffer() {}
+
+			//设置帧释放回调，在push()（环满时）、release()和flush()中调用
+			virtual void output(const FrameFunc& func) = 0;
+
+			//缓存一帧，key为帧序号或pts（见Config::key），arrival为到达时刻
+			//pts小于0的帧没有媒体时间，在下一次release()时按序释放
+			// 0 : 成功（晚到或重复的帧被丢弃，见Stats）
+			// EXTERNAL_PARAM_NOT_VAILD : frame为空
+			virtual int push(NMediaFrame::Unique frame, int64_t key, TimePoint arrival) = 0;
+
+			//释放所有播放时间不晚于now的帧，返回释放的帧数
+			virtual int release(TimePoint now) = 0;
+
+			//按序释放所有缓存的帧
+			virtual void flush() = 0;
+
+			virtual const Config& getConfig() const = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//创建一个JitterBuffer实例
+			// nullptr : cfg参数不可用
+			static
+			shared Create(const std::string& name, const Config& cfg);
+		};
+	}
+}
+
+#endif //NJitterBuffer_hpp
@@ -12,6 +12,16 @@
 #define strcasecmp stricmp
 #endif
 
+// scatter/gather element, the system struct iovec where there is one
+#ifdef _WIN32
+struct iovec {
+    void *      iov_base;
+    size_t      iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 // see https://www.iana.org/assignments/media-types/media-types.xhtml
 class NMedia{
 public:
@@ -293,7 +303,7 @@ public:
     // return >0, bytes read
     // return =0, reach file end
     // return <0, error
-    virtual unsigned int next() = 0;
+    virtual int next() = 0;
     
     virtual uint8_t * data() = 0;
     
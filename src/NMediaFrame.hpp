@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <deque>
 #include <cassert>
+#include <algorithm>
 #include "NPool.hpp"
 #include "NMediaBasic.hpp"
 
@@ -29,6 +30,11 @@ struct NIData{
     NIData():NIData(nullptr, 0){}
 };
 
+// Growth: a buffer that runs out of space grows by half its capacity, at least
+// capacity_step_, rounded up to capacity_step_, so appending amortizes to O(1)
+// copies per element. New storage is left uninitialized (T is trivial here).
+// Headroom: clear() leaves setHeadroom() elements free in front of the data, so
+// prepend() of headers up to that size needs neither a memmove nor a reallocation.
 template <typename T>
 class NBuffer {
 public:
@@ -99,6 +105,11 @@ public:
         return size_;
     }
     
+    // bytes allocated, including the space in front of data()
+    size_t allocatedSize() const {
+        return capacity_ * sizeof(T);
+    }
+    
 //    size_t capacity() const {
 //        return capacity_-pos_;
 //    }
@@ -147,7 +158,19 @@ public:
         if(pos_ >= reserved){
             return;
         }
-        EnsureCapacity(reserved, size_);
+        EnsureCapacity(std::max(reserved, headroom_), size_);
+    }
+    
+    // elements kept free in front of the data for prepend(), applied now if empty and on clear()
+    void setHeadroom(size_t headroom){
+        headroom_ = headroom;
+        if(0 == size_){
+            EnsureCapacity(headroom_, 0);
+        }
+    }
+    
+    size_t headroom() const {
+        return pos_;
     }
 
     void prepend(const T* data, size_t size){
@@ -162,6 +185,8 @@ public:
         capacity_ = buf.capacity_;
         data_ = std::move(buf.data_);
         pos_ = buf.pos_;
+        headroom_ = buf.headroom_;
+        capacity_step_ = buf.capacity_step_;
     }
     
 //    void SetSize(size_t size) {
@@ -173,6 +198,7 @@ public:
     
     void clear() {
         size_ = 0;
+        pos_ = headroom_ <= capacity_ ? headroom_ : 0;
     }
     
     friend void swap(NBuffer& a, NBuffer& b) {
@@ -181,6 +207,8 @@ public:
         swap(a.capacity_, b.capacity_);
         swap(a.data_, b.data_);
         swap(a.pos_, b.pos_);
+        swap(a.capacity_step_, b.capacity_step_);
+        swap(a.headroom_, b.headroom_);
     }
     
 protected:
@@ -212,12 +240,14 @@ protected:
             return;
         }
         
-        const size_t multi = (new_capacity + capacity_step_-1) / capacity_step_ ;
-        new_capacity = multi * capacity_step_;
+        const size_t step = capacity_step_ > 0 ? capacity_step_ : DEFAULT_CAPACITY;
+        new_capacity = std::max(new_capacity, capacity_ + std::max(capacity_ / 2, step));
+        new_capacity = (new_capacity + step - 1) / step * step;
         
+        // default-initialized, no zeroing
         std::unique_ptr<T[]> new_data(new T[new_capacity]);
         if(size_ > 0){
-            std::memcpy(new_data.get()+new_pos, data(), size_);
+            std::memcpy(new_data.get()+new_pos, data(), size_ * sizeof(T));
         }
         data_ = std::move(new_data);
         capacity_ = new_capacity;
@@ -230,6 +260,7 @@ protected:
     std::unique_ptr<T[]> data_;
     size_t capacity_step_ = DEFAULT_CAPACITY;
     size_t pos_ = 0;
+    size_t headroom_ = 0;
 };
 
 
@@ -243,7 +274,7 @@ public:
 
     NMediaFrame(size_t capacity, size_t step_capacity=1024
                 , NMedia::Type mtype = NMedia::Unknown, NCodec::Type ctype = NCodec::UNKNOWN)
-    :NBuffer(capacity),  mediaType_(mtype), codecType_(ctype) {
+    :NBuffer(capacity, step_capacity),  mediaType_(mtype), codecType_(ctype) {
     }
     
     virtual ~NMediaFrame(){
@@ -337,7 +368,12 @@ public:
     static const size_t kStartCapacity = 1700;
     static const size_t kStepCapacity = 1*1024;
     class Pool : public NPool<NAudioFrame, NMediaFrame>{
-        
+    public:
+        Pool() {
+            this->setSizer([](const NMediaFrame* frame) {
+                return frame->allocatedSize();
+            });
+        }
     };
 public:
     NAudioFrame():NAudioFrame(NCodec::UNKNOWN){}
@@ -350,11 +386,29 @@ class NVideoFrame : public NMediaFrame{
 public:
     static const size_t kStartCapacity = 30*1024;
     static const size_t kStepCapacity = 30*1024;
+    // zeroed bytes kept after the data for decoders reading ahead, same as AV_INPUT_BUFFER_PADDING_SIZE
+    static const size_t kPaddingSize = 64;
     class Pool : public NPool<NVideoFrame, NMediaFrame>{
-        
+    public:
+        Pool() {
+            this->setSizer([](const NMediaFrame* frame) {
+                return frame->allocatedSize();
+            });
+        }
+    };
+    // for frames taken and released on different threads
+    class ConcurrentPool : public NConcurrentPool<NVideoFrame, NMediaFrame>{
+    public:
+        ConcurrentPool() {
+            this->setSizer([](const NMediaFrame* frame) {
+                return frame->allocatedSize();
+            });
+        }
     };
 private:
     NVideoSize size_;
+    bool keyframe_ = false;
+    int temporalId_ = -1;
 public:
     NVideoFrame():NVideoFrame(NCodec::UNKNOWN){}
     NVideoFrame(NCodec::Type ctype) : NMediaFrame(kStartCapacity, kStepCapacity, NMedia::Video){
@@ -362,7 +416,7 @@ public:
     }
     
     virtual bool isKeyframe(){
-        return false;
+        return keyframe_;
     };
     
     virtual const NVideoSize& videoSize() {
@@ -372,11 +426,39 @@ public:
     virtual int64_t pictureId() {
         return -1;
     };
+    
+    // -1 if unknown, 0 for base layer
+    virtual int temporalId() {
+        return temporalId_;
+    };
 
     void setSize(const NVideoSize& size) {
         size_ = size;
     }
     
+    void setKeyframe(bool keyframe) {
+        keyframe_ = keyframe;
+    }
+    
+    void setTemporalId(int tid) {
+        temporalId_ = tid;
+    }
+    
+    // set data size to size (keeping existing content) and return the data
+    // for writing in place, e.g. fread() straight into a pooled frame
+    uint8_t * resize(size_t size) {
+        EnsureCapacity(pos_, size + kPaddingSize);
+        NBuffer::size_ = size;
+        ensurePadding();
+        return data();
+    }
+    
+    // make sure kPaddingSize zeroed bytes follow the data
+    void ensurePadding() {
+        EnsureCapacity(pos_, NBuffer::size_ + kPaddingSize);
+        std::memset(data() + NBuffer::size_, 0, kPaddingSize);
+    }
+    
     // return true if first unit
     bool first()const{
         return true;
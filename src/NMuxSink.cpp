@@ -0,0 +1,316 @@
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "NMuxSink.hpp"
+#include "NVideoInspector.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+#include "libavutil/dict.h"
+#include "libavutil/mathematics.h"
+}
+
+namespace nmedia {
+	namespace video {
+
+		class MuxSinkImpl : public MuxSink {
+		private:
+			using Clock = std::chrono::steady_clock;
+			//AVIOContext的缓冲区，封装器按块输出到OutputSink
+			static const int kIOBufferSize = 64 * 1024;
+			//封装器内部的时间基
+			static const AVRational kTimebase;
+
+			NLogger::shared				logger_ = nullptr;
+			Config						cfg_;
+			OutputSink::shared			sink_ = nullptr;
+			AVFormatContext*			fmtCtx_ = nullptr;
+			AVIOContext*				ioCtx_ = nullptr;
+			AVStream*					stream_ = nullptr;
+			AVPacket*					pkt_ = nullptr;
+			bool						headerWritten_ = false;
+
+			//本次write()中封装器是否输出了数据，输出即一个分片完成
+			bool						emitted_ = false;
+			Clock::time_point			pendingSince_;		//尚未输出的第一个包的进入时刻
+			bool						pending_ = false;
+			Stats						stats_;
+
+		public:
+			MuxSinkImpl(const std::string& name) :logger_(NLogger::Get(name)) {}
+
+			virtual ~MuxSinkImpl() {
+				close();
+			}
+
+			virtual int open(const std::string& path, const Config& cfg) override {
+				if (isOpened()) {
+					return ALREADY_OPENED_TRANSCODER;
+				}
+
+				if (!cfg.vaild()) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				cfg_ = cfg;
+				if (Container::Auto == cfg_.container) {
+					cfg_.container = (NCodec::VP8 == cfg_.codec) ? Container::IVF : Container::FMP4;
+				}
+				if (Container::IVF == cfg_.container && NCodec::VP8 != cfg_.codec) {
+					dbge(logger_, "ivf only carries vp8.");
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				OutputSink::Config sinkCfg = cfg_.sink;
+				sinkCfg.framing = OutputSink::Framing::Raw;
+				sink_ = OutputSink::Create("mux-output");
+				int ret = sink_->open(path, sinkCfg);
+				if (ret < 0) {
+					sink_ = nullptr;
+					return ret;
+				}
+
+				ret = initMuxer();
+				if (ret < 0) {
+					close();
+					return ret;
+				}
+
+				stats_ = Stats();
+				dbgi(logger_, "mux sink opened, file=[{}], container=[{}].", path, GetNameFor(cfg_.container));
+				return 0;
+			}
+
+			virtual void close() override {
+				if (fmtCtx_) {
+					if (headerWritten_) {
+						emitted_ = false;
+						av_write_trailer(fmtCtx_);
+						avio_flush(ioCtx_);
+						onEmitted();
+					}
+					avformat_free_context(fmtCtx_);
+					fmtCtx_ = nullptr;
+					stream_ = nullptr;
+				}
+
+				if (ioCtx_) {
+					av_freep(&ioCtx_->buffer);
+					avio_context_free(&ioCtx_);
+				}
+
+				if (pkt_) {
+					av_packet_free(&pkt_);
+				}
+
+				if (sink_) {
+					sink_->close();
+					stats_.sink = sink_->getStats();
+					sink_ = nullptr;
+					dbgi(logger_, "mux sink closed, stats=[{}].", stats_.dump());
+				}
+
+				headerWritten_ = false;
+				pending_ = false;
+			}
+
+			virtual bool isOpened() const override {
+				return nullptr != fmtCtx_;
+			}
+
+			virtual int write(const EncodedPacket::shared& pkt) override {
+				if (!isOpened()) {
+					return NOT_OPENED_TRANSCODER;
+				}
+
+				if (!pkt) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				//从第一个关键帧开始，MP4的文件头需要其中的SPS/PPS
+				if (!headerWritten_) {
+					if (!pkt->isKeyframe()) {
+						++stats_.skipped;
+						return 0;
+					}
+					if (writeHeader(*pkt) < 0) {
+						++stats_.errors;
+						return ERROR_ENCODE_VIDEO;
+					}
+				}
+
+				Clock::time_point now = Clock::now();
+				if (!pending_) {
+					pendingSince_ = now;
+					pending_ = true;
+				}
+
+				//包数据只被引用，不拷贝；非引用计数的包封装器不会保留
+				av_init_packet(pkt_);
+				pkt_->data = const_cast<uint8_t*>(pkt->data());
+				pkt_->size = (int)pkt->size();
+				pkt_->stream_index = stream_->index;
+				pkt_->flags = pkt->isKeyframe() ? AV_PKT_FLAG_KEY : 0;
+				AVRational tb = { pkt->timebaseNum(), pkt->timebaseDen() };
+				pkt_->pts = av_rescale_q(pkt->pts(), tb, stream_->time_base);
+				pkt_->dts = av_rescale_q(pkt->dts(), tb, stream_->time_base);
+				pkt_->duration = av_rescale_q(pkt->duration(), tb, stream_->time_base);
+
+				emitted_ = false;
+				int ret = av_write_frame(fmtCtx_, pkt_);
+				if (ret < 0) {
+					++stats_.errors;
+					return ERROR_ENCODE_VIDEO;
+				}
+				++stats_.packets;
+				if (emitted_) {
+					onEmitted();
+					//MP4在新分片的第一个包到来时输出上一个分片，这个包留在新分片中
+					if (Container::FMP4 == cfg_.container) {
+						pendingSince_ = now;
+						pending_ = true;
+					}
+				}
+				return 0;
+			}
+
+			virtual Stats getStats() const override {
+				Stats stats = stats_;
+				if (sink_) {
+					stats.sink = sink_->getStats();
+				}
+				return stats;
+			}
+
+			virtual Transcoder::PacketFunc packetFunc() override {
+				return [this](const EncodedPacket::shared& pkt) {
+					write(pkt);
+				};
+			}
+
+		private:
+			//AVIOContext的写回调
+			static int writePacket(void* opaque, uint8_t* buf, int size) {
+				MuxSinkImpl* self = static_cast<MuxSinkImpl*>(opaque);
+				self->emitted_ = true;
+				return self->sink_->write(buf, size) < 0 ? AVERROR(EIO) : size;
+			}
+
+			int initMuxer() {
+				const char* format = (Container::IVF == cfg_.container) ? "ivf" : "mp4";
+				if (avformat_alloc_output_context2(&fmtCtx_, nullptr, format, nullptr) < 0 || !fmtCtx_) {
+					dbge(logger_, "failed to alloc {} muxer.", format);
+					return FAILED_INIT_ENCODER;
+				}
+
+				uint8_t* buffer = (uint8_t*)av_malloc(kIOBufferSize);
+				ioCtx_ = avio_alloc_context(buffer, kIOBufferSize, 1, this, nullptr, &MuxSinkImpl::writePacket, nullptr);
+				if (!ioCtx_) {
+					av_free(buffer);
+					return FAILED_INIT_ENCODER;
+				}
+				//输出不可回写，MP4必须分片，IVF的帧数在文件头中保持为0
+				ioCtx_->seekable = 0;
+				fmtCtx_->pb = ioCtx_;
+				fmtCtx_->flags |= AVFMT_FLAG_CUSTOM_IO | AVFMT_FLAG_FLUSH_PACKETS;
+
+				stream_ = avformat_new_stream(fmtCtx_, nullptr);
+				if (!stream_) {
+					return FAILED_INIT_ENCODER;
+				}
+				stream_->time_base = kTimebase;
+				stream_->avg_frame_rate = { cfg_.framerate, 1 };
+				AVCodecParameters* par = stream_->codecpar;
+				par->codec_type = AVMEDIA_TYPE_VIDEO;
+				par->codec_id = (NCodec::VP8 == cfg_.codec) ? AV_CODEC_ID_VP8 : AV_CODEC_ID_H264;
+				par->width = cfg_.width;
+				par->height = cfg_.height;
+				par->format = AV_PIX_FMT_YUV420P;
+
+				pkt_ = av_packet_alloc();
+				return pkt_ ? 0 : FAILED_INIT_ENCODER;
+			}
+
+			//H264把关键帧中的SPS/PPS（Annex-B）作为extradata，封装器转换为avcC
+			int setExtradata(const EncodedPacket& pkt) {
+				const uint8_t* begin = pkt.data();
+				const uint8_t* end = begin + pkt.size();
+				std::vector<uint8_t> extradata;
+				const uint8_t* sc = NVideoInspector::FindStartCode(begin, end);
+				while (sc < end) {
+					const uint8_t* nal = sc + 3;
+					const uint8_t* next = NVideoInspector::FindStartCode(nal, end);
+					//去掉下一个4字节起始码的前导0
+					const uint8_t* nalEnd = (next < end && next > nal && next[-1] == 0) ? next - 1 : next;
+					int type = (nal < end) ? (nal[0] & 0x1f) : 0;
+					if (7 == type || 8 == type) {
+						static const uint8_t kStartCode[4] = { 0, 0, 0, 1 };
+						extradata.insert(extradata.end(), kStartCode, kStartCode + 4);
+						extradata.insert(extradata.end(), nal, nalEnd);
+					}
+					sc = next;
+				}
+				if (extradata.empty()) {
+					dbge(logger_, "no sps/pps in the first keyframe.");
+					return -1;
+				}
+
+				AVCodecParameters* par = stream_->codecpar;
+				par->extradata = (uint8_t*)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+				if (!par->extradata) {
+					return -1;
+				}
+				memcpy(par->extradata, extradata.data(), extradata.size());
+				par->extradata_size = (int)extradata.size();
+				return 0;
+			}
+
+			int writeHeader(const EncodedPacket& pkt) {
+				AVDictionary* opts = nullptr;
+				if (Container::FMP4 == cfg_.container) {
+					if (setExtradata(pkt) < 0) {
+						return -1;
+					}
+					//每个关键帧开始新分片，分片时长不超过fragmentMs
+					av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+					av_dict_set_int(&opts, "frag_duration", (int64_t)cfg_.fragmentMs * 1000, 0);
+				}
+
+				emitted_ = false;
+				int ret = avformat_write_header(fmtCtx_, &opts);
+				av_dict_free(&opts);
+				if (ret < 0) {
+					dbge(logger_, "failed to write {} header, ret=[{}].", GetNameFor(cfg_.container), ret);
+					return -1;
+				}
+				avio_flush(ioCtx_);
+				headerWritten_ = true;
+				return 0;
+			}
+
+			//一个分片已输出
+			void onEmitted() {
+				if (!emitted_ || !pending_) {
+					return;
+				}
+				++stats_.fragments;
+				int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - pendingSince_).count();
+				stats_.maxFragmentMs = std::max(stats_.maxFragmentMs, ms);
+				pending_ = false;
+			}
+		};
+
+		const AVRational MuxSinkImpl::kTimebase = { 1, 90000 };
+
+		MuxSink::shared MuxSink::Create(const std::string& name) {
+			return std::make_shared<MuxSinkImpl>(name);
+		}
+	}
+}
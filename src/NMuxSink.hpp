@@ -0,0 +1,120 @@
+#ifndef NMuxSink_hpp
+#define NMuxSink_hpp
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "NVideoTranscoder.hpp"
+#include "NOutputSink.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//封装输出：把编码包直接封装为可播放的文件，不需要再用ffmpeg进程转封装
+		//VP8写IVF，H264写分片MP4（empty_moov，每个关键帧或每fragmentMs开始一个新分片），写入过程中文件即可读取播放
+		//封装器通过自定义AVIOContext输出，数据进入OutputSink预分配的缓冲区，由其后台线程写文件
+		class MuxSink {
+		public:
+			using shared = std::shared_ptr<MuxSink>;
+
+			enum class Container {
+				Auto = 0,		//VP8为IVF，H264为FMP4
+				IVF,
+				FMP4
+			};
+
+			static const char* GetNameFor(Container container) {
+				switch (container) {
+				case Container::Auto:	return "auto";
+				case Container::IVF:	return "ivf";
+				case Container::FMP4:	return "fmp4";
+				default:				return "unknown";
+				}
+			}
+
+			struct Config {
+				Container container = Container::Auto;
+				NCodec::Type codec = NCodec::Type::UNKNOWN;
+				int width = -1;
+				int height = -1;
+				int framerate = -1;
+				int fragmentMs = 1000;				//FMP4分片的最大时长，决定写入中的文件落后多久
+				OutputSink::Config sink;			//framing不使用，总是Raw
+
+				bool vaild() const {
+					return (0 < width)
+						&& (0 < height)
+						&& (0 < framerate)
+						&& (0 < fragmentMs)
+						&& (NCodec::Type::H264 == codec || NCodec::Type::VP8 == codec)
+						&& sink.vaild();
+				}
+
+				//按转码器的输出参数填写
+				static Config From(const Transcoder::OutputConfig& out) {
+					Config cfg;
+					cfg.codec = out.outCodecType;
+					cfg.width = out.width;
+					cfg.height = out.height;
+					cfg.framerate = out.framerate;
+					return cfg;
+				}
+			};
+
+			struct Stats {
+				int64_t packets = 0;		//封装的包数
+				int64_t skipped = 0;		//第一个关键帧之前跳过的包数
+				int64_t errors = 0;			//封装失败的包数
+				int64_t fragments = 0;		//输出的分片数，IVF每包一个
+				int64_t maxFragmentMs = 0;	//包从进入到随分片输出的最大延迟
+				OutputSink::Stats sink;
+
+				const std::string dump() const {
+					return fmt::format("[packets={}, skipped={}, errors={}, fragments={}, maxFragment={}ms, sink={}]"
+						, packets
+						, skipped
+						, errors
+						, fragments
+						, maxFragmentMs
+						, sink.dump());
+				}
+			};
+
+		public:
+			MuxSink() {}
+
+			virtual ~MuxSink() {}
+
+			//打开输出文件，文件头在收到第一个关键帧时写出（MP4需要从中取得SPS/PPS）
+			// 0 : 成功
+			// ALREADY_OPENED_TRANSCODER : 已打开
+			// EXTERNAL_PARAM_NOT_VAILD : cfg参数不可用
+			// FAILED_OPEN_FILE : 文件打开失败
+			virtual int open(const std::string& path, const Config& cfg) = 0;
+
+			//写出剩余的分片和文件尾，关闭文件
+			virtual void close() = 0;
+
+			virtual bool isOpened() const = 0;
+
+			//封装一个编码包，不拷贝包数据
+			// 0 : 成功
+			// NOT_OPENED_TRANSCODER : 未打开
+			// ERROR_ENCODE_VIDEO : 封装失败
+			virtual int write(const EncodedPacket::shared& pkt) = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//接到Transcoder::outputPacket()的回调
+			virtual Transcoder::PacketFunc packetFunc() = 0;
+
+			//创建一个MuxSink实例
+			static
+			shared Create(const std::string& name);
+		};
+	}
+}
+
+#endif //NMuxSink_hpp
@@ -0,0 +1,328 @@
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+
+#include "NOutputClock.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#endif
+
+namespace nmedia {
+	namespace video {
+
+		//CLOCK_MONOTONIC当前时刻，与steady_clock同一时基
+		static
+		inline int64_t monotonicNs() {
+#ifdef _WIN32
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+		}
+
+		//按绝对时间睡眠到ns，被信号打断时继续睡眠
+		static
+		inline void sleepUntilNs(int64_t ns) {
+#ifdef _WIN32
+			std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns)));
+#else
+			struct timespec ts;
+			ts.tv_sec = ns / 1000000000LL;
+			ts.tv_nsec = ns % 1000000000LL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+			}
+#endif
+		}
+
+		class OutputClockImpl : public OutputClock {
+		private:
+			//时间轮：每个槽1ms，256个槽，超过一圈的定时器记录剩余圈数
+			static const int64_t kSlotNs = 1000000LL;
+			static const int64_t kSlots = 256;
+			//一次最长睡眠时间，新增的定时器最多因此晚这么久开始
+			static const int64_t kMaxSleepNs = 10 * kSlotNs;
+
+			struct Timer {
+				using shared = std::shared_ptr<Timer>;
+
+				int					id = -1;
+				int					framerate = 0;
+				Policy				policy = Policy::Skip;
+				TickFunc			func;
+				int64_t				startNs = 0;		//序号0的截止时间减一帧
+				int64_t				tick = 0;			//下一次回调的序号
+				int64_t				rounds = 0;			//在时间轮上还需经过的圈数
+				std::atomic<bool>	removed{ false };
+				TimerStats			stats;
+
+				//序号n的截止时间
+				int64_t deadlineOf(int64_t n) const {
+					return startNs + (n + 1) * 1000000000LL / framerate;
+				}
+			};
+
+		private:
+			NLogger::shared								logger_ = nullptr;
+			std::atomic<bool>							running_{ false };
+			std::thread									thread_;
+
+			std::mutex									mutex_;
+			std::condition_variable						cond_;
+			std::map<int, Timer::shared>				timers_;
+			std::vector<std::vector<Timer::shared>>		wheel_;
+			int64_t										cursor_ = 0;		//下一个要处理的槽
+			int											nextId_ = 0;
+
+			//回调期间持有，removeTimer()借此等待进行中的回调结束
+			std::mutex									fireMutex_;
+
+		public:
+			OutputClockImpl(const std::string& name) :logger_(NLogger::Get(name)), wheel_(kSlots) {}
+
+			virtual ~OutputClockImpl() {
+				stop();
+			}
+
+			virtual int start() override {
+				if (running_) {
+					return ALREADY_OPENED_TRANSCODER;
+				}
+
+				size_t timers = 0;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					timers = timers_.size();
+					//停止期间的截止时间都已错过，从当前时刻重新计时
+					int64_t now = monotonicNs();
+					cursor_ = now / kSlotNs;
+					for (auto& s : wheel_) {
+						s.clear();
+					}
+					for (auto& t : timers_) {
+						t.second->startNs = now;
+						t.second->tick = 0;
+						insert(t.second);
+					}
+				}
+
+				running_ = true;
+				thread_ = std::thread(&OutputClockImpl::clockLoop, this);
+				dbgi(logger_, "output clock started, timers=[{}].", timers);
+				return 0;
+			}
+
+			virtual void stop() override {
+				if (!running_) {
+					return;
+				}
+
+				//持锁修改，否则可能落在clockLoop检查条件和进入等待之间，唤醒丢失
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					running_ = false;
+				}
+				cond_.notify_all();
+				if (thread_.joinable()) {
+					thread_.join();
+				}
+			}
+
+			virtual int addTimer(int framerate, Policy policy, const TickFunc& func) override {
+				if (framerate <= 0 || framerate > 1000 || !func) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				Timer::shared t = std::make_shared<Timer>();
+				t->framerate = framerate;
+				t->policy = policy;
+				t->func = func;
+				t->startNs = monotonicNs();
+				t->stats.framerate = framerate;
+				t->stats.policy = policy;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					//时钟线程空闲时不推进cursor_，加入第一个定时器前先对齐到当前时刻
+					if (timers_.empty()) {
+						cursor_ = std::max(cursor_, t->startNs / kSlotNs);
+					}
+					t->id = nextId_++;
+					t->stats.id = t->id;
+					timers_[t->id] = t;
+					if (running_) {
+						insert(t);
+					}
+				}
+				cond_.notify_all();
+				return t->id;
+			}
+
+			virtual int removeTimer(int timerId) override {
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					auto search = timers_.find(timerId);
+					if (search == timers_.end()) {
+						return PARAM_NOT_EXISTS;
+					}
+					//时间轮中的引用在经过时丢弃
+					search->second->removed = true;
+					timers_.erase(search);
+				}
+
+				//在回调中移除自己时不能等待
+				if (std::this_thread::get_id() != thread_.get_id()) {
+					std::lock_guard<std::mutex> wait(fireMutex_);
+				}
+				return 0;
+			}
+
+			virtual int getTimerStats(int timerId, TimerStats* stats) override {
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto search = timers_.find(timerId);
+				if (search == timers_.end()) {
+					return PARAM_NOT_EXISTS;
+				}
+				*stats = search->second->stats;
+				return 0;
+			}
+
+		private:
+			//把定时器放到下一次截止时间所在的槽，持有mutex_时调用
+			//槽k在时刻(k+1)*kSlotNs之后处理，因此回调不会早于截止时间，最多晚一个槽
+			void insert(const Timer::shared& t) {
+				int64_t slot = std::max(t->deadlineOf(t->tick) / kSlotNs, cursor_);
+				t->rounds = (slot - cursor_) / kSlots;
+				wheel_[slot % kSlots].push_back(t);
+			}
+
+			//下一次需要醒来的时刻，持有mutex_时调用
+			int64_t nextWakeNs(int64_t now) const {
+				int64_t limit = std::min(now + kMaxSleepNs, (cursor_ + kSlots) * kSlotNs);
+				for (int64_t slot = cursor_; (slot + 1) * kSlotNs < limit; ++slot) {
+					for (auto& t : wheel_[slot % kSlots]) {
+						if (0 == t->rounds && !t->removed) {
+							return (slot + 1) * kSlotNs;
+						}
+					}
+				}
+				return limit;
+			}
+
+			void clockLoop() {
+				std::vector<Timer::shared> due;
+
+				while (running_) {
+					int64_t wakeNs = 0;
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						if (timers_.empty()) {
+							cond_.wait(lock, [this]() { return !running_ || !timers_.empty(); });
+							continue;
+						}
+						wakeNs = nextWakeNs(monotonicNs());
+					}
+
+					sleepUntilNs(wakeNs);
+
+					int64_t now = monotonicNs();
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						//处理所有已结束的槽
+						while ((cursor_ + 1) * kSlotNs <= now) {
+							std::vector<Timer::shared>& bucket = wheel_[cursor_ % kSlots];
+							std::vector<Timer::shared> keep;
+							for (auto& t : bucket) {
+								if (t->removed) {
+									continue;
+								}
+								if (t->rounds > 0) {
+									--t->rounds;
+									keep.push_back(t);
+								}
+								else {
+									due.push_back(t);
+								}
+							}
+							bucket.swap(keep);
+							++cursor_;
+						}
+					}
+
+					if (due.empty()) {
+						continue;
+					}
+
+					{
+						std::lock_guard<std::mutex> fire(fireMutex_);
+						for (auto& t : due) {
+							fireTimer(t);
+						}
+					}
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						for (auto& t : due) {
+							if (!t->removed) {
+								insert(t);
+							}
+						}
+					}
+					due.clear();
+				}
+			}
+
+			//回调到期的序号，按策略处理错过的序号，之后t->tick为下一个未到期的序号
+			void fireTimer(const Timer::shared& t) {
+				const int64_t intervalNs = 1000000000LL / t->framerate;
+				int64_t now = monotonicNs();
+				int64_t burst = 0;
+
+				while (!t->removed && t->deadlineOf(t->tick) <= now) {
+					int64_t deadline = t->deadlineOf(t->tick);
+					int64_t lagNs = now - deadline;
+
+					//落后一帧以上：Skip直接跳到最后一个已到期的序号，CatchUp最多补发1秒
+					if (lagNs >= intervalNs
+						&& (Policy::Skip == t->policy || burst >= t->framerate)) {
+						int64_t last = (now - t->startNs) * t->framerate / 1000000000LL - 1;
+						if (last > t->tick) {
+							std::lock_guard<std::mutex> lock(mutex_);
+							t->stats.skipped += last - t->tick;
+							t->tick = last;
+							continue;
+						}
+					}
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						if (lagNs >= intervalNs) {
+							++t->stats.lateTicks;
+						}
+						t->stats.maxLagUs = std::max(t->stats.maxLagUs, lagNs / 1000);
+						++t->stats.ticks;
+					}
+					++burst;
+
+					t->func(t->tick, TimePoint(std::chrono::nanoseconds(deadline)));
+					++t->tick;
+					now = monotonicNs();
+				}
+			}
+		};
+
+		OutputClock::shared OutputClock::Create(const std::string& name) {
+			return std::make_shared<OutputClockImpl>(name);
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef NOutputClock_hpp
+#define NOutputClock_hpp
+
+#include <memory>
+#include <string>
+#include <chrono>
+#include <functional>
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//输出时钟：按输出帧率定时回调，用于驱动Transcoder::transcode()，不依赖显示窗口
+		//一个时钟线程管理一个时间轮，可以同时服务多个会话的定时器，每个定时器有自己的帧率
+		//第n次回调的截止时间为 起点 + n / framerate，由序号直接计算，不累积误差
+		//线程在CLOCK_MONOTONIC上按绝对时间睡眠，回调在时钟线程中执行，应只做投递任务等轻量工作
+		class OutputClock {
+		public:
+			using shared = std::shared_ptr<OutputClock>;
+			using Clock = std::chrono::steady_clock;
+			using TimePoint = Clock::time_point;
+			//tick : 回调序号，从0开始，跳过的序号不回调
+			//deadline : 该序号的截止时间
+			using TickFunc = std::function<void(int64_t tick, TimePoint deadline)>;
+
+			//错过截止时间后的处理策略
+			enum class Policy {
+				CatchUp = 0,	//连续补发错过的回调，落后超过1秒的部分跳过
+				Skip			//跳过错过的回调，从下一个未到期的截止时间继续
+			};
+
+			static const char* GetNameFor(Policy policy) {
+				switch (policy) {
+				case Policy::CatchUp:	return "catchup";
+				case Policy::Skip:		return "skip";
+				default:				return "unknown";
+				}
+			}
+
+			//定时器统计
+			struct TimerStats {
+				int id = -1;
+				int framerate = 0;
+				Policy policy = Policy::Skip;
+				int64_t ticks = 0;			//已回调次数
+				int64_t lateTicks = 0;		//晚于截止时间超过一帧才回调的次数
+				int64_t skipped = 0;		//跳过的回调次数
+				int64_t maxLagUs = 0;		//回调相对截止时间的最大延迟
+
+				const std::string dump() const {
+					return fmt::format("[id={}, fps={}, policy={}, ticks={}, late={}, skipped={}, maxLag={}us]"
+						, id
+						, framerate
+						, GetNameFor(policy)
+						, ticks
+						, lateTicks
+						, skipped
+						, maxLagUs);
+				}
+			};
+
+		public:
+			OutputClock() {}
+
+			virtual ~OutputClock() {}
+
+			//启动时钟线程
+			// 0 : 成功
+			// ALREADY_OPENED_TRANSCODER : 已启动
+			virtual int start() = 0;
+
+			//停止时钟线程，定时器保留，再次启动后继续从当前时刻计时
+			virtual void stop() = 0;
+
+			//增加一个定时器，第一次回调在一帧间隔之后
+			// >= 0 : 定时器id
+			// EXTERNAL_PARAM_NOT_VAILD : 帧率不在(0, 1000]范围内或func为空
+			virtual int addTimer(int framerate, Policy policy, const TickFunc& func) = 0;
+
+			//移除定时器，可以在回调中调用；返回后该定时器不会再开始新的回调
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 定时器不存在
+			virtual int removeTimer(int timerId) = 0;
+
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 定时器不存在
+			virtual int getTimerStats(int timerId, TimerStats* stats) = 0;
+
+			//创建一个OutputClock实例
+			static
+			shared Create(const std::string& name);
+		};
+	}
+}
+
+#endif //NOutputClock_hpp
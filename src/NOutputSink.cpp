@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+
+#include "NOutputSink.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#endif
+
+namespace nmedia {
+	namespace video {
+
+		class OutputSinkImpl : public OutputSink {
+		private:
+			using Clock = std::chrono::steady_clock;
+			//一次writev最多的分段数，不超过IOV_MAX
+			static const size_t kMaxSegments = 1024;
+
+			struct Segment {
+				const uint8_t*	data;
+				size_t			size;
+			};
+
+			//一批待写出的数据：拷贝的数据放在预分配的buf中，编码包只保留引用
+			struct Batch {
+				std::unique_ptr<uint8_t[]>					buf;
+				size_t										capacity = 0;
+				size_t										used = 0;
+				std::vector<Segment>						segments;
+				std::vector<EncodedPacket::shared>			refs;
+				std::vector<std::unique_ptr<uint8_t[]>>		large;		//大于缓冲区的拷贝
+				size_t										bytes = 0;
+				Clock::time_point							first;
+
+				Batch(size_t cap) :buf(new uint8_t[cap]), capacity(cap) {
+					segments.reserve(kMaxSegments);
+				}
+
+				void reset() {
+					used = 0;
+					segments.clear();
+					refs.clear();
+					large.clear();
+					bytes = 0;
+				}
+
+				//追加一段，与上一段在buf中连续时合并
+				void add(const uint8_t* data, size_t size) {
+					if (segments.empty()) {
+						first = Clock::now();
+					}
+					if (!segments.empty() && segments.back().data + segments.back().size == data) {
+						segments.back().size += size;
+					}
+					else {
+						segments.push_back({ data, size });
+					}
+					bytes += size;
+				}
+
+				uint8_t* copy(const uint8_t* data, size_t size) {
+					uint8_t* dst = buf.get() + used;
+					memcpy(dst, data, size);
+					used += size;
+					add(dst, size);
+					return dst;
+				}
+			};
+
+		private:
+			NLogger::shared								logger_ = nullptr;
+			Config										cfg_;
+			std::atomic<bool>							running_{ false };
+			std::thread									thread_;
+#ifdef _WIN32
+			FILE*										file_ = nullptr;
+#else
+			int											fd_ = -1;
+#endif
+
+			mutable std::mutex							mutex_;
+			std::condition_variable						cond_;
+			std::vector<std::unique_ptr<Batch>>			free_;
+			std::unique_ptr<Batch>						current_;
+			std::deque<std::unique_ptr<Batch>>			full_;
+			Stats										stats_;
+
+		public:
+			OutputSinkImpl(const std::string& name) :logger_(NLogger::Get(name)) {}
+
+			virtual ~OutputSinkImpl() {
+				close();
+			}
+
+			virtual int open(const std::string& path, const Config& cfg) override {
+				if (running_) {
+					return ALREADY_OPENED_TRANSCODER;
+				}
+
+				if (!cfg.vaild()) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+#ifdef _WIN32
+				file_ = fopen(path.c_str(), "wb");
+				if (!file_) {
+#else
+				fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd_ < 0) {
+#endif
+					dbge(logger_, "failed to open output file, [{}]", path);
+					return FAILED_OPEN_FILE;
+				}
+
+				cfg_ = cfg;
+				stats_ = Stats();
+				free_.clear();
+				full_.clear();
+				//所有缓冲区在打开时分配，之后不再分配
+				for (size_t i = 0; i < cfg_.buffers; ++i) {
+					free_.emplace_back(new Batch(cfg_.bufferSize));
+				}
+				current_ = std::move(free_.back());
+				free_.pop_back();
+
+				running_ = true;
+				thread_ = std::thread(&OutputSinkImpl::writeLoop, this);
+				dbgi(logger_, "output sink opened, file=[{}], buffers=[{}x{}].", path, cfg_.buffers, cfg_.bufferSize);
+				return 0;
+			}
+
+			virtual void close() override {
+				if (!running_) {
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					running_ = false;
+					seal();
+				}
+				cond_.notify_all();
+				if (thread_.joinable()) {
+					thread_.join();
+				}
+
+#ifdef _WIN32
+				fclose(file_);
+				file_ = nullptr;
+#else
+				::close(fd_);
+				fd_ = -1;
+#endif
+				current_.reset();
+				free_.clear();
+				dbgi(logger_, "output sink closed, stats=[{}].", stats_.dump());
+			}
+
+			virtual bool isOpened() const override {
+				return running_;
+			}
+
+			virtual int write(const uint8_t* data, size_t size) override {
+				return append(data, size, nullptr);
+			}
+
+			virtual int write(const EncodedPacket::shared& pkt) override {
+				if (!pkt) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				return append(pkt->data(), pkt->size(), &pkt);
+			}
+
+			virtual void flush() override {
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					seal();
+				}
+				cond_.notify_one();
+			}
+
+			virtual Stats getStats() const override {
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+			virtual Transcoder::DataFunc dataFunc() override {
+				return [this](uint8_t* data, size_t size) {
+					write(data, size);
+				};
+			}
+
+			virtual Transcoder::PacketFunc packetFunc() override {
+				return [this](const EncodedPacket::shared& pkt) {
+					write(pkt);
+				};
+			}
+
+		private:
+			//ref不为空时只引用包的数据，否则拷贝
+			int append(const uint8_t* data, size_t size, const EncodedPacket::shared* ref) {
+				const bool prefixed = (Framing::LengthPrefixed == cfg_.framing);
+				const size_t header = prefixed ? sizeof(int) : 0;
+				const bool large = !ref && (header + size > cfg_.bufferSize);
+				//需要占用缓冲区的字节数
+				const size_t need = header + ((ref || large) ? 0 : size);
+
+				bool wake = false;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (!running_) {
+						return NOT_OPENED_TRANSCODER;
+					}
+					++stats_.packets;
+
+					if (stats_.backlog + header + size > cfg_.maxBacklog) {
+						++stats_.dropped;
+						return FAILED_FILL_BUFFER;
+					}
+
+					if (current_ && (current_->used + need > current_->capacity
+						|| current_->segments.size() + 2 > kMaxSegments)) {
+						wake = seal();
+					}
+					if (!current_) {
+						//所有缓冲区都在等待写出
+						++stats_.dropped;
+						return FAILED_FILL_BUFFER;
+					}
+
+					Batch* b = current_.get();
+					if (prefixed) {
+						int len = (int)size;
+						b->copy((const uint8_t*)&len, sizeof(len));
+					}
+					if (ref) {
+						b->refs.push_back(*ref);
+						b->add(data, size);
+					}
+					else if (large) {
+						std::unique_ptr<uint8_t[]> copy(new uint8_t[size]);
+						memcpy(copy.get(), data, size);
+						b->add(copy.get(), size);
+						b->large.push_back(std::move(copy));
+					}
+					else {
+						b->copy(data, size);
+					}
+
+					stats_.backlog += header + size;
+					stats_.maxBacklog = std::max(stats_.maxBacklog, stats_.backlog);
+
+					if (b->bytes >= cfg_.bufferSize) {
+						wake = seal() || wake;
+					}
+				}
+				if (wake) {
+					cond_.notify_one();
+				}
+				return 0;
+			}
+
+			//把当前缓冲区交给写线程，换一个空闲的，持有mutex_时调用
+			//返回是否需要唤醒写线程
+			bool seal() {
+				if (!current_ || current_->segments.empty()) {
+					return false;
+				}
+				full_.push_back(std::move(current_));
+				if (!free_.empty()) {
+					current_ = std::move(free_.back());
+					free_.pop_back();
+				}
+				return true;
+			}
+
+			void writeLoop() {
+				const auto maxDelay = std::chrono::milliseconds(cfg_.maxDelayMs);
+				while (true) {
+					std::unique_ptr<Batch> batch;
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						cond_.wait_for(lock, maxDelay, [this]() { return !running_ || !full_.empty(); });
+
+						//未满的缓冲区等待超过maxDelayMs后写出，限制输出延迟
+						if (full_.empty() && current_ && !current_->segments.empty()
+							&& Clock::now() - current_->first >= maxDelay) {
+							seal();
+						}
+						if (full_.empty()) {
+							if (!running_) {
+								break;
+							}
+							continue;
+						}
+						batch = std::move(full_.front());
+						full_.pop_front();
+					}
+
+					auto begin = Clock::now();
+					int64_t written = writeBatch(*batch);
+					int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count();
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						++stats_.writes;
+						if (written < 0) {
+							++stats_.writeErrors;
+						}
+						else {
+							stats_.bytes += written;
+						}
+						stats_.totalWriteUs += us;
+						stats_.maxWriteUs = std::max(stats_.maxWriteUs, us);
+						stats_.backlog -= batch->bytes;
+
+						batch->reset();
+						if (!current_) {
+							current_ = std::move(batch);
+						}
+						else {
+							free_.push_back(std::move(batch));
+						}
+					}
+				}
+			}
+
+			//写出一批数据，返回写入的字节数，出错时返回-1
+			int64_t writeBatch(const Batch& batch) {
+#ifdef _WIN32
+				int64_t total = 0;
+				for (auto& s : batch.segments) {
+					if (fwrite(s.data, 1, s.size, file_) != s.size) {
+						return -1;
+					}
+					total += s.size;
+				}
+				fflush(file_);
+				return total;
+#else
+				struct iovec iov[kMaxSegments];
+				size_t count = batch.segments.size();
+				for (size_t i = 0; i < count; ++i) {
+					iov[i].iov_base = (void*)batch.segments[i].data;
+					iov[i].iov_len = batch.segments[i].size;
+				}
+
+				int64_t total = 0;
+				struct iovec* p = iov;
+				while (count > 0) {
+					ssize_t n = writev(fd_, p, (int)count);
+					if (n < 0) {
+						if (EINTR == errno) {
+							continue;
+						}
+						dbge(logger_, "writev failed, errno=[{}]", errno);
+						return -1;
+					}
+					total += n;
+					//部分写入时跳过已写的分段
+					while (count > 0 && (size_t)n >= p->iov_len) {
+						n -= p->iov_len;
+						++p;
+						--count;
+					}
+					if (count > 0) {
+						p->iov_base = (uint8_t*)p->iov_base + n;
+						p->iov_len -= n;
+					}
+				}
+				return total;
+#endif
+			}
+		};
+
+		OutputSink::shared OutputSink::Create(const std::string& name) {
+			return std::make_shared<OutputSinkImpl>(name);
+		}
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef NOutputSink_hpp
+#define NOutputSink_hpp
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "NVideoTranscoder.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//批量输出文件：调用线程只把数据追加到预分配的缓冲区，后台线程用writev批量写文件
+		//每个会话每帧一次fwrite时，系统调用和文件系统的停顿会直接表现为输出抖动，这里把它们移出转码线程
+		//通过dataFunc()/packetFunc()接到Transcoder::output()/outputPacket()上，两者只应接一个
+		//dataFunc()的数据只在回调期间有效，需要拷贝；packetFunc()保留包的引用，writev直接引用包的数据，只拷贝长度前缀
+		//积压超过上限时丢弃新数据并计数，不阻塞调用线程
+		class OutputSink {
+		public:
+			using shared = std::shared_ptr<OutputSink>;
+
+			//每个包的写出格式
+			enum class Framing {
+				Raw = 0,			//直接拼接，如H264 Annex-B
+				LengthPrefixed		//int类型的长度加数据，与old-transcoder的输入格式相同
+			};
+
+			struct Config {
+				Framing framing = Framing::Raw;
+				size_t bufferSize = 1024 * 1024;		//单个缓冲区大小
+				size_t buffers = 8;						//预分配的缓冲区个数
+				size_t maxBacklog = 64 * 1024 * 1024;	//等待写入的数据上限（含引用的包），超过后丢弃
+				int maxDelayMs = 20;					//缓冲区未满时最多等待多久写出
+
+				bool vaild() const {
+					return (0 < bufferSize)
+						&& (0 < buffers)
+						&& (bufferSize <= maxBacklog)
+						&& (0 < maxDelayMs);
+				}
+			};
+
+			struct Stats {
+				int64_t packets = 0;		//接收的包数
+				int64_t dropped = 0;		//积压超限丢弃的包数
+				int64_t bytes = 0;			//已写入的字节数
+				int64_t writes = 0;			//writev调用次数
+				int64_t writeErrors = 0;	//写失败次数
+				int64_t maxWriteUs = 0;		//单次写出的最大耗时
+				int64_t totalWriteUs = 0;	//写出累计耗时
+				size_t backlog = 0;			//当前等待写入的字节数
+				size_t maxBacklog = 0;		//最大积压字节数
+
+				const std::string dump() const {
+					return fmt::format("[packets={}, dropped={}, bytes={}, writes={}, errors={}, avgWrite={}us, maxWrite={}us, backlog={}, maxBacklog={}]"
+						, packets
+						, dropped
+						, bytes
+						, writes
+						, writeErrors
+						, writes > 0 ? totalWriteUs / writes : 0
+						, maxWriteUs
+						, backlog
+						, maxBacklog);
+				}
+			};
+
+		public:
+			OutputSink() {}
+
+			virtual ~OutputSink() {}
+
+			//打开输出文件并启动写线程
+			// 0 : 成功
+			// ALREADY_OPENED_TRANSCODER : 已打开
+			// EXTERNAL_PARAM_NOT_VAILD : cfg参数不可用
+			// FAILED_OPEN_FILE : 文件打开失败
+			virtual int open(const std::string& path, const Config& cfg) = 0;
+
+			//写完积压的数据并关闭文件
+			virtual void close() = 0;
+
+			virtual bool isOpened() const = 0;
+
+			//追加一个包，data会被拷贝
+			// 0 : 成功
+			// NOT_OPENED_TRANSCODER : 未打开
+			// FAILED_FILL_BUFFER : 积压超限，已丢弃
+			virtual int write(const uint8_t* data, size_t size) = 0;
+
+			//追加一个编码包，只保留引用，不拷贝数据
+			// 返回值同write()
+			virtual int write(const EncodedPacket::shared& pkt) = 0;
+
+			//立即写出当前缓冲区中的数据，不等待写完
+			virtual void flush() = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//接到Transcoder::output()的回调
+			virtual Transcoder::DataFunc dataFunc() = 0;
+
+			//接到Transcoder::outputPacket()的回调
+			virtual Transcoder::PacketFunc packetFunc() = 0;
+
+			//创建一个OutputSink实例
+			static
+			shared Create(const std::string& name);
+		};
+	}
+}
+
+#endif //NOutputSink_hpp
@@ -4,11 +4,188 @@
 #define NPool_hpp
 
 #include <stdio.h>
+#include <stdint.h>
 #include <cstring>
-#include <stack>
+#include <string>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+#include "NMediaBasic.hpp"
+
+// Watermarks for the idle objects of a pool, by default a pool keeps everything it was ever given.
+// high caps the idle objects retained, extra returns are deleted.
+// With idleMs > 0 the pool tracks the fewest idle objects seen during each idleMs
+// window; those were not needed by anyone, so trim() frees them down to low.
+struct NPoolLimits {
+    size_t      high = SIZE_MAX;
+    size_t      low = 0;
+    int64_t     idleMs = 0;         // 0 disables trimming
+};
+
+// Counters of one pool, shared with NPoolRegistry. They outlive the pool while
+// objects are still out, so returns after the pool is gone show up as orphaned.
+// Updated with relaxed atomics, a snapshot taken while the pool is in use is approximate.
+struct NPoolCounters {
+    // changes applied at once, see NConcurrentObjectPool's thread caches
+    struct Delta {
+        int64_t gets = 0;
+        int64_t misses = 0;
+        int64_t puts = 0;
+        int64_t dropped = 0;
+        int64_t returned = 0;
+        int64_t idle = 0;
+        int64_t bytes = 0;
+    };
+    
+    std::atomic<int64_t>    gets{0};
+    std::atomic<int64_t>    misses{0};          // gets served by the creator
+    std::atomic<int64_t>    puts{0};            // objects given to put(), including dropped
+    std::atomic<int64_t>    dropped{0};         // deleted instead of kept, above the high watermark
+    std::atomic<int64_t>    trimmed{0};         // freed by trim()
+    std::atomic<int64_t>    returned{0};        // handed out objects that came back
+    std::atomic<int64_t>    orphaned{0};        // came back after the pool was destroyed, deleted
+    std::atomic<int64_t>    peakOutstanding{0};
+    std::atomic<int64_t>    idle{0};
+    std::atomic<int64_t>    bytesHeld{0};       // by idle objects, see NObjectPool::setSizer()
+    std::atomic<bool>       closed{false};      // the pool is destroyed
+    std::string             name;               // guarded by NPoolRegistry
+    bool                    reported = false;   // guarded by NPoolRegistry, a snapshot showed the final counts
+    
+    int64_t outstanding() const {
+        return gets.load(std::memory_order_relaxed) - returned.load(std::memory_order_relaxed);
+    }
+    
+    void apply(const Delta& d) {
+        add(gets, d.gets);
+        if (d.gets > 0) {
+            // before the returns of the same batch, so a batched peak errs high
+            int64_t n = outstanding();
+            if (n > peakOutstanding.load(std::memory_order_relaxed)) {
+                peakOutstanding.store(n, std::memory_order_relaxed);
+            }
+        }
+        add(misses, d.misses);
+        add(puts, d.puts);
+        add(dropped, d.dropped);
+        add(returned, d.returned);
+        add(idle, d.idle);
+        add(bytesHeld, d.bytes);
+    }
+    
+    static void add(std::atomic<int64_t>& counter, int64_t n) {
+        if (n) {
+            counter.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+};
+
+// snapshot of one pool
+struct NPoolStats {
+    std::string name;
+    int64_t gets = 0;
+    int64_t misses = 0;
+    int64_t puts = 0;
+    int64_t dropped = 0;
+    int64_t trimmed = 0;
+    int64_t orphaned = 0;
+    int64_t outstanding = 0;
+    int64_t peakOutstanding = 0;
+    int64_t idle = 0;
+    int64_t bytesHeld = 0;
+    bool closed = false;
+    
+    // gets served from idle objects
+    double hitRate() const {
+        return gets > 0 ? (double)(gets - misses) / gets : 0;
+    }
+};
+
+// Process-wide list of pool counters. Every pool registers itself on construction;
+// a destroyed pool stays listed until all its objects are back and, if any came
+// back orphaned, until one snapshot has shown it, so a leak past the pool's
+// lifetime remains visible.
+class NPoolRegistry {
+public:
+    // never destroyed, pools with static storage may outlive any other static
+    static NPoolRegistry& Get() {
+        static NPoolRegistry * registry = new NPoolRegistry();
+        return *registry;
+    }
+    
+    void add(const std::shared_ptr<NPoolCounters>& counters) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.push_back(counters);
+    }
+    
+    void setName(NPoolCounters * counters, const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counters->name = name;
+    }
+    
+    void close(NPoolCounters * counters) {
+        counters->idle.store(0, std::memory_order_relaxed);
+        counters->bytesHeld.store(0, std::memory_order_relaxed);
+        counters->closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(mutex_);
+        prune();
+    }
+    
+    NPoolStats stats(const NPoolCounters * counters) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return StatsOf(*counters);
+    }
+    
+    // all registered pools, in registration order
+    std::vector<NPoolStats> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        prune();
+        std::vector<NPoolStats> result;
+        result.reserve(entries_.size());
+        for (auto& c : entries_) {
+            result.push_back(StatsOf(*c));
+            c->reported = result.back().closed && 0 == result.back().outstanding;
+        }
+        return result;
+    }
+    
+private:
+    NPoolRegistry() {}
+    
+    // with mutex_ held, for the name
+    static NPoolStats StatsOf(const NPoolCounters& c) {
+        NPoolStats s;
+        s.name = c.name;
+        s.gets = c.gets.load(std::memory_order_relaxed);
+        s.misses = c.misses.load(std::memory_order_relaxed);
+        s.puts = c.puts.load(std::memory_order_relaxed);
+        s.dropped = c.dropped.load(std::memory_order_relaxed);
+        s.trimmed = c.trimmed.load(std::memory_order_relaxed);
+        s.orphaned = c.orphaned.load(std::memory_order_relaxed);
+        s.outstanding = std::max<int64_t>(c.outstanding(), 0);
+        s.peakOutstanding = c.peakOutstanding.load(std::memory_order_relaxed);
+        s.idle = c.idle.load(std::memory_order_relaxed);
+        s.bytesHeld = c.bytesHeld.load(std::memory_order_relaxed);
+        s.closed = c.closed.load(std::memory_order_acquire);
+        return s;
+    }
+    
+    void prune() {
+        entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [](const std::shared_ptr<NPoolCounters>& c) {
+            return c->closed.load(std::memory_order_acquire) && c->outstanding() <= 0
+                && (c->reported || 0 == c->orphaned.load(std::memory_order_relaxed));
+        }), entries_.end());
+    }
+    
+private:
+    std::mutex                                  mutex_;
+    std::vector<std::shared_ptr<NPoolCounters> > entries_;
+};
 
 // see https://swarminglogic.com/jotting/2015_05_smartpool
 template <class T, class D = std::default_delete<T>>
@@ -16,70 +193,213 @@ class NObjectPool
 {
 private:
     using PoolType = NObjectPool<T, D>;
+    // what handed out objects refer to, kept alive by the registry while they are out
+    struct Home {
+        std::atomic<PoolType *>     pool;       // nullptr once the pool is destroyed
+        NPoolCounters               counters;
+        
+        explicit Home(PoolType * p) : pool(p) {}
+    };
+    
     struct ReturnToPool_Deleter {
-        explicit ReturnToPool_Deleter(std::weak_ptr<PoolType* > pool)
-        : pool_(pool) {}
+        explicit ReturnToPool_Deleter(std::weak_ptr<Home> home)
+        : home_(home) {}
         
         void operator()(T* ptr) {
-            if (auto pool_ptr = pool_.lock()){
-                (*pool_ptr.get())->put(std::unique_ptr<T, D>{ptr});
-            }else{
-                D{}(ptr);
+            if (auto home = home_.lock()){
+                PoolType * pool = home->pool.load(std::memory_order_acquire);
+                if (pool) {
+                    pool->recycle(std::unique_ptr<T, D>{ptr});
+                    return;
+                }
+                home->counters.returned.fetch_add(1, std::memory_order_relaxed);
+                home->counters.orphaned.fetch_add(1, std::memory_order_relaxed);
             }
-            
+            D{}(ptr);
         }
     private:
-        std::weak_ptr<PoolType* > pool_;
+        std::weak_ptr<Home> home_;
     };
     
 public:
     using Unique = std::unique_ptr<T, ReturnToPool_Deleter >;
     using CreateType = std::function<T *()>;
+    // bytes an idle object holds, for NPoolStats::bytesHeld
+    using SizeType = std::function<size_t(const T *)>;
+    using Clock = std::chrono::steady_clock;
+    using Limits = NPoolLimits;
+    
+    // trim() is also attempted from put() once every TRIM_CHECK_INTERVAL returns
+    static const unsigned TRIM_CHECK_INTERVAL = 64;
     
     static inline Unique MakeNullPtr(){
         return Unique(nullptr,
                       ReturnToPool_Deleter{
-                          std::weak_ptr<PoolType*>{std::shared_ptr<PoolType* >(nullptr)}});
+                          std::weak_ptr<Home>{std::shared_ptr<Home>(nullptr)}});
     }
 public:
     NObjectPool()
-    : this_ptr_(new PoolType*(this)) {}
+    : home_(std::make_shared<Home>(this)) {
+        NPoolRegistry::Get().add(counters());
+    }
     NObjectPool(const CreateType& creator)
-    : this_ptr_(new PoolType*(this)), creator_(creator) {}
+    : home_(std::make_shared<Home>(this)), creator_(creator) {
+        NPoolRegistry::Get().add(counters());
+    }
     
-    virtual ~NObjectPool(){}
+    virtual ~NObjectPool(){
+        detach();
+        NPoolRegistry::Get().close(&home_->counters);
+    }
     
-    void put(std::unique_ptr<T, D> t) {
-        pool_.push(std::move(t));
+    // set before the pool is in use
+    void setLimits(const Limits& limits) {
+        limits_ = limits;
     }
     
-    Unique get() {
+    const Limits& getLimits() const {
+        return limits_;
+    }
+    
+    // name shown in NPoolRegistry snapshots
+    void setName(const std::string& name) {
+        NPoolRegistry::Get().setName(&home_->counters, name);
+    }
+    
+    // set before the pool is in use, by default an object holds sizeof(T) bytes
+    void setSizer(const SizeType& sizer) {
+        sizer_ = sizer;
+    }
+    
+    // put/get are virtual so that subclasses (e.g. NConcurrentObjectPool)
+    // share the same Unique type and deleter
+    virtual void put(std::unique_ptr<T, D> t) {
+        NPoolCounters::Delta d;
+        d.puts = 1;
+        if (pool_.size() >= limits_.high) {
+            // t is deleted
+            d.dropped = 1;
+            home_->counters.apply(d);
+            return;
+        }
+        d.idle = 1;
+        d.bytes = bytesOf(t.get());
+        home_->counters.apply(d);
+        pool_.push_back(std::move(t));
+        if (limits_.idleMs > 0 && 0 == (++puts_ % TRIM_CHECK_INTERVAL)) {
+            trim();
+        }
+    }
+    
+    virtual Unique get() {
+        NPoolCounters::Delta d;
+        d.gets = 1;
         if (pool_.empty()){
-            auto t = std::unique_ptr<T>(creator_());
-            pool_.push(std::move(t));
+            minIdle_ = 0;
+            d.misses = 1;
+            home_->counters.apply(d);
+            return wrap(creator_());
         }
         
-        Unique tmp(pool_.top().release(),
-                   ReturnToPool_Deleter{
-                       std::weak_ptr<PoolType*>{this_ptr_}});
-        pool_.pop();
-        return std::move(tmp);
+        Unique tmp = wrap(pool_.back().release());
+        pool_.pop_back();
+        minIdle_ = std::min(minIdle_, pool_.size());
+        d.idle = -1;
+        d.bytes = -bytesOf(tmp.get());
+        home_->counters.apply(d);
+        return tmp;
     }
     
-    bool empty() const {
+    virtual bool empty() const {
         return pool_.empty();
     }
     
-    size_t size() const {
+    virtual size_t size() const {
         return pool_.size();
     }
     
+    // Frees the idle objects nobody needed during the last idleMs window, down to low,
+    // and starts a new window. Returns the number of objects freed.
+    // A pool that goes quiet sees no put(), so owners should also call this periodically.
+    virtual size_t trim() {
+        if (limits_.idleMs <= 0) {
+            return 0;
+        }
+        Clock::time_point now = Clock::now();
+        if (now - trimStart_ < std::chrono::milliseconds(limits_.idleMs)) {
+            return 0;
+        }
+        size_t excess = minIdle_ > limits_.low ? std::min(minIdle_ - limits_.low, pool_.size()) : 0;
+        // the front holds the objects returned longest ago
+        int64_t bytes = 0;
+        for (size_t n = 0; n < excess; ++n) {
+            bytes += bytesOf(pool_[n].get());
+        }
+        pool_.erase(pool_.begin(), pool_.begin() + excess);
+        onTrimmed(excess, bytes);
+        trimStart_ = now;
+        minIdle_ = pool_.size();
+        return excess;
+    }
+    
+    // this pool's counters, as listed by NPoolRegistry
+    std::shared_ptr<NPoolCounters> counters() const {
+        return std::shared_ptr<NPoolCounters>(home_, &home_->counters);
+    }
+    
+    NPoolStats getStats() const {
+        return NPoolRegistry::Get().stats(&home_->counters);
+    }
+    
+protected:
+    // a new object from the creator
+    T * create() {
+        return creator_();
+    }
+    
+    // hand out an object that returns to this pool when released
+    Unique wrap(T * t) {
+        return Unique(t,
+                      ReturnToPool_Deleter{
+                          std::weak_ptr<Home>{home_}});
+    }
+    
+    // objects returned from now on are deleted, for subclass destructors
+    void detach() {
+        home_->pool.store(nullptr, std::memory_order_release);
+    }
+    
+    // a handed out object came back
+    virtual void recycle(std::unique_ptr<T, D> t) {
+        home_->counters.returned.fetch_add(1, std::memory_order_relaxed);
+        put(std::move(t));
+    }
+    
+    int64_t bytesOf(const T * t) const {
+        return sizer_ ? (int64_t)sizer_(t) : (int64_t)sizeof(T);
+    }
+    
+    NPoolCounters& poolCounters() {
+        return home_->counters;
+    }
+    
+    void onTrimmed(size_t n, int64_t bytes) {
+        NPoolCounters::add(home_->counters.trimmed, n);
+        NPoolCounters::add(home_->counters.idle, -(int64_t)n);
+        NPoolCounters::add(home_->counters.bytesHeld, -bytes);
+    }
+    
 private:
-    std::shared_ptr<PoolType* > this_ptr_;
-    std::stack<std::unique_ptr<T, D> > pool_;
+    std::shared_ptr<Home> home_;
+    std::deque<std::unique_ptr<T, D> > pool_;
     const CreateType creator_ = []()->T *{
         return new T();
     };
+    SizeType sizer_;
+    Limits limits_;
+    unsigned puts_ = 0;
+    size_t minIdle_ = 0;
+    Clock::time_point trimStart_ = Clock::now();
 };
 
 template <class T, class BaseType=T>
@@ -94,6 +414,386 @@ public:
     NPool(typename NObjectPool<BaseType>::CreateType creator):NObjectPool<BaseType>(creator){}
 };
 
+// Thread-safe NObjectPool: get() and put() are lock-free and may be called from
+// any thread, e.g. frames taken on a network thread and released on a decode thread.
+// Idle objects are kept in a Treiber stack over a fixed array of nodes; the stack
+// heads pack a 32-bit tag with a 32-bit node index so a single 64-bit CAS avoids ABA.
+// Empty nodes live in a second stack, so get/put never allocate once the pool is warm.
+// At most min(capacity, Limits::high) idle objects are retained in the shared stack,
+// extra returns are deleted.
+// In front of the shared stack every thread keeps a small cache of up to `threadCache`
+// objects, so a thread that takes and returns objects itself touches no shared state.
+// A cache is flushed back to the shared stack when its thread exits; size() only
+// counts the shared stack. Counter updates on a cached thread are batched too, so
+// NPoolStats lag by up to COUNTER_FLUSH_INTERVAL operations per thread.
+// The pool itself must outlive concurrent get/put calls.
+template <class T, class D = std::default_delete<T>>
+class NConcurrentObjectPool : public NObjectPool<T, D>
+{
+public:
+    using Parent = NObjectPool<T, D>;
+    using Unique = typename Parent::Unique;
+    using CreateType = typename Parent::CreateType;
+    using Clock = typename Parent::Clock;
+    static const size_t DEFAULT_CAPACITY = 1024;
+    static const size_t DEFAULT_THREAD_CACHE = 8;
+    static const unsigned COUNTER_FLUSH_INTERVAL = 64;
+    
+public:
+    NConcurrentObjectPool(size_t capacity = DEFAULT_CAPACITY, size_t threadCache = DEFAULT_THREAD_CACHE)
+    : Parent(), capacity_(capacity), threadCache_(threadCache), uid_(NextUid()), nodes_(new Node[capacity]) {
+        init();
+    }
+    
+    NConcurrentObjectPool(const CreateType& creator, size_t capacity = DEFAULT_CAPACITY, size_t threadCache = DEFAULT_THREAD_CACHE)
+    : Parent(creator), capacity_(capacity), threadCache_(threadCache), uid_(NextUid()), nodes_(new Node[capacity]) {
+        init();
+    }
+    
+    virtual ~NConcurrentObjectPool(){
+        this->detach();
+        // detach the thread caches first, a thread exiting meanwhile either
+        // flushes into the shared stack before it is drained or sees the pool gone
+        std::vector<std::shared_ptr<Cache> > caches;
+        {
+            std::lock_guard<std::mutex> lock(cachesMutex_);
+            caches.swap(caches_);
+        }
+        for (auto& cache : caches) {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            cache->pool = nullptr;
+            this->poolCounters().apply(cache->delta);
+            for (size_t n = 0; n < cache->count; ++n) {
+                D{}(cache->objs[n]);
+            }
+            cache->count = 0;
+        }
+        
+        uint32_t index;
+        while ((index = pop(full_)) != 0) {
+            D{}(nodes_[index - 1].obj);
+        }
+    }
+    
+    virtual void put(std::unique_ptr<T, D> t) override {
+        Cache * cache = localCache();
+        NPoolCounters::Delta d;
+        NPoolCounters::Delta& delta = cache ? cache->delta : d;
+        ++delta.puts;
+        int64_t bytes = this->bytesOf(t.get());
+        if (cache && cache->count < threadCache_) {
+            cache->objs[cache->count++] = t.release();
+            ++delta.idle;
+            delta.bytes += bytes;
+        } else if (putShared(std::move(t))) {
+            ++delta.idle;
+            delta.bytes += bytes;
+        } else {
+            ++delta.dropped;
+        }
+        counted(cache, delta);
+        if (cache && this->getLimits().idleMs > 0 && 0 == (++cache->puts % Parent::TRIM_CHECK_INTERVAL)) {
+            trim();
+        }
+    }
+    
+    virtual Unique get() override {
+        Cache * cache = localCache();
+        NPoolCounters::Delta d;
+        NPoolCounters::Delta& delta = cache ? cache->delta : d;
+        ++delta.gets;
+        if (cache && cache->count > 0) {
+            T * t = cache->objs[--cache->count];
+            --delta.idle;
+            delta.bytes -= this->bytesOf(t);
+            counted(cache, delta);
+            return this->wrap(t);
+        }
+        
+        uint32_t index = pop(full_);
+        if (!index) {
+            minIdle_.store(0, std::memory_order_relaxed);
+            ++delta.misses;
+            counted(cache, delta);
+            return this->wrap(this->create());
+        }
+        long n = count_.fetch_sub(1, std::memory_order_relaxed) - 1;
+        if (n < minIdle_.load(std::memory_order_relaxed)) {
+            // racy but only ever an estimate
+            minIdle_.store(n, std::memory_order_relaxed);
+        }
+        T * t = nodes_[index - 1].obj;
+        nodes_[index - 1].obj = nullptr;
+        push(free_, index);
+        --delta.idle;
+        delta.bytes -= this->bytesOf(t);
+        counted(cache, delta);
+        return this->wrap(t);
+    }
+    
+    // approximate under concurrent use
+    virtual bool empty() const override {
+        return 0 == size();
+    }
+    
+    virtual size_t size() const override {
+        long n = count_.load(std::memory_order_relaxed);
+        return n > 0 ? (size_t)n : 0;
+    }
+    
+    // Same policy as NObjectPool::trim() over the shared stack; thread caches are
+    // left alone. Only one thread trims at a time, the others return 0.
+    virtual size_t trim() override {
+        const auto& limits = this->getLimits();
+        if (limits.idleMs <= 0 || trimming_.exchange(true, std::memory_order_acquire)) {
+            return 0;
+        }
+        size_t freed = 0;
+        int64_t bytes = 0;
+        typename Clock::time_point now = Clock::now();
+        if (now - trimStart_ >= std::chrono::milliseconds(limits.idleMs)) {
+            long minIdle = minIdle_.load(std::memory_order_relaxed);
+            size_t excess = minIdle > (long)limits.low ? (size_t)minIdle - limits.low : 0;
+            uint32_t index;
+            while (freed < excess && (index = pop(full_)) != 0) {
+                count_.fetch_sub(1, std::memory_order_relaxed);
+                bytes += this->bytesOf(nodes_[index - 1].obj);
+                D{}(nodes_[index - 1].obj);
+                nodes_[index - 1].obj = nullptr;
+                push(free_, index);
+                ++freed;
+            }
+            trimStart_ = now;
+            minIdle_.store(count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            this->onTrimmed(freed, bytes);
+        }
+        trimming_.store(false, std::memory_order_release);
+        return freed;
+    }
+    
+    size_t capacity() const {
+        return capacity_;
+    }
+    
+protected:
+    virtual void recycle(std::unique_ptr<T, D> t) override {
+        Cache * cache = localCache();
+        if (cache) {
+            ++cache->delta.returned;
+        } else {
+            this->poolCounters().returned.fetch_add(1, std::memory_order_relaxed);
+        }
+        put(std::move(t));
+    }
+    
+private:
+    struct Node {
+        std::atomic<uint32_t>   next{0};    // 1-based index, 0 is the end of the stack
+        T *                     obj = nullptr;
+    };
+    
+    // one thread's objects for one pool, only that thread touches objs/count while the pool lives;
+    // mutex and pool are for thread exit racing with pool destruction
+    struct Cache {
+        std::mutex                  mutex;
+        NConcurrentObjectPool *     pool = nullptr;
+        std::vector<T *>            objs;
+        size_t                      count = 0;
+        unsigned                    puts = 0;
+        unsigned                    ops = 0;
+        NPoolCounters::Delta        delta;      // not yet applied to the pool's counters
+        
+        Cache(NConcurrentObjectPool * p, size_t n) : pool(p), objs(n, nullptr) {}
+    };
+    
+    // the caches of the current thread, keyed by pool uid so a destroyed pool's
+    // address reused by a new pool never matches a stale entry
+    struct ThreadCaches {
+        static const size_t kEntries = 8;
+        struct Entry {
+            uint64_t                    uid = 0;
+            std::shared_ptr<Cache>      cache;
+        };
+        Entry       entries[kEntries];
+        size_t      next = 0;
+        
+        Cache * find(uint64_t uid) {
+            for (auto& e : entries) {
+                if (e.uid == uid) {
+                    return e.cache.get();
+                }
+            }
+            return nullptr;
+        }
+        
+        // replaces the oldest entry once all are in use
+        void add(uint64_t uid, const std::shared_ptr<Cache>& cache) {
+            Entry& e = entries[next++ % kEntries];
+            if (e.cache) {
+                Release(e.cache);
+            }
+            e.uid = uid;
+            e.cache = cache;
+        }
+        
+        ~ThreadCaches() {
+            for (auto& e : entries) {
+                if (e.cache) {
+                    Release(e.cache);
+                }
+            }
+        }
+    };
+    
+    static uint64_t NextUid() {
+        static std::atomic<uint64_t> uid{0};
+        return ++uid;
+    }
+    
+    static ThreadCaches& LocalCaches() {
+        static thread_local ThreadCaches caches;
+        return caches;
+    }
+    
+    // gives a cache's objects back to its pool, if the pool is still alive
+    static void Release(const std::shared_ptr<Cache>& cache) {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        NConcurrentObjectPool * pool = cache->pool;
+        if (!pool) {
+            return;
+        }
+        for (size_t n = 0; n < cache->count; ++n) {
+            int64_t bytes = pool->bytesOf(cache->objs[n]);
+            if (!pool->putShared(std::unique_ptr<T, D>(cache->objs[n]))) {
+                ++cache->delta.dropped;
+                --cache->delta.idle;
+                cache->delta.bytes -= bytes;
+            }
+        }
+        cache->count = 0;
+        cache->pool = nullptr;
+        pool->poolCounters().apply(cache->delta);
+        cache->delta = NPoolCounters::Delta();
+        
+        std::lock_guard<std::mutex> poolLock(pool->cachesMutex_);
+        auto& caches = pool->caches_;
+        caches.erase(std::remove(caches.begin(), caches.end(), cache), caches.end());
+    }
+    
+    Cache * localCache() {
+        if (!threadCache_) {
+            return nullptr;
+        }
+        ThreadCaches& caches = LocalCaches();
+        Cache * cache = caches.find(uid_);
+        if (!cache) {
+            // first use on this thread
+            auto created = std::make_shared<Cache>(this, threadCache_);
+            {
+                std::lock_guard<std::mutex> lock(cachesMutex_);
+                caches_.push_back(created);
+            }
+            caches.add(uid_, created);
+            cache = created.get();
+        }
+        return cache;
+    }
+    
+    // false if t was deleted, above the high watermark or the capacity
+    bool putShared(std::unique_ptr<T, D> t) {
+        if (count_.load(std::memory_order_relaxed) >= (long)std::min<size_t>(this->getLimits().high, capacity_)) {
+            return false;
+        }
+        uint32_t index = pop(free_);
+        if (!index) {
+            return false;
+        }
+        nodes_[index - 1].obj = t.release();
+        push(full_, index);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    // applies delta now without a cache, otherwise every COUNTER_FLUSH_INTERVAL operations
+    void counted(Cache * cache, NPoolCounters::Delta& delta) {
+        if (!cache || 0 == (++cache->ops % COUNTER_FLUSH_INTERVAL)) {
+            this->poolCounters().apply(delta);
+            delta = NPoolCounters::Delta();
+        }
+    }
+    
+    // head: tag << 32 | 1-based node index
+    static uint32_t indexOf(uint64_t head) {
+        return (uint32_t)head;
+    }
+    
+    static uint64_t makeHead(uint64_t prev, uint32_t index) {
+        return (((prev >> 32) + 1) << 32) | index;
+    }
+    
+    void init() {
+        for (size_t n = 0; n < capacity_; ++n) {
+            nodes_[n].next.store(n + 1 < capacity_ ? (uint32_t)(n + 2) : 0, std::memory_order_relaxed);
+        }
+        free_.store(capacity_ > 0 ? 1 : 0, std::memory_order_release);
+        full_.store(0, std::memory_order_release);
+    }
+    
+    void push(std::atomic<uint64_t>& head, uint32_t index) {
+        uint64_t old = head.load(std::memory_order_relaxed);
+        do {
+            nodes_[index - 1].next.store(indexOf(old), std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(old, makeHead(old, index)
+                                             , std::memory_order_release
+                                             , std::memory_order_relaxed));
+    }
+    
+    // returns the popped 1-based node index, 0 if the stack is empty
+    uint32_t pop(std::atomic<uint64_t>& head) {
+        uint64_t old = head.load(std::memory_order_acquire);
+        while (indexOf(old)) {
+            // a stale next only matters if the head is unchanged, which the tag rules out
+            uint32_t next = nodes_[indexOf(old) - 1].next.load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(old, makeHead(old, next)
+                                           , std::memory_order_acquire
+                                           , std::memory_order_acquire)) {
+                return indexOf(old);
+            }
+        }
+        return 0;
+    }
+    
+private:
+    const size_t                capacity_;
+    const size_t                threadCache_;
+    const uint64_t              uid_;
+    std::unique_ptr<Node[]>     nodes_;
+    std::atomic<uint64_t>       full_{0};       // nodes holding idle objects
+    std::atomic<uint64_t>       free_{0};       // empty nodes
+    std::atomic<long>           count_{0};
+    
+    std::atomic<long>           minIdle_{0};
+    std::atomic<bool>           trimming_{false};
+    typename Clock::time_point  trimStart_ = Clock::now();  // guarded by trimming_
+    
+    std::mutex                              cachesMutex_;
+    std::vector<std::shared_ptr<Cache> >    caches_;
+};
+
+template <class T, class BaseType=T>
+class NConcurrentPool : public NConcurrentObjectPool<BaseType>{
+public:
+    using Parent = NConcurrentObjectPool<BaseType>;
+public:
+    NConcurrentPool(size_t capacity = Parent::DEFAULT_CAPACITY, size_t threadCache = Parent::DEFAULT_THREAD_CACHE)
+    : Parent([]()->BaseType*{
+        return new T();
+    }, capacity, threadCache){};
+    
+    NConcurrentPool(typename Parent::CreateType creator, size_t capacity = Parent::DEFAULT_CAPACITY, size_t threadCache = Parent::DEFAULT_THREAD_CACHE)
+    : Parent(creator, capacity, threadCache){}
+};
+
 
 
 
@@ -473,6 +1173,17 @@ public:
         return &block_[position_];
     }
     
+    /**
+     * The start of the backing array, elements [0, position) are what was put so far.
+     */
+    T * data(){
+        return block_.data();
+    }
+    
+    const T * data() const{
+        return block_.data();
+    }
+    
     SizeType get(NIOBuffer& dst) {
         SizeType n = get(dst.next(), dst.remaining());
         dst.position_ += n;
@@ -509,12 +1220,10 @@ public:
     
 private:
     SizeType limitIn(SizeType pos){
-        if(pos >= 0 && pos <= limit_){
+        if(pos <= limit_){
             return pos;
-        }else if(pos > limit_){
-            return limit_;
         }else{
-            return 0;
+            return limit_;
         }
     }
     
@@ -528,7 +1237,9 @@ public:
         Pool(size_t cap) : NPool<NIOByteBuffer>([cap]()->NIOByteBuffer*{
             return new NIOByteBuffer(cap);
         }){
-            
+            this->setSizer([](const NIOByteBuffer* buf) {
+                return (size_t)buf->capacity();
+            });
         }
         
         Pool::Unique alloc(){
@@ -550,18 +1261,94 @@ public:
     }
 };
 
-class NIOByteBufferQ : public std::deque<NIOByteBuffer::unique>{
+// A byte stream kept as a queue of pooled chunks. Bytes [0, position) of each
+// chunk hold data, the front chunk is read from head_ on. Readers work on the
+// chunks in place: iovecs() for writev, span() and Slice for parsers, consume()
+// to drop what was handled; only contiguous() copies, and only when the range
+// crosses a chunk boundary.
+// The deque is a private base so that only the members below, which keep head_
+// in step, can change the chunks.
+class NIOByteBufferQ : private std::deque<NIOByteBuffer::unique>{
 private:
     using Parent = std::deque<NIOByteBuffer::unique>;
     
+public:
+    // contiguous bytes inside one chunk
+    struct Span {
+        const uint8_t *     data = nullptr;
+        size_t              size = 0;
+    };
+    
+    // A range of a queue, no bytes are copied. Valid until the queue is
+    // consumed, cleared or appended to.
+    class Slice {
+    public:
+        Slice(const NIOByteBufferQ& q, size_t offset, size_t size)
+        : q_(&q), offset_(offset), size_(size){}
+        
+        size_t size() const{
+            return size_;
+        }
+        
+        Slice slice(size_t offset, size_t size) const{
+            offset = std::min(offset, size_);
+            return Slice(*q_, offset_ + offset, std::min(size, size_ - offset));
+        }
+        
+        int iovecs(struct iovec * iov, int maxcnt) const{
+            return q_->iovecs(iov, maxcnt, offset_, size_);
+        }
+        
+        Span span(size_t offset) const{
+            if(offset >= size_){
+                return Span();
+            }
+            Span s = q_->span(offset_ + offset);
+            s.size = std::min(s.size, size_ - offset);
+            return s;
+        }
+        
+        const uint8_t * contiguous(std::vector<uint8_t>& scratch) const{
+            return q_->contiguous(offset_, size_, scratch);
+        }
+        
+        size_t copyTo(uint8_t * dst) const{
+            return q_->copyTo(offset_, dst, size_);
+        }
+        
+    private:
+        const NIOByteBufferQ *  q_;
+        size_t                  offset_;
+        size_t                  size_;
+    };
+    
 public:
     NIOByteBufferQ(){}
     
     virtual ~NIOByteBufferQ(){}
     
+    // chunks, not bytes, see bytes()
     using Parent::size;
+    using Parent::empty;
     using Parent::front;
-    using Parent::pop_front;
+    using Parent::back;
+    using Parent::begin;
+    using Parent::end;
+    
+    void pop_front(){
+        Parent::pop_front();
+        head_ = 0;
+    }
+    
+    void clear(){
+        Parent::clear();
+        head_ = 0;
+    }
+    
+    void swap(NIOByteBufferQ& other){
+        Parent::swap(other);
+        std::swap(head_, other.head_);
+    }
     
     void append(NIOByteBuffer::Pool& pool, const uint8_t * data, size_t size){
         size_t num = 0;
@@ -579,13 +1366,138 @@ public:
         this->emplace_back(std::move(buf));
     }
     
+    void append(NIOByteBuffer::unique&& buf){
+        this->emplace_back(std::move(buf));
+    }
+    
     void append(NIOByteBufferQ& other){
+        if(this->empty()){
+            head_ = other.head_;
+        }else if(other.head_ > 0 && !other.empty()){
+            // only the front chunk may start past 0, move other's unread bytes down
+            NIOByteBuffer * buf = other.front().get();
+            size_t n = buf->position() - other.head_;
+            std::memmove(buf->data(), buf->data() + other.head_, n);
+            buf->rewind();
+            buf->forward((unsigned int)n);
+        }
         while (!other.empty()) {
             this->emplace_back(std::move(other.front()));
             other.pop_front();
         }
     }
     
+    // readable bytes
+    size_t bytes() const{
+        size_t n = 0;
+        for(auto& buf : *this){
+            n += buf->position();
+        }
+        return n - head_;
+    }
+    
+    // Fills iov with the chunks covering [offset, offset+len), at most maxcnt
+    // entries; returns the entries used.
+    int iovecs(struct iovec * iov, int maxcnt, size_t offset = 0, size_t len = SIZE_MAX) const{
+        int cnt = 0;
+        forEach(offset, len, [&](const uint8_t * p, size_t n){
+            if(cnt >= maxcnt){
+                return false;
+            }
+            iov[cnt].iov_base = (void*)p;
+            iov[cnt].iov_len = n;
+            ++cnt;
+            return true;
+        });
+        return cnt;
+    }
+    
+    // the contiguous bytes from offset to the end of its chunk, empty past the end
+    Span span(size_t offset = 0) const{
+        Span s;
+        forEach(offset, SIZE_MAX, [&s](const uint8_t * p, size_t n){
+            s.data = p;
+            s.size = n;
+            return false;
+        });
+        return s;
+    }
+    
+    Slice slice(size_t offset, size_t len) const{
+        size_t total = bytes();
+        offset = std::min(offset, total);
+        return Slice(*this, offset, std::min(len, total - offset));
+    }
+    
+    // [offset, offset+len) as one block: in place when it lies inside a chunk,
+    // else copied into scratch. nullptr when the range is out of the queue.
+    const uint8_t * contiguous(size_t offset, size_t len, std::vector<uint8_t>& scratch) const{
+        Span s = span(offset);
+        if(s.size >= len){
+            return s.data;
+        }
+        if(!s.data){
+            return nullptr;
+        }
+        scratch.resize(len);
+        if(copyTo(offset, scratch.data(), len) < len){
+            return nullptr;
+        }
+        return scratch.data();
+    }
+    
+    // copies up to len bytes from offset, returns the bytes copied
+    size_t copyTo(size_t offset, uint8_t * dst, size_t len) const{
+        size_t num = 0;
+        forEach(offset, len, [&](const uint8_t * p, size_t n){
+            std::memcpy(dst + num, p, n);
+            num += n;
+            return true;
+        });
+        return num;
+    }
+    
+    // Drops n bytes from the front, chunks fully read go back to their pool.
+    // Returns the bytes dropped.
+    size_t consume(size_t n){
+        size_t num = 0;
+        while(num < n && !this->empty()){
+            size_t avail = this->front()->position() - head_;
+            if(n - num < avail){
+                head_ += n - num;
+                return n;
+            }
+            num += avail;
+            pop_front();
+        }
+        return num;
+    }
+    
+private:
+    // calls f(data, size) for each chunk piece of [offset, offset+len) until f returns false
+    template <typename F>
+    void forEach(size_t offset, size_t len, F f) const{
+        size_t skip = offset + head_;
+        for(auto& buf : *this){
+            if(0 == len){
+                return;
+            }
+            size_t used = buf->position();
+            if(skip >= used){
+                skip -= used;
+                continue;
+            }
+            size_t n = std::min(used - skip, len);
+            if(!f(buf->data() + skip, n)){
+                return;
+            }
+            len -= n;
+            skip = 0;
+        }
+    }
+    
+private:
+    size_t      head_ = 0;  // bytes already consumed of the front chunk
 };
 
 
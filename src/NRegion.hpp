@@ -29,6 +29,7 @@ namespace nmedia {
             int             height = -1;
             int             zOrder = -1;        //zOrder数字越大，所在层次越高，越不会被遮挡。
             ScalingMode     scalinglMode = ScalingMode::AspectFit;
+            int             source = -1;        //引用的输入源编号，-1表示与index相同。多个区域可以引用同一个源
             
             bool valid() const {
                 return (0 <= index)
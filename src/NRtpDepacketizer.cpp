@@ -0,0 +1,416 @@
+#include <string.h>
+#include <vector>
+
+#include "NRtpDepacketizer.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+namespace nmedia {
+	namespace video {
+
+		class RtpDepacketizerImpl : public RtpDepacketizer {
+		private:
+			static const size_t kRtpHeaderSize = 12;
+			static const uint8_t kStapA = 24;
+			static const uint8_t kFuA = 28;
+			//暂存缓冲区的大小，通常一个包一块
+			static const size_t kStashChunkSize = 2048;
+			//池中保留的空闲帧数，关键帧突发后多余的帧在空闲kPoolIdleMs后释放
+			static const size_t kIdleFrames = 4;
+			static const int64_t kPoolIdleMs = 10000;
+			static const uint8_t kStartCode[4];
+
+			//暂存的乱序包，按序号放在slots_[seq % kMaxReorderPackets]
+			struct Slot {
+				bool				used = false;
+				uint16_t			seq = 0;
+				uint32_t			timestamp = 0;
+				bool				marker = false;
+				size_t				size = 0;
+				NIOByteBufferQ		payload;
+			};
+
+			NLogger::shared				logger_ = nullptr;
+			Config						cfg_;
+			FrameFunc					func_ = nullptr;
+			NVideoFrame::Pool			framePool_;
+			NIOByteBuffer::Pool			stashPool_;
+			std::vector<Slot>			slots_;
+			int							stashed_ = 0;
+			std::vector<uint8_t>		scratch_;			//跨块的暂存包拼接到这里
+
+			bool						started_ = false;
+			uint16_t					expected_ = 0;		//下一个要处理的序号
+			uint16_t					newest_ = 0;		//暂存中最新的序号
+
+			//正在重组的帧
+			NMediaFrame::Unique			frame_ = NMediaFrame::MakeNullPtr();
+			uint32_t					frameTs_ = 0;
+			bool						corrupt_ = false;
+			bool						keyframe_ = false;
+			bool						fuStarted_ = false;	//已收到FU-A的开始分片
+			bool						lossPending_ = false;	//丢包发生在帧之间，下一帧不完整
+			bool						waitKeyframe_ = false;
+
+			bool						tsStarted_ = false;
+			uint32_t					lastTs_ = 0;
+			int64_t						extTs_ = 0;
+			Stats						stats_;
+
+		public:
+			RtpDepacketizerImpl(const std::string& name, const Config& cfg)
+				:logger_(NLogger::Get(name)), cfg_(cfg), stashPool_(kStashChunkSize), slots_(kMaxReorderPackets)
+				, waitKeyframe_(cfg.waitKeyframe) {
+				NVideoFrame::Pool::Limits limits;
+				limits.high = kIdleFrames;
+				limits.idleMs = kPoolIdleMs;
+				framePool_.setLimits(limits);
+				framePool_.setName(name + ".frames");
+				//每个暂存包通常占一块
+				limits.high = cfg.reorderPackets;
+				stashPool_.setLimits(limits);
+				stashPool_.setName(name + ".stash");
+			}
+
+			virtual ~RtpDepacketizerImpl() {}
+
+			virtual void output(const FrameFunc& func) override {
+				func_ = func;
+			}
+
+			virtual int input(const uint8_t* data, size_t size) override {
+				if (!data || size < kRtpHeaderSize || (data[0] >> 6) != 2) {
+					++stats_.invalid;
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				//跳过CSRC、扩展头和填充
+				size_t offset = kRtpHeaderSize + 4 * (data[0] & 0x0f);
+				if (data[0] & 0x10) {
+					offset = (size >= offset + 4) ? offset + 4 + 4 * ((data[offset + 2] << 8) | data[offset + 3]) : size + 1;
+				}
+				size_t end = size;
+				if ((data[0] & 0x20) && offset < end) {
+					end -= data[size - 1];
+				}
+				int payloadType = data[1] & 0x7f;
+				if (offset > end || end > size || (cfg_.payloadType >= 0 && payloadType != cfg_.payloadType)) {
+					++stats_.invalid;
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				bool marker = (data[1] & 0x80) != 0;
+				uint16_t seq = (uint16_t)((data[2] << 8) | data[3]);
+				uint32_t ts = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+				const uint8_t* payload = data + offset;
+				size_t payloadSize = end - offset;
+				++stats_.packets;
+				stats_.bytes += payloadSize;
+
+				if (!started_) {
+					started_ = true;
+					expected_ = seq;
+				}
+
+				int16_t diff = (int16_t)(seq - expected_);
+				if (diff < 0) {
+					++stats_.late;
+					return 0;
+				}
+
+				if (0 == diff) {
+					process(ts, marker, payload, payloadSize);
+					++expected_;
+				}
+				else if (diff >= kMaxReorderPackets) {
+					//序号跳变（如发送端重启），处理完暂存的包后从这个包继续
+					skipTo(seq);
+					process(ts, marker, payload, payloadSize);
+					++expected_;
+				}
+				else {
+					stash(seq, ts, marker, payload, payloadSize);
+				}
+				drain();
+				return 0;
+			}
+
+			virtual void flush() override {
+				if (stashed_ > 0) {
+					skipTo(newest_ + 1);
+				}
+				if (frame_) {
+					frame_ = nullptr;
+					++stats_.dropped;
+				}
+				framePool_.trim();
+				stashPool_.trim();
+			}
+
+			virtual const Config& getConfig() const override {
+				return cfg_;
+			}
+
+			virtual Stats getStats() const override {
+				return stats_;
+			}
+
+		private:
+			void stash(uint16_t seq, uint32_t ts, bool marker, const uint8_t* payload, size_t size) {
+				Slot& slot = slots_[seq % kMaxReorderPackets];
+				if (slot.used) {
+					//重复的包
+					++stats_.late;
+					return;
+				}
+				slot.used = true;
+				slot.seq = seq;
+				slot.timestamp = ts;
+				slot.marker = marker;
+				slot.size = size;
+				slot.payload.append(stashPool_, payload, size);
+				if (0 == stashed_ || (int16_t)(seq - newest_) > 0) {
+					newest_ = seq;
+				}
+				++stashed_;
+			}
+
+			void processSlot(Slot& slot) {
+				//包在一个池缓冲区内时直接使用，跨块时才拼接到scratch_
+				const uint8_t* payload = nullptr;
+				if (slot.size > 0) {
+					payload = slot.payload.contiguous(0, slot.size, scratch_);
+				}
+				process(slot.timestamp, slot.marker, payload, slot.size);
+
+				//缓冲区归还到池
+				slot.payload.clear();
+				slot.used = false;
+				--stashed_;
+				++stats_.reordered;
+			}
+
+			//按序处理暂存的包；缺口超过reorderPackets时跳过缺失的包
+			void drain() {
+				while (stashed_ > 0) {
+					Slot& slot = slots_[expected_ % kMaxReorderPackets];
+					if (slot.used && slot.seq == expected_) {
+						processSlot(slot);
+					}
+					else if ((int16_t)(newest_ - expected_) >= cfg_.reorderPackets) {
+						onLost(1);
+					}
+					else {
+						break;
+					}
+					++expected_;
+				}
+			}
+
+			//处理seq之前的所有暂存包，缺失的计为丢包
+			void skipTo(uint16_t seq) {
+				while (stashed_ > 0 && expected_ != seq) {
+					Slot& slot = slots_[expected_ % kMaxReorderPackets];
+					if (slot.used && slot.seq == expected_) {
+						processSlot(slot);
+					}
+					else {
+						onLost(1);
+					}
+					++expected_;
+				}
+				if (expected_ != seq) {
+					onLost((uint16_t)(seq - expected_));
+					expected_ = seq;
+				}
+			}
+
+			//缺失的包属于正在重组的帧，或者（上一帧已完整时）属于下一帧
+			void onLost(int count) {
+				stats_.lost += count;
+				if (frame_) {
+					corrupt_ = true;
+				}
+				else {
+					lossPending_ = true;
+				}
+				if (cfg_.waitKeyframe) {
+					waitKeyframe_ = true;
+				}
+			}
+
+			void process(uint32_t ts, bool marker, const uint8_t* payload, size_t size) {
+				//时间戳变化而没有收到标记位，上一帧结束
+				if (frame_ && ts != frameTs_) {
+					finishFrame();
+				}
+				if (!frame_) {
+					startFrame(ts);
+				}
+
+				if (!corrupt_ && size > 0) {
+					bool ok = (NCodec::H264 == cfg_.codec) ? appendH264(payload, size) : appendVP8(payload, size);
+					if (!ok) {
+						corrupt_ = true;
+					}
+				}
+
+				if (marker) {
+					finishFrame();
+				}
+			}
+
+			void startFrame(uint32_t ts) {
+				frame_ = framePool_.get();
+				frame_->clear();
+				frame_->setCodecType(cfg_.codec, NMedia::Video);
+				frameTs_ = ts;
+				corrupt_ = lossPending_;
+				lossPending_ = false;
+				keyframe_ = false;
+				fuStarted_ = false;
+			}
+
+			void finishFrame() {
+				NMediaFrame::Unique frame = std::move(frame_);
+				//FU-A没有结束分片
+				if (fuStarted_) {
+					corrupt_ = true;
+				}
+				int64_t pts = unwrap(frameTs_);
+				if (corrupt_ || 0 == frame->size() || (waitKeyframe_ && !keyframe_)) {
+					++stats_.dropped;
+					return;
+				}
+				waitKeyframe_ = false;
+
+				NVideoFrame* videoFrame = static_cast<NVideoFrame*>(frame.get());
+				videoFrame->ensurePadding();
+				videoFrame->setKeyframe(keyframe_);
+				videoFrame->setPts(pts);
+				++stats_.frames;
+				if (func_) {
+					func_(std::move(frame));
+				}
+			}
+
+			//RTP时间戳展开为64位
+			int64_t unwrap(uint32_t ts) {
+				if (!tsStarted_) {
+					tsStarted_ = true;
+					extTs_ = ts;
+				}
+				else {
+					extTs_ += (int32_t)(ts - lastTs_);
+				}
+				lastTs_ = ts;
+				return extTs_;
+			}
+
+			bool append(const uint8_t* data, size_t size) {
+				if (frame_->size() + size > cfg_.maxFrameSize) {
+					return false;
+				}
+				frame_->appendData(data, size);
+				return true;
+			}
+
+			bool appendNal(const uint8_t* nal, size_t size) {
+				if (5 == (nal[0] & 0x1f)) {
+					keyframe_ = true;
+				}
+				return append(kStartCode, sizeof(kStartCode)) && append(nal, size);
+			}
+
+			//还原为Annex-B；不支持交错模式的STAP-B、MTAP和FU-B
+			bool appendH264(const uint8_t* payload, size_t size) {
+				uint8_t type = payload[0] & 0x1f;
+				if (1 <= type && type <= 23) {
+					fuStarted_ = false;
+					return appendNal(payload, size);
+				}
+
+				if (kStapA == type) {
+					fuStarted_ = false;
+					size_t offset = 1;
+					while (offset + 2 <= size) {
+						size_t len = (payload[offset] << 8) | payload[offset + 1];
+						offset += 2;
+						if (0 == len || offset + len > size || !appendNal(payload + offset, len)) {
+							return false;
+						}
+						offset += len;
+					}
+					return offset == size;
+				}
+
+				if (kFuA == type && size >= 2) {
+					uint8_t fuHeader = payload[1];
+					if (fuHeader & 0x80) {
+						//NAL头由FU indicator的F、NRI和FU header的类型组成
+						uint8_t nalHeader = (payload[0] & 0xe0) | (fuHeader & 0x1f);
+						if (!appendNal(&nalHeader, 1)) {
+							return false;
+						}
+						fuStarted_ = true;
+					}
+					else if (!fuStarted_) {
+						return false;
+					}
+					if (fuHeader & 0x40) {
+						fuStarted_ = false;
+					}
+					return append(payload + 2, size - 2);
+				}
+
+				return false;
+			}
+
+			//跳过负载描述符；帧的第一个包必须是分区0的开始
+			bool appendVP8(const uint8_t* payload, size_t size) {
+				size_t offset = 1;
+				if (payload[0] & 0x80) {
+					if (size < 2) {
+						return false;
+					}
+					uint8_t ext = payload[1];
+					offset = 2;
+					if (ext & 0x80) {
+						if (offset >= size) {
+							return false;
+						}
+						offset += (payload[offset] & 0x80) ? 2 : 1;		//7位或15位PictureID
+					}
+					if (ext & 0x40) {
+						offset += 1;		//TL0PICIDX
+					}
+					if (ext & 0x30) {
+						offset += 1;		//TID和KEYIDX
+					}
+				}
+				if (offset > size) {
+					return false;
+				}
+
+				if (0 == frame_->size()) {
+					bool start = (payload[0] & 0x10) && 0 == (payload[0] & 0x07);
+					if (!start) {
+						return false;
+					}
+					//帧头P位为0表示关键帧
+					keyframe_ = offset < size && 0 == (payload[offset] & 0x01);
+				}
+				return append(payload + offset, size - offset);
+			}
+		};
+
+		const uint8_t RtpDepacketizerImpl::kStartCode[4] = { 0, 0, 0, 1 };
+
+		RtpDepacketizer::shared RtpDepacketizer::Create(const std::string& name, const Config& cfg) {
+			if (!cfg.vaild()) {
+				return nullptr;
+			}
+			return std::make_shared<RtpDepacketizerImpl>(name, cfg);
+		}
+	}
+}
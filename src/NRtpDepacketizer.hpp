@@ -0,0 +1,96 @@
+#ifndef NRtpDepacketizer_hpp
+#define NRtpDepacketizer_hpp
+
+#include <memory>
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include "NMediaFrame.hpp"
+#include "NPool.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//RTP解包：把H264（RFC 6184，单NAL、STAP-A、FU-A）和VP8（RFC 7741）的RTP包重组为完整的帧，
+		//输出NVideoFrame::Pool中的帧，可以直接交给Transcoder::input()/inputSource()
+		//按序到达的包直接追加到正在重组的帧中，负载只拷贝一次；提前到达的包暂存在池缓冲区（NIOByteBufferQ）中，等待缺失的包
+		//帧边界由标记位和时间戳变化确定，序号缺口超过reorderPackets时认为丢包，缺失所在的帧被丢弃
+		//不是线程安全的，应在接收线程中调用
+		class RtpDepacketizer {
+		public:
+			using shared = std::shared_ptr<RtpDepacketizer>;
+			//输出一个完整的帧，pts为展开后的RTP时间戳（90kHz）
+			using FrameFunc = std::function<void(NMediaFrame::Unique frame)>;
+
+			//暂存乱序包的最大个数
+			static const int kMaxReorderPackets = 256;
+
+			struct Config {
+				NCodec::Type codec = NCodec::Type::UNKNOWN;
+				int payloadType = -1;				//-1为不检查
+				int reorderPackets = 32;			//序号缺口超过这个包数时认为丢包
+				size_t maxFrameSize = 8 * 1024 * 1024;
+				bool waitKeyframe = true;			//开始和丢包后丢弃非关键帧，直到下一个关键帧
+
+				bool vaild() const {
+					return (NCodec::Type::H264 == codec || NCodec::Type::VP8 == codec)
+						&& (payloadType < 128)
+						&& (0 < reorderPackets && reorderPackets <= kMaxReorderPackets)
+						&& (0 < maxFrameSize);
+				}
+			};
+
+			struct Stats {
+				int64_t packets = 0;		//收到的RTP包
+				int64_t bytes = 0;			//负载字节数
+				int64_t frames = 0;			//输出的帧
+				int64_t dropped = 0;		//因丢包、格式错误或等待关键帧而丢弃的帧
+				int64_t lost = 0;			//序号缺失的包
+				int64_t late = 0;			//晚于已处理序号到达而丢弃的包
+				int64_t reordered = 0;		//经暂存后按序处理的包
+				int64_t invalid = 0;		//不是可用RTP包的输入
+
+				const std::string dump() const {
+					return fmt::format("[packets={}, bytes={}, frames={}, dropped={}, lost={}, late={}, reordered={}, invalid={}]"
+						, packets
+						, bytes
+						, frames
+						, dropped
+						, lost
+						, late
+						, reordered
+						, invalid);
+				}
+			};
+
+		public:
+			RtpDepacketizer() {}
+
+			virtual ~RtpDepacketizer() {}
+
+			//设置帧输出回调，在input()/flush()中调用
+			virtual void output(const FrameFunc& func) = 0;
+
+			//输入一个RTP包，数据在返回后不再被引用
+			// 0 : 成功（包可能被暂存或丢弃，见Stats）
+			// EXTERNAL_PARAM_NOT_VAILD : 不是可用的RTP包或负载类型不符
+			virtual int input(const uint8_t* data, size_t size) = 0;
+
+			//流结束时调用：按序处理暂存的包（跳过缺口），未收到标记位的最后一帧被丢弃
+			virtual void flush() = 0;
+
+			virtual const Config& getConfig() const = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//创建一个RtpDepacketizer实例
+			// nullptr : cfg参数不可用
+			static
+			shared Create(const std::string& name, const Config& cfg);
+		};
+	}
+}
+
+#endif //NRtpDepacketizer_hpp
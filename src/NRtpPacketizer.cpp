@@ -0,0 +1,290 @@
+#include <string.h>
+#include <vector>
+
+#include "NRtpPacketizer.hpp"
+#include "NVideoInspector.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+namespace nmedia {
+	namespace video {
+
+		class RtpPacketizerImpl : public RtpPacketizer {
+		private:
+			static const size_t kRtpHeaderSize = 12;
+			static const size_t kVP8DescriptorSize = 4;		//X位、I位和15位PictureID
+			static const uint8_t kStapA = 24;
+			static const uint8_t kFuA = 28;
+			//头部缓冲区的大小，一帧的头部通常只占一两个
+			static const size_t kHeaderChunkSize = 2048;
+			static const size_t kIdleHeaderChunks = 16;
+			static const int64_t kPoolIdleMs = 10000;
+
+			struct Nal {
+				const uint8_t*	data;
+				size_t			size;
+			};
+
+			NLogger::shared				logger_ = nullptr;
+			Config						cfg_;
+			NIOByteBuffer::Pool			headerPool_;
+			uint16_t					seq_ = 0;
+			uint16_t					pictureId_ = 0;
+			std::vector<Nal>			nals_;
+			RtpFrame					frame_;				//packetFunc()使用
+			Stats						stats_;
+
+		public:
+			RtpPacketizerImpl(const std::string& name, const Config& cfg)
+				:logger_(NLogger::Get(name)), cfg_(cfg), headerPool_(kHeaderChunkSize), seq_(cfg.initialSeq) {
+				NIOByteBuffer::Pool::Limits limits;
+				limits.high = kIdleHeaderChunks;
+				limits.idleMs = kPoolIdleMs;
+				headerPool_.setLimits(limits);
+				headerPool_.setName(name + ".headers");
+			}
+
+			virtual ~RtpPacketizerImpl() {
+				frame_.clear();
+			}
+
+			virtual int packetize(const EncodedPacket::shared& pkt, RtpFrame* frame) override {
+				if (!pkt || pkt->codecType() != cfg_.codec || !frame) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				frame->clear();
+				frame->packet_ = pkt;
+				//RTP视频时钟为90kHz
+				frame->timestamp_ = (uint32_t)((pkt->pts() * 90000 * pkt->timebaseNum()) / pkt->timebaseDen());
+
+				if (NCodec::H264 == cfg_.codec) {
+					packetizeH264(*pkt, frame);
+				}
+				else {
+					packetizeVP8(*pkt, frame);
+				}
+
+				if (!frame->packets_.empty()) {
+					frame->packets_.back().marker = true;
+					//标记位在RTP头第2字节的最高位
+					uint8_t* header = (uint8_t*)frame->iovs_[frame->packets_.back().iov].iov_base;
+					header[1] |= 0x80;
+				}
+
+				++stats_.frames;
+				stats_.packets += frame->packets_.size();
+				for (auto& p : frame->packets_) {
+					stats_.bytes += p.size;
+				}
+				return 0;
+			}
+
+			virtual uint16_t nextSeq() const override {
+				return seq_;
+			}
+
+			virtual const Config& getConfig() const override {
+				return cfg_;
+			}
+
+			virtual Stats getStats() const override {
+				return stats_;
+			}
+
+			virtual Transcoder::PacketFunc packetFunc(const FrameFunc& func) override {
+				return [this, func](const EncodedPacket::shared& pkt) {
+					if (!packetize(pkt, &frame_) && func) {
+						func(frame_);
+					}
+				};
+			}
+
+		private:
+			//在头部缓冲区中分配size字节，同一RTP包的各段头部不要求连续
+			uint8_t* allocHeader(RtpFrame* frame, size_t size) {
+				if (frame->headers_.empty() || frame->headers_.back()->remaining() < size) {
+					frame->headers_.append(headerPool_.alloc());
+				}
+				NIOByteBuffer* buf = frame->headers_.back().get();
+				uint8_t* p = buf->next();
+				buf->forward(size);
+				return p;
+			}
+
+			void addSegment(RtpFrame* frame, const uint8_t* data, size_t size) {
+				//与上一段连续时合并，头部缓冲区中相邻的头部常常可以合并
+				if (frame->packets_.back().iovcnt > 0) {
+					struct iovec& last = frame->iovs_.back();
+					if ((const uint8_t*)last.iov_base + last.iov_len == data) {
+						last.iov_len += size;
+						frame->packets_.back().size += size;
+						return;
+					}
+				}
+				struct iovec v;
+				v.iov_base = (void*)data;
+				v.iov_len = size;
+				frame->iovs_.push_back(v);
+				frame->packets_.back().iovcnt += 1;
+				frame->packets_.back().size += size;
+			}
+
+			//开始一个RTP包，写入RTP头，extra为紧跟其后的负载头长度，返回负载头的位置
+			uint8_t* beginPacket(RtpFrame* frame, size_t extra) {
+				RtpFrame::Packet p;
+				p.iov = frame->iovs_.size();
+				p.seq = seq_++;
+				frame->packets_.push_back(p);
+
+				uint8_t* h = allocHeader(frame, kRtpHeaderSize + extra);
+				h[0] = 0x80;		//V=2
+				h[1] = cfg_.payloadType;
+				h[2] = (uint8_t)(p.seq >> 8);
+				h[3] = (uint8_t)(p.seq);
+				h[4] = (uint8_t)(frame->timestamp_ >> 24);
+				h[5] = (uint8_t)(frame->timestamp_ >> 16);
+				h[6] = (uint8_t)(frame->timestamp_ >> 8);
+				h[7] = (uint8_t)(frame->timestamp_);
+				h[8] = (uint8_t)(cfg_.ssrc >> 24);
+				h[9] = (uint8_t)(cfg_.ssrc >> 16);
+				h[10] = (uint8_t)(cfg_.ssrc >> 8);
+				h[11] = (uint8_t)(cfg_.ssrc);
+				addSegment(frame, h, kRtpHeaderSize + extra);
+				return h + kRtpHeaderSize;
+			}
+
+			//拆分Annex-B为NAL单元，不含起始码
+			void splitNals(const uint8_t* data, size_t size) {
+				nals_.clear();
+				const uint8_t* end = data + size;
+				const uint8_t* sc = NVideoInspector::FindStartCode(data, end);
+				while (sc < end) {
+					const uint8_t* nal = sc + 3;
+					const uint8_t* next = NVideoInspector::FindStartCode(nal, end);
+					//去掉尾部的0（下一个4字节起始码的前导0或trailing_zero）
+					const uint8_t* nalEnd = next;
+					while (nalEnd > nal && nalEnd[-1] == 0) {
+						--nalEnd;
+					}
+					if (nalEnd > nal) {
+						nals_.push_back({ nal, (size_t)(nalEnd - nal) });
+					}
+					sc = next;
+				}
+			}
+
+			void packetizeH264(const EncodedPacket& pkt, RtpFrame* frame) {
+				const size_t maxPayload = cfg_.mtu - kRtpHeaderSize;
+				splitNals(pkt.data(), pkt.size());
+
+				size_t i = 0;
+				while (i < nals_.size()) {
+					const Nal& nal = nals_[i];
+
+					if (nal.size > maxPayload) {
+						packetizeFuA(nal, maxPayload, frame);
+						++i;
+						continue;
+					}
+
+					//尽量把后续的小NAL合并为STAP-A：1字节STAP头，每个NAL加2字节长度
+					size_t count = 1;
+					size_t stapSize = 1 + 2 + nal.size;
+					if (cfg_.aggregate) {
+						while (i + count < nals_.size() && stapSize + 2 + nals_[i + count].size <= maxPayload) {
+							stapSize += 2 + nals_[i + count].size;
+							++count;
+						}
+					}
+
+					if (1 == count) {
+						beginPacket(frame, 0);
+						addSegment(frame, nal.data, nal.size);
+						++stats_.single;
+						++i;
+						continue;
+					}
+
+					//STAP-A的F位为各NAL的或，NRI取最大值
+					uint8_t f = 0;
+					uint8_t nri = 0;
+					for (size_t k = i; k < i + count; ++k) {
+						f |= nals_[k].data[0] & 0x80;
+						nri = std::max<uint8_t>(nri, nals_[k].data[0] & 0x60);
+					}
+					uint8_t* h = beginPacket(frame, 3);
+					h[0] = f | nri | kStapA;
+					h[1] = (uint8_t)(nal.size >> 8);
+					h[2] = (uint8_t)(nal.size);
+					addSegment(frame, nal.data, nal.size);
+					for (size_t k = i + 1; k < i + count; ++k) {
+						uint8_t* len = allocHeader(frame, 2);
+						len[0] = (uint8_t)(nals_[k].size >> 8);
+						len[1] = (uint8_t)(nals_[k].size);
+						addSegment(frame, len, 2);
+						addSegment(frame, nals_[k].data, nals_[k].size);
+					}
+					++stats_.stapA;
+					i += count;
+				}
+			}
+
+			//FU-A分片，NAL头不发送，由FU indicator和FU header携带；各分片长度尽量均匀
+			void packetizeFuA(const Nal& nal, size_t maxPayload, RtpFrame* frame) {
+				const uint8_t* p = nal.data + 1;
+				size_t remaining = nal.size - 1;
+				const size_t maxFragment = maxPayload - 2;
+				const size_t fragments = (remaining + maxFragment - 1) / maxFragment;
+				const size_t fragment = (remaining + fragments - 1) / fragments;
+
+				bool first = true;
+				while (remaining > 0) {
+					size_t len = std::min(fragment, remaining);
+					uint8_t* h = beginPacket(frame, 2);
+					h[0] = (nal.data[0] & 0xe0) | kFuA;
+					h[1] = (nal.data[0] & 0x1f) | (first ? 0x80 : 0) | (len == remaining ? 0x40 : 0);
+					addSegment(frame, p, len);
+					p += len;
+					remaining -= len;
+					first = false;
+					++stats_.fuA;
+				}
+			}
+
+			void packetizeVP8(const EncodedPacket& pkt, RtpFrame* frame) {
+				const size_t maxFragment = cfg_.mtu - kRtpHeaderSize - kVP8DescriptorSize;
+				const uint8_t* p = pkt.data();
+				size_t remaining = pkt.size();
+				if (!remaining) {
+					return;
+				}
+				const size_t fragments = (remaining + maxFragment - 1) / maxFragment;
+				const size_t fragment = (remaining + fragments - 1) / fragments;
+				const uint16_t pid = pictureId_++ & 0x7fff;
+
+				bool first = true;
+				while (remaining > 0) {
+					size_t len = std::min(fragment, remaining);
+					uint8_t* d = beginPacket(frame, kVP8DescriptorSize);
+					//X=1，S=1表示分区0的起始，PID=0
+					d[0] = 0x80 | (first ? 0x10 : 0);
+					d[1] = 0x80;					//I=1
+					d[2] = 0x80 | (uint8_t)(pid >> 8);	//M=1，15位PictureID
+					d[3] = (uint8_t)(pid);
+					addSegment(frame, p, len);
+					p += len;
+					remaining -= len;
+					first = false;
+				}
+			}
+		};
+
+		RtpPacketizer::shared RtpPacketizer::Create(const std::string& name, const Config& cfg) {
+			if (!cfg.vaild()) {
+				return nullptr;
+			}
+			return std::make_shared<RtpPacketizerImpl>(name, cfg);
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#ifndef NRtpPacketizer_hpp
+#define NRtpPacketizer_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "NVideoTranscoder.hpp"
+#include "NMediaBasic.hpp"
+#include "NPool.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//一帧打包后的RTP包，分散/聚集形式
+		//每个RTP包是iovs()中连续的若干段：RTP头和负载头（FU、STAP-A长度、VP8描述符）在池中的小缓冲区里，
+		//负载直接引用编码包的数据，不拷贝。帧持有编码包的引用，可以保留到发送完成
+		//对象可以复用，packetize()时清空但保留容量；头部缓冲区归还到打包器的池，池不是线程安全的，应在打包线程中释放
+		class RtpFrame {
+		public:
+			struct Packet {
+				size_t		iov = 0;			//第一段在iovs()中的下标
+				size_t		iovcnt = 0;			//段数
+				size_t		size = 0;			//RTP包总长度
+				uint16_t	seq = 0;
+				bool		marker = false;
+			};
+
+		public:
+			const std::vector<Packet>& packets() const {
+				return packets_;
+			}
+
+			const std::vector<struct iovec>& iovs() const {
+				return iovs_;
+			}
+
+			//第i个RTP包的段
+			const struct iovec* iov(size_t i) const {
+				return &iovs_[packets_[i].iov];
+			}
+
+			uint32_t timestamp() const {
+				return timestamp_;
+			}
+
+			//拷贝第i个RTP包到dst，用于不支持分散写的发送方式，返回长度
+			size_t copyPacket(size_t i, uint8_t* dst, size_t capacity) const {
+				const Packet& p = packets_[i];
+				size_t n = 0;
+				for (size_t k = 0; k < p.iovcnt && n < capacity; ++k) {
+					const struct iovec& v = iovs_[p.iov + k];
+					size_t len = std::min(v.iov_len, capacity - n);
+					memcpy(dst + n, v.iov_base, len);
+					n += len;
+				}
+				return n;
+			}
+
+			void swap(RtpFrame& other) {
+				packets_.swap(other.packets_);
+				iovs_.swap(other.iovs_);
+				headers_.swap(other.headers_);
+				packet_.swap(other.packet_);
+				std::swap(timestamp_, other.timestamp_);
+			}
+
+			void clear() {
+				packets_.clear();
+				iovs_.clear();
+				headers_.clear();
+				packet_ = nullptr;
+			}
+
+		private:
+			friend class RtpPacketizerImpl;
+
+			std::vector<Packet>					packets_;
+			std::vector<struct iovec>			iovs_;
+			NIOByteBufferQ						headers_;		//头部所在的池缓冲区
+			EncodedPacket::shared				packet_ = nullptr;
+			uint32_t							timestamp_ = 0;
+		};
+
+		//RTP打包：H264按RFC 6184非交错模式（单NAL、STAP-A聚合、FU-A分片），VP8按RFC 7741（带15位PictureID的描述符）
+		//输入为编码包（H264为Annex-B），输出RtpFrame，负载不拷贝
+		class RtpPacketizer {
+		public:
+			using shared = std::shared_ptr<RtpPacketizer>;
+			//每打包完一帧回调一次，frame只在回调期间有效，需要保留时交换到自己的RtpFrame
+			using FrameFunc = std::function<void(RtpFrame& frame)>;
+
+			struct Config {
+				NCodec::Type codec = NCodec::Type::UNKNOWN;
+				uint8_t payloadType = 96;
+				uint32_t ssrc = 0;
+				uint16_t initialSeq = 0;
+				size_t mtu = 1200;				//RTP包（含RTP头）的最大长度
+				bool aggregate = true;			//H264小NAL合并为STAP-A
+
+				bool vaild() const {
+					return (NCodec::Type::H264 == codec || NCodec::Type::VP8 == codec)
+						&& (payloadType < 128)
+						&& (64 <= mtu && mtu <= 65000);
+				}
+			};
+
+			struct Stats {
+				int64_t frames = 0;
+				int64_t packets = 0;
+				int64_t bytes = 0;			//RTP包总字节数
+				int64_t single = 0;			//H264单NAL包
+				int64_t stapA = 0;			//H264 STAP-A包
+				int64_t fuA = 0;			//H264 FU-A包
+
+				const std::string dump() const {
+					return fmt::format("[frames={}, packets={}, bytes={}, single={}, stapA={}, fuA={}]"
+						, frames
+						, packets
+						, bytes
+						, single
+						, stapA
+						, fuA);
+				}
+			};
+
+		public:
+			RtpPacketizer() {}
+
+			virtual ~RtpPacketizer() {}
+
+			//打包一个编码包
+			// 0 : 成功
+			// EXTERNAL_PARAM_NOT_VAILD : pkt为空或编码类型与配置不符
+			virtual int packetize(const EncodedPacket::shared& pkt, RtpFrame* frame) = 0;
+
+			//下一个RTP包的序号
+			virtual uint16_t nextSeq() const = 0;
+
+			virtual const Config& getConfig() const = 0;
+
+			virtual Stats getStats() const = 0;
+
+			//接到Transcoder::outputPacket()的回调，每帧打包后调用func
+			virtual Transcoder::PacketFunc packetFunc(const FrameFunc& func) = 0;
+
+			//创建一个RtpPacketizer实例
+			// nullptr : cfg参数不可用
+			static
+			shared Create(const std::string& name, const Config& cfg);
+		};
+	}
+}
+
+#endif //NRtpPacketizer_hpp
@@ -19,6 +19,9 @@
 #define	ALREADY_OPENED_REGION		-15		//区域region已开启
 #define NOT_OPENED_TRANSCODER		-16		//转码器未开启
 #define ALREADY_OPENED_TRANSCODER	-17		//转码器已开启
+#define NOT_STARTED_HOST			-18		//转码宿主未启动
+#define HOST_OVERLOADED				-19		//转码宿主负载超限
+#define FAILED_OPEN_FILE			-20		//打开文件失败
 
 
 
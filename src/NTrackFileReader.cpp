@@ -0,0 +1,394 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "NTrackFileReader.hpp"
+#include "NVideoInspector.hpp"
+#include "NMediaFrame.hpp"
+#include "NTErrorDefined.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+    inline uint32_t rl32(const uint8_t * p){
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    inline uint16_t rl16(const uint8_t * p){
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    inline uint64_t rl64(const uint8_t * p){
+        return (uint64_t)rl32(p) | ((uint64_t)rl32(p + 4) << 32);
+    }
+
+    // H264 NAL units that start a new access unit once the current one has a slice
+    inline bool startsAccessUnit(const uint8_t * nal, const uint8_t * end){
+        int type = nal[0] & 0x1f;
+        switch(type){
+            case 6: case 7: case 8: case 9:
+            case 14: case 15: case 16: case 17: case 18:
+                return true;
+            case 1: case 5:
+                // first_mb_in_slice == 0, ue(v) of 0 is a single 1 bit
+                return (nal + 1 < end) && (nal[1] & 0x80);
+            default:
+                return false;
+        }
+    }
+
+    inline bool isSlice(const uint8_t * nal){
+        int type = nal[0] & 0x1f;
+        return type == 1 || type == 5;
+    }
+
+    class NTrackFileReaderImpl : public NTrackFileReader{
+    private:
+        static const size_t kIVFHeaderSize = 32;
+        static const size_t kIVFFrameHeaderSize = 12;
+        // prefetch this far ahead of the read position
+        static const size_t kReadAheadSize = 4*1024*1024;
+
+        struct Entry{
+            size_t      offset;
+            uint32_t    size;
+            int64_t     time;   // milliseconds
+        };
+
+    public:
+        NTrackFileReaderImpl(){ }
+
+        virtual ~NTrackFileReaderImpl(){
+            close();
+        }
+
+        virtual int open(const std::string& path, Format fmt, int framerate) override {
+            close();
+            if(framerate <= 0){
+                return EXTERNAL_PARAM_NOT_VAILD;
+            }
+
+            if(map(path) < 0){
+                close();
+                return FAILED_OPEN_FILE;
+            }
+
+            if(fmt == Auto){
+                fmt = detect();
+            }
+            format_ = fmt;
+
+            bool ok = false;
+            switch(fmt){
+                case LengthPrefixed:    ok = indexLengthPrefixed(framerate); break;
+                case AnnexB:            ok = indexAnnexB(framerate); break;
+                case IVF:               ok = indexIVF(); break;
+                default:                break;
+            }
+            if(!ok || index_.empty()){
+                close();
+                return FAILED_OPEN_FILE;
+            }
+
+#ifndef _WIN32
+            // the index pass touched every header, from now on the file is read once front to back
+            madvise(base_, mapSize_, MADV_SEQUENTIAL);
+#endif
+            prefetched_ = 0;
+            prefetch(0);
+            return 0;
+        }
+
+        virtual int64_t time() override {
+            return (cur_ < index_.size()) ? index_[cur_].time : -1;
+        }
+
+        virtual int next() override {
+            if(!data_){
+                return -1;
+            }
+            cur_ = next_;
+            if(cur_ >= index_.size()){
+                return 0;
+            }
+            ++next_;
+            const Entry& e = index_[cur_];
+            if(e.offset + e.size + kReadAheadSize / 2 > prefetched_){
+                prefetch(e.offset);
+            }
+            return (int)e.size;
+        }
+
+        virtual uint8_t * data() override {
+            return (cur_ < index_.size()) ? data_ + index_[cur_].offset : nullptr;
+        }
+
+        virtual void close() override {
+#ifdef _WIN32
+            buffer_.clear();
+            buffer_.shrink_to_fit();
+#else
+            if(base_){
+                munmap(base_, mapSize_);
+            }
+#endif
+            base_ = nullptr;
+            data_ = nullptr;
+            size_ = 0;
+            mapSize_ = 0;
+            index_.clear();
+            cur_ = (size_t)-1;
+            next_ = 0;
+            codec_ = NCodec::UNKNOWN;
+            videoSize_ = NVideoSize();
+        }
+
+        virtual Format format() const override {
+            return format_;
+        }
+
+        virtual NCodec::Type codec() const override {
+            return codec_;
+        }
+
+        virtual NVideoSize videoSize() const override {
+            return videoSize_;
+        }
+
+        virtual size_t frames() const override {
+            return index_.size();
+        }
+
+        virtual size_t size() const override {
+            return (cur_ < index_.size()) ? index_[cur_].size : 0;
+        }
+
+        virtual int seek(size_t index) override {
+            if(index >= index_.size()){
+                return EXTERNAL_PARAM_NOT_VAILD;
+            }
+            next_ = index;
+            cur_ = (size_t)-1;
+            prefetch(index_[index].offset);
+            return 0;
+        }
+
+    private:
+        // map the file followed by zeroed padding
+        int map(const std::string& path){
+            const size_t padding = NVideoFrame::kPaddingSize;
+#ifdef _WIN32
+            FILE * fp = fopen(path.c_str(), "rb");
+            if(!fp){
+                return -1;
+            }
+            fseek(fp, 0, SEEK_END);
+            long len = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+            if(len <= 0){
+                fclose(fp);
+                return -1;
+            }
+            buffer_.assign((size_t)len + padding, 0);
+            size_t got = fread(buffer_.data(), 1, (size_t)len, fp);
+            fclose(fp);
+            if(got != (size_t)len){
+                return -1;
+            }
+            size_ = (size_t)len;
+            data_ = buffer_.data();
+            return 0;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                return -1;
+            }
+            struct stat st;
+            if(fstat(fd, &st) < 0 || st.st_size <= 0){
+                ::close(fd);
+                return -1;
+            }
+            size_ = (size_t)st.st_size;
+
+            // reserve file + padding as zeroed anonymous memory, then map the file over the front,
+            // so the bytes after the end of file are always readable zeros
+            const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            mapSize_ = (size_ + padding + page - 1) / page * page;
+            void * base = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(base == MAP_FAILED){
+                ::close(fd);
+                return -1;
+            }
+            base_ = base;
+            // private and writable so data() can hand out non-const pointers, writes never reach the file
+            void * file = mmap(base, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+            ::close(fd);
+            if(file == MAP_FAILED){
+                return -1;
+            }
+            data_ = (uint8_t *)base;
+            return 0;
+#endif
+        }
+
+        // hint the kernel to read the next window ahead of the reader
+        void prefetch(size_t offset){
+            prefetched_ = offset + kReadAheadSize;
+#ifndef _WIN32
+            const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t begin = offset / page * page;
+            if(begin < size_){
+                size_t len = size_ - begin;
+                if(len > kReadAheadSize){
+                    len = kReadAheadSize;
+                }
+                madvise(data_ + begin, len, MADV_WILLNEED);
+            }
+#endif
+        }
+
+        Format detect() const {
+            if(size_ >= kIVFHeaderSize && memcmp(data_, "DKIF", 4) == 0){
+                return IVF;
+            }
+            if(size_ >= 4 && data_[0] == 0 && data_[1] == 0
+               && (data_[2] == 1 || (data_[2] == 0 && data_[3] == 1))){
+                return AnnexB;
+            }
+            return LengthPrefixed;
+        }
+
+        bool indexLengthPrefixed(int framerate){
+            codec_ = NCodec::UNKNOWN;
+            size_t pos = 0;
+            while(pos + sizeof(int) <= size_){
+                int len = 0;
+                memcpy(&len, data_ + pos, sizeof(int));
+                pos += sizeof(int);
+                if(len <= 0 || (size_t)len > size_ - pos){
+                    // a truncated tail, keep what was complete
+                    break;
+                }
+                if(index_.empty()){
+                    codec_ = codecOf(data_ + pos, (size_t)len);
+                }
+                index_.push_back({ pos, (uint32_t)len, (int64_t)index_.size() * 1000 / framerate });
+                pos += len;
+            }
+            return true;
+        }
+
+        // the recordings hold Annex-B H.264 access units or VP8 frames, a stream starts with a key frame
+        static NCodec::Type codecOf(const uint8_t * p, size_t len){
+            if(len >= 4 && p[0] == 0 && p[1] == 0
+               && (p[2] == 1 || (p[2] == 0 && p[3] == 1))){
+                return NCodec::H264;
+            }
+            // VP8 key frame: 3 byte frame tag with bit 0 clear, then the start code 9d 01 2a
+            if(len >= 10 && (p[0] & 0x01) == 0 && p[3] == 0x9d && p[4] == 0x01 && p[5] == 0x2a){
+                return NCodec::VP8;
+            }
+            return NCodec::UNKNOWN;
+        }
+
+        bool indexAnnexB(int framerate){
+            codec_ = NCodec::H264;
+            const uint8_t * end = data_ + size_;
+            const uint8_t * au = nullptr;       // start of the current access unit
+            bool hasSlice = false;
+
+            const uint8_t * sc = NVideoInspector::FindStartCode(data_, end);
+            while(sc < end){
+                const uint8_t * nal = sc + 3;
+                if(nal >= end){
+                    break;
+                }
+                // include the leading zero_byte of a 4 byte start code
+                const uint8_t * unit = (sc > data_ && sc[-1] == 0) ? sc - 1 : sc;
+                if(!au){
+                    au = unit;
+                }
+                else if(hasSlice && startsAccessUnit(nal, end)){
+                    addUnit(au, unit, framerate);
+                    au = unit;
+                    hasSlice = false;
+                }
+                hasSlice = hasSlice || isSlice(nal);
+                sc = NVideoInspector::FindStartCode(nal, end);
+            }
+            if(au){
+                addUnit(au, end, framerate);
+            }
+            return true;
+        }
+
+        void addUnit(const uint8_t * begin, const uint8_t * end, int framerate){
+            index_.push_back({ (size_t)(begin - data_), (uint32_t)(end - begin), (int64_t)index_.size() * 1000 / framerate });
+        }
+
+        bool indexIVF(){
+            if(size_ < kIVFHeaderSize){
+                return false;
+            }
+            const uint8_t * h = data_;
+            size_t headerSize = rl16(h + 6);
+            if(headerSize < kIVFHeaderSize || headerSize > size_){
+                return false;
+            }
+            if(memcmp(h + 8, "VP80", 4) == 0){
+                codec_ = NCodec::VP8;
+            }else if(memcmp(h + 8, "H264", 4) == 0){
+                codec_ = NCodec::H264;
+            }else{
+                return false;
+            }
+            videoSize_ = NVideoSize(rl16(h + 12), rl16(h + 14));
+            // time base is scale / rate seconds
+            uint32_t rate = rl32(h + 16);
+            uint32_t scale = rl32(h + 20);
+            if(rate == 0 || scale == 0){
+                rate = 1000;
+                scale = 1;
+            }
+
+            size_t pos = headerSize;
+            while(pos + kIVFFrameHeaderSize <= size_){
+                uint32_t len = rl32(data_ + pos);
+                uint64_t pts = rl64(data_ + pos + 4);
+                pos += kIVFFrameHeaderSize;
+                if(len == 0 || len > size_ - pos){
+                    break;
+                }
+                index_.push_back({ pos, len, (int64_t)(pts * scale * 1000 / rate) });
+                pos += len;
+            }
+            return true;
+        }
+
+    private:
+        Format                  format_ = Auto;
+        NCodec::Type            codec_ = NCodec::UNKNOWN;
+        NVideoSize              videoSize_;
+        void *                  base_ = nullptr;
+        size_t                  mapSize_ = 0;
+        uint8_t *               data_ = nullptr;
+        size_t                  size_ = 0;      // file size
+#ifdef _WIN32
+        std::vector<uint8_t>    buffer_;
+#endif
+        std::vector<Entry>      index_;
+        size_t                  cur_ = (size_t)-1;
+        size_t                  next_ = 0;
+        size_t                  prefetched_ = 0;
+    };
+}
+
+NTrackFileReader::shared NTrackFileReader::Create(){
+    return std::make_shared<NTrackFileReaderImpl>();
+}
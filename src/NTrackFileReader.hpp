@@ -0,0 +1,78 @@
+
+#ifndef NTrackFileReader_hpp
+#define NTrackFileReader_hpp
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include "NMediaBasic.hpp"
+
+// TrackFileReader over a memory mapped file
+//
+// The whole file is mapped and indexed on open(), data() points straight into
+// the mapping, so reading a frame is neither a syscall nor an allocation.
+// At least NVideoFrame::kPaddingSize bytes after any frame are readable: the
+// following frame, or zeroed padding behind the end of file. They are not
+// zero in general, copy into a NVideoFrame when zeroed padding is required.
+//
+// Supported layouts:
+//   LengthPrefixed : int (native byte order) size + payload, e.g. the .h264p recordings
+//   AnnexB         : raw H.264 byte stream, split into access units
+//   IVF            : 32 byte DKIF header + (uint32 size, uint64 pts) frame headers, e.g. VP8
+class NTrackFileReader : public TrackFileReader {
+public:
+    using shared = std::shared_ptr<NTrackFileReader>;
+
+    enum Format {
+        Auto = 0,       // IVF if it has the DKIF signature, AnnexB if it starts with a start code, else LengthPrefixed
+        LengthPrefixed,
+        AnnexB,
+        IVF
+    };
+
+    static const char* GetNameFor(Format fmt){
+        switch (fmt){
+            case Auto:              return "auto";
+            case LengthPrefixed:    return "length-prefixed";
+            case AnnexB:            return "annexb";
+            case IVF:               return "ivf";
+            default:                return "unknown";
+        }
+    }
+
+public:
+    virtual ~NTrackFileReader(){}
+
+    // map and index the file
+    // framerate gives time() for layouts without timestamps
+    // 0 : success
+    // EXTERNAL_PARAM_NOT_VAILD : framerate <= 0
+    // FAILED_OPEN_FILE : can not open or map the file, or no frame found
+    virtual int open(const std::string& path, Format fmt = Auto, int framerate = 25) = 0;
+
+    virtual Format format() const = 0;
+
+    // H264 for AnnexB, from the fourcc for IVF
+    // LengthPrefixed is told by the first frame: H264 if it starts with a start
+    // code, VP8 if it is a VP8 key frame, UNKNOWN otherwise
+    virtual NCodec::Type codec() const = 0;
+
+    // from the IVF header, 0x0 otherwise
+    virtual NVideoSize videoSize() const = 0;
+
+    // number of frames in the file
+    virtual size_t frames() const = 0;
+
+    // size of the current frame, same as the last next() result
+    virtual size_t size() const = 0;
+
+    // next() returns frame index next
+    // 0 : success
+    // EXTERNAL_PARAM_NOT_VAILD : index out of range
+    virtual int seek(size_t index) = 0;
+
+    static
+    shared Create();
+};
+
+#endif /* NTrackFileReader_hpp */
@@ -0,0 +1,525 @@
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+
+#include "NTranscoderHost.hpp"
+#include "NLogger.hpp"
+#include "NTErrorDefined.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+namespace nmedia {
+	namespace video {
+
+		//当前线程消耗的CPU时间
+		static
+		inline int64_t threadCpuNs() {
+#ifdef _WIN32
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+			struct timespec ts;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+			return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+		}
+
+		class TranscoderHostImpl : public TranscoderHost {
+		private:
+			//负载采样周期
+			static const int64_t kLoadSampleNs = 1000000000LL;
+			//负载的指数平滑系数
+			static constexpr double kLoadAlpha = 0.3;
+
+			struct Task {
+				Stage			stage = Stage::Decode;
+				TimePoint		deadline;
+				TaskFunc		func;
+			};
+
+			struct Session {
+				using shared = std::shared_ptr<Session>;
+
+				int						id = -1;
+				std::string				name;
+				Transcoder::shared		transcoder;
+				int						home = 0;			//首选工作线程
+				int						timerId = -1;		//输出时钟定时器，受sessionsMutex_保护
+
+				std::mutex				mutex;
+				std::deque<Task>		pending;			//按截止时间排序
+				bool					scheduled = false;	//是否已在某个工作线程队列中
+				bool					closed = false;
+
+				std::atomic<int64_t>	cpuNs[(int)Stage::Count];
+				std::atomic<int64_t>	tasks{ 0 };
+				std::atomic<int64_t>	lateTasks{ 0 };
+
+				//负载测量，受TranscoderHostImpl::sessionsMutex_保护
+				double					load = 0;
+				bool					measured = false;
+				int64_t					sampleCpuNs = 0;
+				TimePoint				sampleTime;
+
+				Session() {
+					for (auto& ns : cpuNs) {
+						ns = 0;
+					}
+				}
+
+				int64_t totalCpuNs() const {
+					int64_t sum = 0;
+					for (auto& ns : cpuNs) {
+						sum += ns.load(std::memory_order_relaxed);
+					}
+					return sum;
+				}
+			};
+
+			struct Item {
+				TimePoint			deadline;
+				Session::shared		session;
+			};
+
+			//工作线程队列：队首截止时间最早，由本线程取出；队尾截止时间最晚，由其他线程窃取
+			struct Worker {
+				std::mutex			mutex;
+				std::deque<Item>	items;
+				std::thread			thread;
+			};
+
+		private:
+			NLogger::shared								logger_ = nullptr;
+			Config										cfg_;
+			std::mutex									workersMutex_;		//保护workers_的创建和清空，见enqueue()
+			std::vector<std::unique_ptr<Worker>>		workers_;
+			std::atomic<bool>							running_{ false };
+			std::atomic<int64_t>						queued_{ 0 };
+			std::mutex									idleMutex_;
+			std::condition_variable						idleCond_;
+
+			std::mutex									sessionsMutex_;
+			std::map<int, Session::shared>				sessions_;
+			int											nextId_ = 0;
+
+			OutputClock::shared							clock_;
+
+		public:
+			TranscoderHostImpl(const std::string& name) :logger_(NLogger::Get(name)), clock_(OutputClock::Create(name + "-clock")) {}
+
+			virtual ~TranscoderHostImpl() {
+				stop();
+			}
+
+			virtual int start(const Config& cfg) override {
+				if (running_) {
+					return ALREADY_OPENED_TRANSCODER;
+				}
+
+				if (!cfg.vaild()) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				cfg_ = cfg;
+				if (cfg_.workers <= 0) {
+					cfg_.workers = std::max(1, (int)std::thread::hardware_concurrency());
+				}
+
+				running_ = true;
+				{
+					std::lock_guard<std::mutex> wlock(workersMutex_);
+					for (int i = 0; i < cfg_.workers; ++i) {
+						workers_.emplace_back(new Worker());
+					}
+				}
+				for (int i = 0; i < cfg_.workers; ++i) {
+					workers_[i]->thread = std::thread(&TranscoderHostImpl::workerLoop, this, i);
+				}
+				clock_->start();
+
+				dbgi(logger_, "transcoder host started, workers=[{}], maxLoad=[{}].", cfg_.workers, cfg_.maxLoad);
+				return 0;
+			}
+
+			virtual void stop() override {
+				if (!running_) {
+					return;
+				}
+
+				//先关闭所有会话，之后的submit()不再投递任务
+				clock_->stop();
+				{
+					std::lock_guard<std::mutex> lock(sessionsMutex_);
+					for (auto& s : sessions_) {
+						if (s.second->timerId >= 0) {
+							clock_->removeTimer(s.second->timerId);
+						}
+						std::lock_guard<std::mutex> slock(s.second->mutex);
+						s.second->closed = true;
+						s.second->pending.clear();
+					}
+					sessions_.clear();
+				}
+
+				running_ = false;
+				idleCond_.notify_all();
+				for (auto& w : workers_) {
+					if (w->thread.joinable()) {
+						w->thread.join();
+					}
+				}
+
+				//关闭前已通过检查的submit()可能仍在enqueue()，清空workers_需与其互斥
+				std::lock_guard<std::mutex> wlock(workersMutex_);
+				workers_.clear();
+				queued_ = 0;
+			}
+
+			virtual int addSession(const std::string& name, const Transcoder::shared& transcoder, double estimatedLoad) override {
+				if (!running_) {
+					return NOT_STARTED_HOST;
+				}
+
+				if (!transcoder || estimatedLoad < 0) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				std::lock_guard<std::mutex> lock(sessionsMutex_);
+				double load = measureLoad(Clock::now());
+				if (load + estimatedLoad > capacity()) {
+					dbgw(logger_, "session rejected, name=[{}], load=[{:.3f}], estimated=[{:.3f}], capacity=[{:.3f}].", name, load, estimatedLoad, capacity());
+					return HOST_OVERLOADED;
+				}
+
+				Session::shared s = std::make_shared<Session>();
+				s->id = nextId_++;
+				s->name = name;
+				s->transcoder = transcoder;
+				s->home = s->id % cfg_.workers;
+				s->load = estimatedLoad;
+				s->sampleTime = Clock::now();
+				s->sampleCpuNs = 0;
+				sessions_[s->id] = s;
+
+				dbgi(logger_, "session added, id=[{}], name=[{}], load=[{:.3f}].", s->id, name, load + estimatedLoad);
+				return s->id;
+			}
+
+			virtual int removeSession(int sessionId) override {
+				Session::shared s;
+				int timerId = -1;
+				{
+					std::lock_guard<std::mutex> lock(sessionsMutex_);
+					auto search = sessions_.find(sessionId);
+					if (search == sessions_.end()) {
+						return PARAM_NOT_EXISTS;
+					}
+					s = search->second;
+					sessions_.erase(search);
+					timerId = s->timerId;
+					s->timerId = -1;
+				}
+
+				//removeTimer()会等待进行中的时钟回调，而回调需要sessionsMutex_，不能持锁调用
+				if (timerId >= 0) {
+					clock_->removeTimer(timerId);
+				}
+
+				std::lock_guard<std::mutex> slock(s->mutex);
+				s->closed = true;
+				s->pending.clear();
+				return 0;
+			}
+
+			virtual int submit(int sessionId, Stage stage, TimePoint deadline, const TaskFunc& func) override {
+				Session::shared s = findSession(sessionId);
+				if (!s) {
+					return PARAM_NOT_EXISTS;
+				}
+
+				Task task;
+				task.stage = stage;
+				task.deadline = deadline;
+				task.func = func;
+
+				bool schedule = false;
+				{
+					std::lock_guard<std::mutex> slock(s->mutex);
+					if (s->closed) {
+						return PARAM_NOT_EXISTS;
+					}
+					auto pos = std::upper_bound(s->pending.begin(), s->pending.end(), deadline, [](const TimePoint& t, const Task& o) {
+						return t < o.deadline;
+					});
+					s->pending.insert(pos, std::move(task));
+					if (!s->scheduled) {
+						s->scheduled = true;
+						schedule = true;
+					}
+				}
+
+				if (schedule) {
+					enqueue(s->home, s, deadline);
+				}
+				return 0;
+			}
+
+			virtual int input(int sessionId, int regionIndex, NMediaFrame::Unique pkt, TimePoint deadline) override {
+				Session::shared s = findSession(sessionId);
+				if (!s) {
+					return PARAM_NOT_EXISTS;
+				}
+
+				if (!pkt) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				//std::function要求可拷贝，用shared_ptr持有，执行时把帧零拷贝交给解码器
+				//任务被丢弃时随holder析构经ReturnToPool_Deleter归还
+				auto holder = std::make_shared<NMediaFrame::Unique>(std::move(pkt));
+				Transcoder::shared transcoder = s->transcoder;
+				return submit(sessionId, Stage::Decode, deadline, [transcoder, regionIndex, holder]() {
+					transcoder->input(regionIndex, std::move(*holder));
+				});
+			}
+
+			virtual int transcode(int sessionId, TimePoint deadline) override {
+				Session::shared s = findSession(sessionId);
+				if (!s) {
+					return PARAM_NOT_EXISTS;
+				}
+
+				Transcoder::shared transcoder = s->transcoder;
+				return submit(sessionId, Stage::Transcode, deadline, [transcoder]() {
+					const AVFrame* frame = nullptr;
+					transcoder->transcode(&frame);
+				});
+			}
+
+			virtual int pace(int sessionId, int framerate, OutputClock::Policy policy) override {
+				if (framerate < 0) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				Session::shared s = findSession(sessionId);
+				if (!s) {
+					return PARAM_NOT_EXISTS;
+				}
+
+				int timerId = -1;
+				if (framerate > 0) {
+					//时钟回调只投递任务，转码在工作线程中进行，截止时间为下一帧
+					const auto interval = std::chrono::nanoseconds(1000000000LL / framerate);
+					timerId = clock_->addTimer(framerate, policy, [this, sessionId, interval](int64_t /*tick*/, OutputClock::TimePoint deadline) {
+						transcode(sessionId, deadline + interval);
+					});
+					if (timerId < 0) {
+						return timerId;
+					}
+				}
+
+				//换上新的定时器，旧的定时器在锁外移除（见removeSession）
+				int oldTimerId = -1;
+				{
+					std::lock_guard<std::mutex> lock(sessionsMutex_);
+					if (sessions_.count(sessionId)) {
+						oldTimerId = s->timerId;
+						s->timerId = timerId;
+					}
+					else {
+						oldTimerId = timerId;
+					}
+				}
+
+				if (oldTimerId >= 0) {
+					clock_->removeTimer(oldTimerId);
+				}
+				return 0;
+			}
+
+			virtual bool admit(double estimatedLoad) override {
+				std::lock_guard<std::mutex> lock(sessionsMutex_);
+				return measureLoad(Clock::now()) + estimatedLoad <= capacity();
+			}
+
+			virtual int getSessionStats(int sessionId, SessionStats* stats) override {
+				std::lock_guard<std::mutex> lock(sessionsMutex_);
+				measureLoad(Clock::now());
+
+				auto search = sessions_.find(sessionId);
+				if (search == sessions_.end()) {
+					return PARAM_NOT_EXISTS;
+				}
+
+				fillStats(*search->second, stats);
+				return 0;
+			}
+
+			virtual std::vector<SessionStats> getStats() override {
+				std::lock_guard<std::mutex> lock(sessionsMutex_);
+				measureLoad(Clock::now());
+
+				std::vector<SessionStats> v;
+				for (auto& s : sessions_) {
+					SessionStats stats;
+					fillStats(*s.second, &stats);
+					v.push_back(stats);
+				}
+				return v;
+			}
+
+		private:
+			double capacity() const {
+				return cfg_.workers * cfg_.maxLoad;
+			}
+
+			Session::shared findSession(int sessionId) {
+				std::lock_guard<std::mutex> lock(sessionsMutex_);
+				auto search = sessions_.find(sessionId);
+				if (search == sessions_.end()) {
+					return nullptr;
+				}
+				return search->second;
+			}
+
+			//更新各会话的测量负载并返回总和，调用者需持有sessionsMutex_
+			//会话在第一个采样周期内使用addSession时给出的预估值
+			double measureLoad(const TimePoint& now) {
+				double sum = 0;
+				for (auto& i : sessions_) {
+					Session& s = *i.second;
+					int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - s.sampleTime).count();
+					if (elapsed >= kLoadSampleNs) {
+						int64_t cpu = s.totalCpuNs();
+						double sample = (double)(cpu - s.sampleCpuNs) / elapsed;
+						s.load = s.measured ? (kLoadAlpha * sample + (1 - kLoadAlpha) * s.load) : sample;
+						s.measured = true;
+						s.sampleCpuNs = cpu;
+						s.sampleTime = now;
+					}
+					sum += s.load;
+				}
+				return sum;
+			}
+
+			void fillStats(Session& s, SessionStats* stats) {
+				stats->id = s.id;
+				stats->name = s.name;
+				for (int i = 0; i < (int)Stage::Count; ++i) {
+					stats->cpuNs[i] = s.cpuNs[i].load(std::memory_order_relaxed);
+				}
+				stats->tasks = s.tasks.load(std::memory_order_relaxed);
+				stats->lateTasks = s.lateTasks.load(std::memory_order_relaxed);
+				stats->load = s.load;
+
+				std::lock_guard<std::mutex> slock(s.mutex);
+				stats->pending = s.pending.size();
+			}
+
+			//宿主已停止时丢弃
+			void enqueue(int index, const Session::shared& s, const TimePoint& deadline) {
+				std::lock_guard<std::mutex> wlock(workersMutex_);
+				if (!running_ || workers_.empty()) {
+					return;
+				}
+				Worker& w = *workers_[index];
+				{
+					std::lock_guard<std::mutex> lock(w.mutex);
+					auto pos = std::upper_bound(w.items.begin(), w.items.end(), deadline, [](const TimePoint& t, const Item& o) {
+						return t < o.deadline;
+					});
+					w.items.insert(pos, Item{ deadline, s });
+				}
+				++queued_;
+				idleCond_.notify_one();
+			}
+
+			//先取本线程队首，为空时从其他线程队尾窃取
+			bool take(int index, Item* item) {
+				{
+					Worker& w = *workers_[index];
+					std::lock_guard<std::mutex> lock(w.mutex);
+					if (!w.items.empty()) {
+						*item = std::move(w.items.front());
+						w.items.pop_front();
+						--queued_;
+						return true;
+					}
+				}
+
+				for (size_t n = 1; n < workers_.size(); ++n) {
+					Worker& victim = *workers_[(index + n) % workers_.size()];
+					std::lock_guard<std::mutex> lock(victim.mutex);
+					if (!victim.items.empty()) {
+						*item = std::move(victim.items.back());
+						victim.items.pop_back();
+						--queued_;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			void workerLoop(int index) {
+				while (running_) {
+					Item item;
+					if (!take(index, &item)) {
+						std::unique_lock<std::mutex> lock(idleMutex_);
+						idleCond_.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+							return !running_ || queued_ > 0;
+						});
+						continue;
+					}
+
+					runOne(index, item.session);
+				}
+			}
+
+			//执行会话中截止时间最早的一个任务，会话仍有任务时重新放回本线程队列
+			void runOne(int index, const Session::shared& s) {
+				Task task;
+				{
+					std::lock_guard<std::mutex> slock(s->mutex);
+					if (s->closed || s->pending.empty()) {
+						s->scheduled = false;
+						return;
+					}
+					task = std::move(s->pending.front());
+					s->pending.pop_front();
+				}
+
+				int64_t begin = threadCpuNs();
+				task.func();
+				int64_t cost = threadCpuNs() - begin;
+
+				s->cpuNs[(int)task.stage].fetch_add(cost, std::memory_order_relaxed);
+				s->tasks.fetch_add(1, std::memory_order_relaxed);
+				if (Clock::now() > task.deadline) {
+					s->lateTasks.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				TimePoint next;
+				{
+					std::lock_guard<std::mutex> slock(s->mutex);
+					if (s->closed || s->pending.empty()) {
+						s->scheduled = false;
+						return;
+					}
+					next = s->pending.front().deadline;
+				}
+				enqueue(index, s, next);
+			}
+		};
+
+		TranscoderHost::shared TranscoderHost::Create(const std::string& name) {
+			return std::make_shared<TranscoderHostImpl>(name);
+		}
+	}	//video
+}	//nmedia
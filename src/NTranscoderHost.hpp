@@ -0,0 +1,140 @@
+#ifndef NTranscoderHost_hpp
+#define NTranscoderHost_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "NVideoTranscoder.hpp"
+#include "NMediaFrame.hpp"
+#include "NOutputClock.hpp"
+
+#include "fmt/fmt.h"
+
+namespace nmedia {
+	namespace video {
+
+		//多会话转码宿主
+		//持有固定数量的工作线程，每个线程一个按截止时间排序的双端队列，空闲线程从其他线程队尾窃取任务。
+		//同一会话的任务串行执行（Transcoder本身不是线程安全的），不同会话的任务在工作线程间并行。
+		class TranscoderHost {
+		public:
+			using shared = std::shared_ptr<TranscoderHost>;
+			using Clock = std::chrono::steady_clock;
+			using TimePoint = Clock::time_point;
+			using TaskFunc = std::function<void()>;
+
+			//任务的类型，用于CPU统计
+			//统计按任务（一次调用）计入，不细分调用内部的阶段：Transcode任务包含缩放、合成和编码，
+			//各阶段的耗时见Transcoder::Stats
+			enum class Stage {
+				Decode = 0,		//input()，解码一个输入包
+				Transcode,		//transcode()，缩放、合成并编码一帧
+				Count
+			};
+
+			static const char* GetNameFor(Stage stage) {
+				switch (stage) {
+				case Stage::Decode:		return "decode";
+				case Stage::Transcode:	return "transcode";
+				default:				return "unknown";
+				}
+			}
+
+			struct Config {
+				int workers = 0;			//工作线程数，0表示使用CPU核数
+				double maxLoad = 0.8;		//准入上限：全部会话占用的核数不超过 workers * maxLoad
+
+				bool vaild() const {
+					return (0 <= workers)
+						&& (0 < maxLoad);
+				}
+			};
+
+			//会话CPU统计
+			struct SessionStats {
+				int id = -1;
+				std::string name;
+				int64_t cpuNs[(int)Stage::Count] = { 0 };	//各类任务累计CPU时间
+				int64_t tasks = 0;							//已执行任务数
+				int64_t lateTasks = 0;						//超过截止时间才完成的任务数
+				size_t pending = 0;							//排队中的任务数
+				double load = 0;							//测量的负载（占用核数）
+
+				const std::string dump() const {
+					return fmt::format("[id={}, name={}, load={:.3f}, tasks={}, late={}, pending={}, decode={}ms, transcode={}ms]"
+						, id
+						, name
+						, load
+						, tasks
+						, lateTasks
+						, pending
+						, cpuNs[(int)Stage::Decode] / 1000000
+						, cpuNs[(int)Stage::Transcode] / 1000000);
+				}
+			};
+
+		public:
+			TranscoderHost() {}
+
+			virtual ~TranscoderHost() {}
+
+			//启动工作线程
+			// 0 : 成功
+			// ALREADY_OPENED_TRANSCODER : 已启动
+			// EXTERNAL_PARAM_NOT_VAILD : cfg参数不可用
+			virtual int start(const Config& cfg) = 0;
+
+			//停止工作线程，未执行的任务被丢弃
+			virtual void stop() = 0;
+
+			//增加一个会话
+			//estimatedLoad为会话预计占用的核数，在没有测量值之前用于准入判断
+			// >= 0 : 会话id
+			// NOT_STARTED_HOST : 宿主未启动
+			// EXTERNAL_PARAM_NOT_VAILD : 参数不可用
+			// HOST_OVERLOADED : 负载超限，拒绝接入
+			virtual int addSession(const std::string& name, const Transcoder::shared& transcoder, double estimatedLoad) = 0;
+
+			//移除会话，排队中的任务被丢弃
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 会话不存在
+			virtual int removeSession(int sessionId) = 0;
+
+			//提交一个任务，同一会话内按截止时间先后执行
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 会话不存在
+			virtual int submit(int sessionId, Stage stage, TimePoint deadline, const TaskFunc& func) = 0;
+
+			//异步输入数据，pkt必须来自NVideoFrame::Pool，任务执行完后归还
+			virtual int input(int sessionId, int regionIndex, NMediaFrame::Unique pkt, TimePoint deadline) = 0;
+
+			//异步转码一帧，编码结果通过Transcoder::output()设置的回调输出
+			virtual int transcode(int sessionId, TimePoint deadline) = 0;
+
+			//由宿主的输出时钟按framerate驱动会话的transcode()，所有会话共享一个时钟线程
+			//每次时钟回调提交一个截止时间为下一帧的转码任务；framerate为0时停止驱动
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 会话不存在
+			// EXTERNAL_PARAM_NOT_VAILD : 帧率不可用
+			virtual int pace(int sessionId, int framerate, OutputClock::Policy policy) = 0;
+
+			//按测量负载判断能否再接入一个预计占用estimatedLoad核的会话
+			virtual bool admit(double estimatedLoad) = 0;
+
+			//获取会话统计
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : 会话不存在
+			virtual int getSessionStats(int sessionId, SessionStats* stats) = 0;
+
+			virtual std::vector<SessionStats> getStats() = 0;
+
+			//创建一个TranscoderHost实例
+			static
+			shared Create(const std::string& name);
+		};
+	}
+}
+
+#endif //NTranscoderHost_hpp
@@ -0,0 +1,324 @@
+
+#include <string.h>
+#include "NVideoInspector.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NVIDEO_INSPECTOR_SSE2 1
+#endif
+
+namespace {
+
+    // big endian bit reader over a NAL payload, skipping emulation prevention bytes
+    class NalBitReader{
+    public:
+        NalBitReader(const uint8_t * data, size_t size)
+        : data_(data), size_(size){ }
+
+        bool ok() const {
+            return !overrun_;
+        }
+
+        uint32_t u(int n){
+            uint32_t v = 0;
+            for(int i = 0; i < n; ++i){
+                v = (v << 1) | bit();
+            }
+            return v;
+        }
+
+        uint32_t ue(){
+            int zeros = 0;
+            while(!bit()){
+                if(++zeros > 31 || overrun_){
+                    overrun_ = true;
+                    return 0;
+                }
+            }
+            return ((1u << zeros) - 1) + u(zeros);
+        }
+
+        int32_t se(){
+            uint32_t v = ue();
+            return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+        }
+
+    private:
+        uint32_t bit(){
+            if(bitPos_ == 0){
+                if(!nextByte()){
+                    overrun_ = true;
+                    return 0;
+                }
+                bitPos_ = 8;
+            }
+            --bitPos_;
+            return (cur_ >> bitPos_) & 1;
+        }
+
+        bool nextByte(){
+            if(pos_ >= size_){
+                return false;
+            }
+            // 00 00 03 -> drop the 03
+            if(zeros_ >= 2 && data_[pos_] == 0x03){
+                ++pos_;
+                zeros_ = 0;
+                if(pos_ >= size_){
+                    return false;
+                }
+            }
+            cur_ = data_[pos_++];
+            zeros_ = (cur_ == 0) ? zeros_ + 1 : 0;
+            return true;
+        }
+
+    private:
+        const uint8_t * data_;
+        size_t          size_;
+        size_t          pos_ = 0;
+        int             zeros_ = 0;
+        uint8_t         cur_ = 0;
+        int             bitPos_ = 0;
+        bool            overrun_ = false;
+    };
+
+    void SkipScalingList(NalBitReader& br, int size){
+        int last = 8;
+        int next = 8;
+        for(int j = 0; j < size; ++j){
+            if(next != 0){
+                next = (last + br.se() + 256) % 256;
+            }
+            last = (next == 0) ? last : next;
+        }
+    }
+
+    // word at a time scan, as ff_avc_find_startcode_internal
+    inline const uint8_t * FindStartCodeC(const uint8_t * p, const uint8_t * end){
+        const uint8_t * last = end - 2;    // a start code begins before last
+        const uint8_t * a = p + 4 - ((intptr_t)p & 3);
+        for(; p < a && p < last; ++p){
+            if(p[0] == 0 && p[1] == 0 && p[2] == 1){
+                return p;
+            }
+        }
+        for(; p + 6 <= end; p += 4){
+            uint32_t x;
+            memcpy(&x, p, sizeof(x));
+            // any zero byte in x
+            if((x - 0x01010101) & (~x) & 0x80808080){
+                if(p[1] == 0){
+                    if(p[0] == 0 && p[2] == 1){
+                        return p;
+                    }
+                    if(p[2] == 0 && p[3] == 1){
+                        return p + 1;
+                    }
+                }
+                if(p[3] == 0){
+                    if(p[2] == 0 && p[4] == 1){
+                        return p + 2;
+                    }
+                    if(p[4] == 0 && p[5] == 1){
+                        return p + 3;
+                    }
+                }
+            }
+        }
+        for(; p < last; ++p){
+            if(p[0] == 0 && p[1] == 0 && p[2] == 1){
+                return p;
+            }
+        }
+        return end;
+    }
+
+}
+
+const uint8_t * NVideoInspector::FindStartCode(const uint8_t * p, const uint8_t * end){
+    if(end - p < 3){
+        return end;
+    }
+#ifdef NVIDEO_INSPECTOR_SSE2
+    // test 16 candidate positions at once: p[i] == 0 && p[i+1] == 0 && p[i+2] == 1
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    while(end - p >= 18){
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(p));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                  _mm_cmpeq_epi8(b2, one));
+        int mask = _mm_movemask_epi8(m);
+        if(mask){
+            int n = 0;
+            while(!(mask & 1)){
+                mask >>= 1;
+                ++n;
+            }
+            return p + n;
+        }
+        p += 16;
+    }
+#endif
+    return FindStartCodeC(p, end);
+}
+
+bool NVideoInspector::ParseH264SPS(const uint8_t * nal, size_t size, NVideoSize * size_out){
+    if(size < 4){
+        return false;
+    }
+
+    NalBitReader br(nal + 1, size - 1);
+    uint32_t profile_idc = br.u(8);
+    br.u(8); // constraint flags
+    br.u(8); // level_idc
+    br.ue(); // seq_parameter_set_id
+
+    uint32_t chroma_format_idc = 1;
+    uint32_t separate_colour_plane = 0;
+    switch(profile_idc){
+        case 100: case 110: case 122: case 244: case 44:
+        case 83: case 86: case 118: case 128: case 138:
+        case 139: case 134: case 135:
+            chroma_format_idc = br.ue();
+            if(chroma_format_idc == 3){
+                separate_colour_plane = br.u(1);
+            }
+            br.ue(); // bit_depth_luma_minus8
+            br.ue(); // bit_depth_chroma_minus8
+            br.u(1); // qpprime_y_zero_transform_bypass_flag
+            if(br.u(1)){ // seq_scaling_matrix_present_flag
+                int lists = (chroma_format_idc != 3) ? 8 : 12;
+                for(int i = 0; i < lists; ++i){
+                    if(br.u(1)){
+                        SkipScalingList(br, i < 6 ? 16 : 64);
+                    }
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    br.ue(); // log2_max_frame_num_minus4
+    uint32_t poc_type = br.ue();
+    if(poc_type == 0){
+        br.ue(); // log2_max_pic_order_cnt_lsb_minus4
+    }else if(poc_type == 1){
+        br.u(1);
+        br.se();
+        br.se();
+        uint32_t cycle = br.ue();
+        if(cycle > 255){
+            return false;
+        }
+        for(uint32_t i = 0; i < cycle; ++i){
+            br.se();
+        }
+    }
+    br.ue(); // max_num_ref_frames
+    br.u(1); // gaps_in_frame_num_value_allowed_flag
+    uint32_t width_mbs = br.ue() + 1;
+    uint32_t height_map_units = br.ue() + 1;
+    uint32_t frame_mbs_only = br.u(1);
+    if(!frame_mbs_only){
+        br.u(1); // mb_adaptive_frame_field_flag
+    }
+    br.u(1); // direct_8x8_inference_flag
+
+    uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    if(br.u(1)){
+        crop_left = br.ue();
+        crop_right = br.ue();
+        crop_top = br.ue();
+        crop_bottom = br.ue();
+    }
+
+    if(!br.ok()){
+        return false;
+    }
+
+    uint32_t chroma_array_type = separate_colour_plane ? 0 : chroma_format_idc;
+    uint32_t sub_width = (chroma_array_type == 1 || chroma_array_type == 2) ? 2 : 1;
+    uint32_t sub_height = (chroma_array_type == 1) ? 2 : 1;
+    uint32_t crop_unit_x = chroma_array_type ? sub_width : 1;
+    uint32_t crop_unit_y = (chroma_array_type ? sub_height : 1) * (2 - frame_mbs_only);
+
+    int width = (int)(width_mbs * 16 - crop_unit_x * (crop_left + crop_right));
+    int height = (int)((2 - frame_mbs_only) * height_map_units * 16 - crop_unit_y * (crop_top + crop_bottom));
+    if(width <= 0 || height <= 0){
+        return false;
+    }
+
+    size_out->width = width;
+    size_out->height = height;
+    return true;
+}
+
+bool NVideoInspector::InspectH264(const uint8_t * data, size_t size, NVideoInfo * info){
+    *info = NVideoInfo();
+
+    const uint8_t * end = data + size;
+    const uint8_t * p = FindStartCode(data, end);
+    bool vcl = false;
+    while(p < end){
+        const uint8_t * nal = p + 3;
+        const uint8_t * next = FindStartCode(nal, end);
+        // trailing zero of a 4 bytes start code belongs to the next start code
+        const uint8_t * nal_end = next;
+        while(nal_end > nal && nal_end < end && nal_end[-1] == 0){
+            --nal_end;
+        }
+
+        if(nal < nal_end){
+            info->valid = true;
+            int type = nal[0] & 0x1f;
+            size_t nal_size = nal_end - nal;
+            if(type == 5){
+                info->keyframe = true;
+                vcl = true;
+            }else if(type >= 1 && type <= 4){
+                vcl = true;
+            }else if(type == 7){
+                NVideoSize sz;
+                if(ParseH264SPS(nal, nal_size, &sz)){
+                    info->size = sz;
+                }
+            }else if((type == 14 || type == 20) && nal_size >= 4 && (nal[1] & 0x80)){
+                // SVC extension header, temporal_id is the top 3 bits of the 3rd byte
+                info->temporalId = nal[3] >> 5;
+            }
+        }
+        p = next;
+    }
+
+    if(vcl && info->temporalId < 0){
+        info->temporalId = 0;
+    }
+    return info->valid;
+}
+
+bool NVideoInspector::InspectVP8(const uint8_t * data, size_t size, NVideoInfo * info){
+    *info = NVideoInfo();
+    if(size < 3){
+        return false;
+    }
+
+    // 3 bytes frame tag, little endian: key_frame(1, 0 means key) version(3) show_frame(1) first_part_size(19)
+    info->valid = true;
+    info->keyframe = !(data[0] & 0x01);
+    if(!info->keyframe){
+        return true;
+    }
+
+    // key frame: start code 9d 01 2a, then 14 bits width + 2 bits scale, 14 bits height + 2 bits scale
+    if(size < 10 || data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a){
+        info->valid = false;
+        return false;
+    }
+    info->size.width = (data[6] | (data[7] << 8)) & 0x3fff;
+    info->size.height = (data[8] | (data[9] << 8)) & 0x3fff;
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef NVideoInspector_hpp
+#define NVideoInspector_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include "NMediaBasic.hpp"
+#include "NMediaFrame.hpp"
+
+// what the packet headers tell about a video frame, without decoding it
+struct NVideoInfo{
+    bool        valid = false;      // the packet could be parsed
+    bool        keyframe = false;   // IDR for H264, key frame for VP8
+    NVideoSize  size;               // only valid when the packet carries SPS (H264) or is a key frame (VP8)
+    int         temporalId = -1;    // -1 if the bitstream does not tell
+};
+
+// Lightweight header parser for H264 (Annex-B) and VP8 packets.
+// Only the NAL headers, SPS and the VP8 frame tag are read, so it is cheap
+// enough to run on every packet at ingestion.
+class NVideoInspector{
+public:
+    // return pointer to the first 00 00 01 in [p, end), or end if not found
+    static const uint8_t * FindStartCode(const uint8_t * p, const uint8_t * end);
+
+    static bool InspectH264(const uint8_t * data, size_t size, NVideoInfo * info);
+
+    static bool InspectVP8(const uint8_t * data, size_t size, NVideoInfo * info);
+
+    // parse resolution from a H264 SPS NAL unit (starting with the NAL header)
+    static bool ParseH264SPS(const uint8_t * nal, size_t size, NVideoSize * size_out);
+
+    static bool Inspect(NCodec::Type codec, const uint8_t * data, size_t size, NVideoInfo * info){
+        if(codec == NCodec::H264){
+            return InspectH264(data, size, info);
+        }else if(codec == NCodec::VP8){
+            return InspectVP8(data, size, info);
+        }
+        return false;
+    }
+
+    // fill keyframe flag, temporal layer and (if present) resolution of frame
+    static bool Inspect(NVideoFrame * frame, NVideoInfo * info){
+        if(!Inspect(frame->getCodecType(), frame->data(), frame->size(), info)){
+            return false;
+        }
+        frame->setKeyframe(info->keyframe);
+        frame->setTemporalId(info->temporalId);
+        if(info->size.valid()){
+            frame->setSize(info->size);
+        }
+        return true;
+    }
+};
+
+#endif /* NVideoInspector_hpp */
@@ -2,11 +2,15 @@
 #include <utility>
 #include <algorithm>
 #include <map>
+#include <chrono>
 
 #include "NVideoTranscoder.hpp"
 #include "NMediaFrame.hpp"
+#include "NVideoInspector.hpp"
+#include "NInputCapture.hpp"
 #include "NLogger.hpp"
 #include "YUVMixer.hpp"
+#include "NFrameBufferPool.hpp"
 #include "NTErrorDefined.hpp"
 
 extern "C" {
@@ -35,46 +39,155 @@ namespace nmedia {
 
 		static const int OUT_FF_FMT = AV_PIX_FMT_YUV420P;
 
-		class Region {
+		//输入帧pts和输出包pts/dts的时间基，与RTP视频时钟一致
+		static const AVRational OUT_TIMEBASE = { 1, 90000 };
+
+		static
+		void releasePooledFrame(void* opaque, uint8_t* /*data*/) {
+			delete static_cast<NMediaFrame::Unique*>(opaque);
+		}
+
+		//把池中的视频帧包装成引用计数缓冲区（含补齐的填充字节），最后一个引用释放时帧归还到池
+		//成功时frame的所有权转移给缓冲区，失败返回nullptr且frame不变
+		static
+		AVBufferRef* wrapPooledFrame(NMediaFrame::Unique& frame) {
+			NVideoFrame* vframe = static_cast<NVideoFrame*>(frame.get());
+			vframe->ensurePadding();
+
+			NMediaFrame::Unique* owner = new NMediaFrame::Unique(std::move(frame));
+			AVBufferRef* buf = av_buffer_create(vframe->data(), vframe->size() + NVideoFrame::kPaddingSize
+				, releasePooledFrame, owner, AV_BUFFER_FLAG_READONLY);
+			if (!buf) {
+				frame = std::move(*owner);
+				delete owner;
+			}
+			return buf;
+		}
+
+		//由AVPacket引用实现的EncodedPacket
+		class FFEncodedPacket : public EncodedPacket {
+		private:
+			AVPacket*		pkt_ = nullptr;
+			NCodec::Type	codec_;
+			AVRational		timebase_;
+			int64_t			gts_;
+
 		public:
+			//接管src的引用，src被重置为空包
+			//gts小于等于0（未知）时使用当前时刻
+			FFEncodedPacket(AVPacket* src, NCodec::Type codec, AVRational timebase, int64_t gts)
+				:pkt_(av_packet_alloc()), codec_(codec), timebase_(timebase), gts_(gts) {
+				av_packet_move_ref(pkt_, src);
+				if (gts_ <= 0) {
+					gts_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+				}
+			}
+
+			virtual ~FFEncodedPacket() {
+				av_packet_free(&pkt_);
+			}
+
+			virtual const uint8_t* data() const override {
+				return pkt_->data;
+			}
+
+			virtual size_t size() const override {
+				return pkt_->size;
+			}
+
+			virtual NCodec::Type codecType() const override {
+				return codec_;
+			}
+
+			virtual bool isKeyframe() const override {
+				return pkt_->flags & AV_PKT_FLAG_KEY;
+			}
 
+			virtual int64_t pts() const override {
+				return AV_NOPTS_VALUE == pkt_->pts ? -1 : pkt_->pts;
+			}
+
+			virtual int64_t dts() const override {
+				return AV_NOPTS_VALUE == pkt_->dts ? -1 : pkt_->dts;
+			}
+
+			virtual int64_t duration() const override {
+				return pkt_->duration > 0 ? pkt_->duration : -1;
+			}
+
+			virtual int timebaseNum() const override {
+				return timebase_.num;
+			}
+
+			virtual int timebaseDen() const override {
+				return timebase_.den;
+			}
+
+			virtual int64_t gts() const override {
+				return gts_;
+			}
+		};
+
+		//输入源：一路输入流及其解码器
+		//每路流只解码一次，解码出的图像被所有引用该源的区域共享，各区域有自己的缩放器和几何参数
+		class Source {
 		private:
+			static const int64_t kPoolIdleMs = 10000;
+
 			NLogger::shared         logger_;
-			RegionConfig            RgConfig_;
+			int						id_ = -1;
 			AVPacket				*imgPacket_ = nullptr;
 			AVFrame					*inFrame_ = nullptr;
 			AVCodecParserContext	*imgParserCtx_ = nullptr;
 			AVCodecContext			*imgCodecCtx_ = nullptr;
+			bool					newFrame_ = false;		//最近一次输入是否解码出了新图像
+			bool					waitKeyframe_ = false;	//重新同步中，丢弃关键帧之前的图像
+			Transcoder::DecodeLevel	level_ = Transcoder::DecodeLevel::Full;
+			int64_t					packets_ = 0;
+			int64_t					frames_ = 0;
+			int64_t					skipped_ = 0;
+			int64_t					arrivals_ = 0;			//进入抖动缓冲的帧序号，Key::Sequence的键
+			NVideoSize				streamSize_;			//最近一次SPS/关键帧头中的分辨率
+			NVideoFrame::Pool		jitterPool_;			//非池输入进入抖动缓冲前拷贝到这里
+			JitterBuffer::shared	jitter_ = nullptr;		//未启用抖动缓冲时为nullptr，先于帧池析构
 
 		public:
-			using shared = std::shared_ptr<Region>;
+			using shared = std::shared_ptr<Source>;
 
-			Region(NLogger::shared logger) :logger_(logger) { }
-
-			Region(const std::string& name) :logger_(NLogger::Get(name)) { }
+			Source(NLogger::shared logger, int id) :logger_(logger), id_(id) {
+				jitterPool_.setName(fmt::format("source{}.jitter", id));
+			}
 
-			virtual ~Region() {
+			virtual ~Source() {
 				close();
 			}
 
-			//初始化改区域
-			int init(const RegionConfig& config) {
-				if (isOpened()) {
-					return ALREADY_OPENED_REGION;
+			//解析包头，填充关键帧标志、时域层和分辨率
+			//不携带SPS的包沿用该源最近一次解析出的分辨率
+			bool inspect(NVideoFrame* pkt, NVideoInfo* info) {
+				if (!NVideoInspector::Inspect(pkt, info)) {
+					return false;
 				}
-
-				if (!config.valid()) {
-					return EXTERNAL_PARAM_NOT_VAILD;
+				if (info->size.valid()) {
+					streamSize_ = info->size;
 				}
-
-				RgConfig_ = config;
-
-				return 0;
+				else if (streamSize_.valid()) {
+					pkt->setSize(streamSize_);
+				}
+				return true;
 			}
 
-			//当有数据输入时，该区域应该调用这个方法
-			//这里传入的数据应该携带分辨率信息
-			int onInputFrame(NVideoFrame* inPacket) {
+			//当有数据输入时，该输入源应该调用这个方法
+			//info为inspect()的结果，用于在解码前丢弃不需要解码的包
+			//owner非空时数据以引用计数缓冲区交给解码器，owner的所有权随之转移
+			int onInputFrame(NVideoFrame* inPacket, const NVideoInfo& info, NMediaFrame::Unique* owner) {
+				if (skippable(info)) {
+					newFrame_ = false;
+					++packets_;
+					++skipped_;
+					return 0;
+				}
+
 				if (!imgCodecCtx_) {
 					if (initDecoder(inPacket->getCodecType()) < 0) {
 						return FAILED_INIT_DECODER;
@@ -85,17 +198,115 @@ namespace nmedia {
 					}
 				}
 
-				return decoder(inPacket);
+				return decoder(inPacket, owner);
 			}
 
-			//获取区域中流被解码后的图像
+			//获取流被解码后的图像
 			const AVFrame* getDrawFrame() const {
 				return inFrame_;
 			}
 
-			//获取区域的配置信息
-			const RegionConfig& getRegionCfg() const {
-				return RgConfig_;
+			//最近一次输入是否解码出了可以绘制的新图像
+			bool hasNewFrame() const {
+				return newFrame_;
+			}
+
+			//重新同步解码器，在下一个关键帧之前不再输出图像
+			//用于退出直通模式时，此时解码器缺少直通期间的参考帧
+			void resync() {
+				if (imgCodecCtx_) {
+					avcodec_flush_buffers(imgCodecCtx_);
+				}
+				newFrame_ = false;
+				waitKeyframe_ = true;
+			}
+
+			int id() const {
+				return id_;
+			}
+
+			//设置解码级别，解码器未创建时在创建后生效
+			//离开KeyOnly时之前的非关键帧都未解码，参考帧缺失，等到下一个关键帧再输出图像
+			void setDecodeLevel(Transcoder::DecodeLevel level) {
+				if (Transcoder::DecodeLevel::KeyOnly == level_ && level != level_) {
+					newFrame_ = false;
+					waitKeyframe_ = true;
+				}
+				level_ = level;
+				applyDecodeLevel();
+			}
+
+			Transcoder::DecodeLevel getDecodeLevel() const {
+				return level_;
+			}
+
+			void fillStats(Transcoder::SourceStats* stats) const {
+				stats->id = id_;
+				stats->level = level_;
+				stats->packets = packets_;
+				stats->frames = frames_;
+				stats->skipped = skipped_;
+				if (jitter_) {
+					stats->jitter = jitter_->getStats();
+				}
+			}
+
+			const JitterBuffer::shared& jitterBuffer() const {
+				return jitter_;
+			}
+
+			//替换抖动缓冲，原缓冲中的帧先全部释放
+			//帧池最多保留一个缓冲容量的空闲帧，多余的在空闲kPoolIdleMs后释放
+			void setJitterBuffer(const JitterBuffer::shared& jitter) {
+				if (jitter_) {
+					jitter_->flush();
+				}
+				jitter_ = jitter;
+				arrivals_ = 0;
+
+				NVideoFrame::Pool::Limits limits;
+				limits.high = jitter ? jitter->getConfig().capacity : 0;
+				limits.idleMs = kPoolIdleMs;
+				jitterPool_.setLimits(limits);
+				jitterPool_.trim();
+			}
+
+			//释放帧池中长时间未用到的空闲帧，源停止输入时也需要定期调用
+			void trimPool() {
+				jitterPool_.trim();
+			}
+
+			//输入包进入抖动缓冲，Key::Pts按pts排序，Key::Sequence按到达顺序编号；owner为空时拷贝到帧池
+			// EXTERNAL_PARAM_NOT_VAILD : Key::Pts时输入没有pts，这样的源应使用Key::Sequence
+			int bufferFrame(NVideoFrame* pkt, NMediaFrame::Unique* owner, JitterBuffer::TimePoint arrival) {
+				int64_t key = 0;
+				if (JitterBuffer::Key::Sequence == jitter_->getConfig().key) {
+					key = arrivals_++;
+				}
+				else if (pkt->getPts() < 0) {
+					dbgw(logger_, "jitter buffer keyed by pts but input has no pts, source=[{}].", id_);
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				else {
+					key = pkt->getPts();
+				}
+
+				NMediaFrame::Unique frame = NMediaFrame::MakeNullPtr();
+				if (owner && *owner) {
+					frame = std::move(*owner);
+				}
+				else {
+					frame = jitterPool_.get();
+					NVideoFrame* copy = static_cast<NVideoFrame*>(frame.get());
+					memcpy(copy->resize(pkt->size()), pkt->data(), pkt->size());
+					copy->setCodecType(pkt->getCodecType(), NMedia::Video);
+					copy->setPts(pkt->getPts());
+					copy->setGts(pkt->getGts());
+					copy->setKeyframe(pkt->isKeyframe());
+					copy->setSize(pkt->videoSize());
+					copy->setTemporalId(pkt->temporalId());
+				}
+				return jitter_->push(std::move(frame), key, arrival);
 			}
 
 			bool isOpened() const {
@@ -119,7 +330,7 @@ namespace nmedia {
 						avcodec_send_packet(imgCodecCtx_, imgPacket_);
 					}
 					else {
-						dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", RgConfig_.index, ret);
+						dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", id_, ret);
 						return;
 					}
 				}
@@ -131,13 +342,13 @@ namespace nmedia {
 					}
 					char arr[1024] = { 0 };
 					av_strerror(ret, arr, 1024);
-					dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", RgConfig_.index, arr);
+					dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", id_, arr);
 					return;
 				}
 
 			}
 
-			//关闭区域
+			//关闭输入源
 			void close() {
 				flushDecoder();
 
@@ -166,17 +377,40 @@ namespace nmedia {
 			}
 
 		private:
+			//解码前即可确定不需要解码的包：
+			//等待关键帧或仅解码关键帧时的非关键帧，以及仅解码非参考帧时的高时域层帧（不被低层参考）
+			bool skippable(const NVideoInfo& info) const {
+				if (!info.valid) {
+					return false;
+				}
+				if (!info.keyframe
+					&& (waitKeyframe_ || Transcoder::DecodeLevel::KeyOnly == level_)) {
+					return true;
+				}
+				return Transcoder::DecodeLevel::NonRef == level_
+					&& info.temporalId > 0;
+			}
+
 			//进行转码，传入的视频帧可以不携带分辨率信息，因为嗅探器会自动嗅探视频帧分辨率
 			//size表示视频帧应该被缩放的大小，用于刷新缩放模块
 			//这里将缩放模块放在这里。主要是因为嗅探器可以获取视频帧的帧格式，缩放模块的初始化需要这个帧格式。
-			inline int decoder(NVideoFrame* pkt) {
+			inline int decoder(NVideoFrame* pkt, NMediaFrame::Unique* owner) {
 				if (!isOpened()) {
-					dbge(logger_, "transcoder is not open! index=[{}].", RgConfig_.index);
+					dbge(logger_, "source is not open! index=[{}].", id_);
 					return NOT_OPENED_REGION;
 				}
 
+				newFrame_ = false;
+				++packets_;
+				//没有引用计数缓冲区时，avcodec_send_packet会拷贝一次数据
+				if (owner && *owner) {
+					imgPacket_->buf = wrapPooledFrame(*owner);
+				}
 				imgPacket_->data = pkt->data();
 				imgPacket_->size = pkt->size();
+				//pts随包进入解码器，gts经reordered_opaque带到解码出的图像上
+				imgPacket_->pts = pkt->getPts() >= 0 ? pkt->getPts() : AV_NOPTS_VALUE;
+				imgCodecCtx_->reordered_opaque = pkt->getGts();
 
 				int ret = avcodec_send_packet(imgCodecCtx_, imgPacket_);
 				if (ret) {
@@ -186,27 +420,36 @@ namespace nmedia {
 						avcodec_send_packet(imgCodecCtx_, imgPacket_);
 					}
 					else {
-						dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", RgConfig_.index, ret);
+						av_packet_unref(imgPacket_);
+						dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", id_, ret);
 						return ERROR_DECODE_VIDEO;
 					}
 				}
 
+				//解码器已持有数据的引用或拷贝
+				av_packet_unref(imgPacket_);
+
 				ret = avcodec_receive_frame(imgCodecCtx_, inFrame_);
 				if (ret) {
 					if (AVERROR(EAGAIN) == ret) {
 						return 0;
 					}
-					dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", RgConfig_.index, ret);
+					dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", id_, ret);
 					return ERROR_DECODE_VIDEO;
 				}
 
-				av_packet_unref(imgPacket_);
+				if (waitKeyframe_ && !inFrame_->key_frame) {
+					return 0;
+				}
+				waitKeyframe_ = false;
+				newFrame_ = true;
+				++frames_;
 				return 0;
 			}
 
 			inline int decoder1(NVideoFrame* pkt, const NVideoSize& size) {
 				if (!isOpened()) {
-					dbge(logger_, "transcoder is not open! index=[{}].", RgConfig_.index);
+					dbge(logger_, "source is not open! index=[{}].", id_);
 					return NOT_OPENED_REGION;
 				}
 
@@ -234,7 +477,7 @@ namespace nmedia {
 								avcodec_send_packet(imgCodecCtx_, imgPacket_);
 							}
 							else {
-								dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", RgConfig_.index, ret);
+								dbge(logger_, "send frame to decoder error. index=[{}], error=[{}].", id_, ret);
 								return ERROR_DECODE_VIDEO;
 							}
 						}
@@ -244,7 +487,7 @@ namespace nmedia {
 							if (AVERROR(EAGAIN) == ret) {
 								return 0;
 							}
-							dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", RgConfig_.index, ret);
+							dbge(logger_, "receive frame from decoder error. index=[{}], error=[{}].", id_, ret);
 							return ERROR_DECODE_VIDEO;
 						}
 
@@ -261,26 +504,31 @@ namespace nmedia {
 				if (!imgCodecCtx_) {
 					int codecId = convertFFCodecID(typ);
 					if (codecId <= 0) {
-						dbge(logger_, "Unsupported decoder type!  index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Unsupported decoder type!  index=[{}], NCodec::Type=[{}].", id_, typ);
 						return codecId;
 					}
 
 					AVCodec* pCodec = avcodec_find_decoder((AVCodecID)codecId);
 					if (!pCodec) {
-						dbge(logger_, "Can not find decoder! index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Can not find decoder! index=[{}], NCodec::Type=[{}].", id_, typ);
 						return NOT_SUPPORT_CODEC_TYPE;
 					}
 
 					imgCodecCtx_ = avcodec_alloc_context3(pCodec);
 					if (!imgCodecCtx_) {
-						dbge(logger_, "Could not allocate video codec context! index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Could not allocate video codec context! index=[{}], NCodec::Type=[{}].", id_, typ);
 						return FAILED_INIT_DECODER;
 					}
 
+					//解码输出帧来自进程内共享的缓冲池，同样分辨率的会话之间复用
+					FrameBufferPool::Attach(imgCodecCtx_);
+
 					if (avcodec_open2(imgCodecCtx_, pCodec, NULL) < 0) {
-						dbge(logger_, "Could not open codec! index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Could not open codec! index=[{}], NCodec::Type=[{}].", id_, typ);
 						return FAILED_INIT_DECODER;
 					}
+
+					applyDecodeLevel();
 				}
 
 				if (!inFrame_) {
@@ -290,19 +538,35 @@ namespace nmedia {
 				return 0;
 			}
 
+			inline void applyDecodeLevel() {
+				if (!imgCodecCtx_) {
+					return;
+				}
+
+				if (Transcoder::DecodeLevel::KeyOnly == level_) {
+					imgCodecCtx_->skip_frame = AVDISCARD_NONKEY;
+				}
+				else if (Transcoder::DecodeLevel::NonRef == level_) {
+					imgCodecCtx_->skip_frame = AVDISCARD_NONREF;
+				}
+				else {
+					imgCodecCtx_->skip_frame = AVDISCARD_DEFAULT;
+				}
+			}
+
 			//初始化图像嗅探器，用于从网络流中识别一整帧可用视频帧
 			inline int initImgParser(const NCodec::Type typ) {
 				if (!imgParserCtx_) {
 					int codecId = convertFFCodecID(typ);
 					if (codecId <= 0) {
-						dbge(logger_, "Unsupported decoder type!  index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Unsupported decoder type!  index=[{}], NCodec::Type=[{}].", id_, typ);
 						return codecId;
 					}
 
 					imgParserCtx_ = av_parser_init(codecId);
 					//avParserContext->flags |= PARSER_FLAG_ONCE;
 					if (!imgParserCtx_) {
-						dbge(logger_, "Could not init avParserContext! index=[{}], NCodec::Type=[{}].", RgConfig_.index, typ);
+						dbge(logger_, "Could not init avParserContext! index=[{}], NCodec::Type=[{}].", id_, typ);
 						return FAILED_INIT_PARSER;
 					}
 				}
@@ -316,6 +580,33 @@ namespace nmedia {
 
 		};
 
+		//区域：画布上的一块显示位置，引用一个输入源
+		class Region {
+		private:
+			RegionConfig            RgConfig_;
+			Source::shared			source_;
+
+		public:
+			using shared = std::shared_ptr<Region>;
+
+			Region(const RegionConfig& config, const Source::shared& source)
+				:RgConfig_(config), source_(source) { }
+
+			//获取区域的配置信息
+			const RegionConfig& getRegionCfg() const {
+				return RgConfig_;
+			}
+
+			const Source::shared& getSource() const {
+				return source_;
+			}
+
+			//区域引用的输入源编号，未指定时与区域index相同
+			static int SourceIdOf(const RegionConfig& config) {
+				return config.source < 0 ? config.index : config.source;
+			}
+		};
+
 		//画布格式为YUV420P
 		//占用内存计算：width * height * (3 / 2)
 		class TranscoderImpl : public Transcoder {
@@ -326,8 +617,10 @@ namespace nmedia {
 			//RegionConfig中index作为增删改查的索引，zOrder作为绘图时的排序key。
 			//channels作为绘图时用，以zOrder作为key排序
 			//numbers_作为增删改查时用，以index作为增删改查的索引
+			//sources_以输入源编号为key，一路源可以被多个区域引用
 			std::vector<Region::shared> channels_;
 			std::map<int, Region::shared>   numbers_;
+			std::map<int, Source::shared>	sources_;
 
 			YUVMixer::shared			yuvMixer_ = nullptr;
 			Transcoder::OutputConfig	cfg_;
@@ -336,6 +629,36 @@ namespace nmedia {
 			AVPacket*					outPacaket_ = nullptr;
 			AVCodecContext*				imgCodecCtx_ = nullptr;
 			Transcoder::DataFunc        onEncodeFrame_ = nullptr;
+			Transcoder::PacketFunc		onEncodePacket_ = nullptr;
+			AVPacket*					fwdPacket_ = nullptr;		//直通时转发的包
+			//送入编码器的帧，浅拷贝合成图像的数据指针，用于设置pict_type等编码参数
+			AVFrame*					encFrame_ = nullptr;
+			bool						passthrough_ = false;
+			bool						forceKeyframe_ = false;		//下一帧强制编码为关键帧
+			InputRecorder::shared		recorder_ = nullptr;		//输入录制，未录制时为nullptr
+
+			//输出时间戳，单位OUT_TIMEBASE
+			//合成模式以输出时钟为基准，直通模式以输入pts为基准，切换模式时重新计算偏移保证单调递增
+			int64_t						lastPts_ = AV_NOPTS_VALUE;
+			int64_t						ptsOffset_ = 0;
+			bool						rebasePts_ = true;
+
+			//输出时钟跟踪：第n次transcode()的截止时间为 tickBase_ + n * 输出帧间隔
+			//落后超过一帧且处理耗时占满周期时视为过载，逐级降低低优先级输入源的解码级别
+			using Clock = std::chrono::steady_clock;
+			static const int kDegradeTicks = 3;			//连续过载多少个周期后降一级
+			static const int kRecoverTicks = 50;		//连续空闲多少个周期后恢复一级
+			static constexpr double kBusyHigh = 0.9;	//过载的耗时比例
+			static constexpr double kBusyLow = 0.6;		//空闲的耗时比例
+			Clock::time_point			tickBase_;
+			//合成帧的pts按输出时钟经过的时间计算：帧序号 = (now - ptsBase_) / 输出帧间隔，取整且单调递增
+			//ptsBase_不随调用方迟到而重设，跳过的周期体现为pts的间隔，合成输出与墙钟和输入时间保持同步
+			Clock::time_point			ptsBase_;
+			int64_t						frameIndex_ = -1;	//本周期合成帧的序号，编码器时间基1/framerate
+			int64_t						busyNs_ = 0;		//本周期内input/transcode的处理耗时
+			int							overloadTicks_ = 0;
+			int							idleTicks_ = 0;
+			Transcoder::Stats			stats_;
 
 		public:
 			TranscoderImpl(NLogger::shared logger) :logger_(logger) {}
@@ -351,8 +674,17 @@ namespace nmedia {
 				onEncodeFrame_ = func;
 			}
 
+			//设置输出编码包的回调函数
+			virtual void outputPacket(const Transcoder::PacketFunc& func) override {
+				onEncodePacket_ = func;
+			}
+
 			//初始化转码器
 			virtual int init(const Transcoder::OutputConfig& cfg) override {
+				if (recorder_) {
+					recorder_->recordConfig(cfg);
+				}
+
 				if (isOpened()) {
 					dbge(logger_, "transcoder already opened! cfg=[{}].", cfg_.dump());
 					return ALREADY_OPENED_TRANSCODER;
@@ -381,6 +713,7 @@ namespace nmedia {
 					return FAILED_INIT_ENCODER;
 				}
 
+				stats_ = Transcoder::Stats();
 				return 0;
 			}
 
@@ -398,6 +731,10 @@ namespace nmedia {
 			// region.index : region参数不可用
 			// -2 : yuv mixer中region增加失败
 			virtual int setRegions(const std::vector<RegionConfig>& channels) override {
+				if (recorder_) {
+					recorder_->recordRegions(channels);
+				}
+
 				{
 					std::map<int, std::shared_ptr<Region::shared>> tmp;
 					for (auto& i : channels) {
@@ -417,12 +754,20 @@ namespace nmedia {
 				channels_.clear();
 				numbers_.clear();
 
+				//仍被引用的输入源保留解码器状态，布局变化不需要等待关键帧
+				std::map<int, Source::shared> sources;
 				for (auto& i : channels) {
-					Region::shared pr = std::make_shared<Region>(logger_);
-					pr->init(i);
+					int sourceId = Region::SourceIdOf(i);
+					if (!sources.count(sourceId)) {
+						auto search = sources_.find(sourceId);
+						sources[sourceId] = (search != sources_.end()) ? search->second : std::make_shared<Source>(logger_, sourceId);
+					}
+
+					Region::shared pr = std::make_shared<Region>(i, sources[sourceId]);
 					channels_.push_back(pr);
 					numbers_[i.index] = pr;
 				}
+				sources_.swap(sources);
 
 				//根据z轴次序进行排序
 				std::sort(channels_.begin(), channels_.end(), [](Region::shared a, Region::shared b) {
@@ -435,6 +780,10 @@ namespace nmedia {
 					return EXTERNAL_PARAM_NOT_VAILD;
 				}
 
+				if (passthrough_ && !layoutAllowsPassthrough()) {
+					leavePassthrough();
+				}
+
 				dbgt(logger_, "regions joined successfully!, regions=[{}]-[{}].", channels_[0]->getRegionCfg().index, channels_[channels_.size()-1]->getRegionCfg().index);
 
 				return 0;
@@ -445,6 +794,10 @@ namespace nmedia {
 			// -2 : index重复
 			// index : 成功
 			virtual int addRegion(const RegionConfig& channel) override {
+				if (recorder_) {
+					recorder_->recordRegion(channel);
+				}
+
 				if(!channel.valid()) {
 					dbgi(logger_, "region param illegal!, region=[{}].", channel.index);
 					return EXTERNAL_PARAM_NOT_VAILD;
@@ -456,8 +809,20 @@ namespace nmedia {
 					return PARAM_EXISTS;
 				}
 
-				Region::shared pr = std::make_shared<Region>(logger_);
-				pr->init(channel);
+				int ret = yuvMixer_->addRegion(channel);
+				if (ret < 0) {
+					dbgi(logger_, "YUV mixer : region joined failed! ret=[{}].", ret);
+					return ret;
+				}
+
+				int sourceId = Region::SourceIdOf(channel);
+				Source::shared source = sources_[sourceId];
+				if (!source) {
+					source = std::make_shared<Source>(logger_, sourceId);
+					sources_[sourceId] = source;
+				}
+
+				Region::shared pr = std::make_shared<Region>(channel, source);
 				channels_.push_back(pr);
 				numbers_[channel.index] = pr;
 
@@ -466,16 +831,19 @@ namespace nmedia {
 					return a->getRegionCfg().zOrder < b->getRegionCfg().zOrder;
 				});
 
+				if (passthrough_ && !layoutAllowsPassthrough()) {
+					leavePassthrough();
+				}
+
 				dbgt(logger_, "region joined successfully!, region=[{}].", channel.index);
 
 				return channel.index;
 			}
 
-			//当有数据时调用该方法输入数据
+			//当有数据时调用该方法输入数据，数据送入区域引用的输入源
 			virtual int input(int regionIndex, NVideoFrame* pkt) override {
-				if (!isSupportCodecType(pkt->getCodecType())) {
-					dbgi(logger_, "Unsupported codec type! index=[{}], Type=[{}].", regionIndex, NCodec::GetNameFor(pkt->getCodecType()));
-					return NOT_SUPPORT_CODEC_TYPE;
+				if (recorder_) {
+					recorder_->recordInput(CaptureRecord::Input, regionIndex, pkt);
 				}
 
 				auto region = numbers_.find(regionIndex);
@@ -484,45 +852,173 @@ namespace nmedia {
 					return PARAM_NOT_EXISTS;
 				}
 
-				int ret = region->second->onInputFrame(pkt);
-				if (ret) {
-					return ret;
+				return inputPacket(region->second->getSource()->id(), pkt, nullptr);
+			}
+
+			//输入一路源的数据，解码一次后分发给所有引用该源的区域
+			virtual int inputSource(int sourceId, NVideoFrame* pkt) override {
+				if (recorder_) {
+					recorder_->recordInput(CaptureRecord::InputSource, sourceId, pkt);
+				}
+
+				return inputPacket(sourceId, pkt, nullptr);
+			}
+
+			virtual int input(int regionIndex, NMediaFrame::Unique pkt) override {
+				if (!pkt || pkt->getMediaType() != NMedia::Video) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				NVideoFrame* frame = static_cast<NVideoFrame*>(pkt.get());
+				if (recorder_) {
+					recorder_->recordInput(CaptureRecord::Input, regionIndex, frame);
+				}
+
+				auto region = numbers_.find(regionIndex);
+				if (region == numbers_.end()) {
+					dbgi(logger_, "Not found target region index! index=[{}].", regionIndex);
+					return PARAM_NOT_EXISTS;
+				}
+
+				return inputPacket(region->second->getSource()->id(), frame, &pkt);
+			}
+
+			virtual int inputSource(int sourceId, NMediaFrame::Unique pkt) override {
+				if (!pkt || pkt->getMediaType() != NMedia::Video) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+
+				NVideoFrame* frame = static_cast<NVideoFrame*>(pkt.get());
+				if (recorder_) {
+					recorder_->recordInput(CaptureRecord::InputSource, sourceId, frame);
 				}
 
-				return yuvMixer_->inputRegionFrame(regionIndex, region->second->getDrawFrame());
+				return inputPacket(sourceId, frame, &pkt);
+			}
+
+			virtual int setJitterBuffer(int regionIndex, const JitterBuffer::Config& cfg) override {
+				auto region = numbers_.find(regionIndex);
+				if (region == numbers_.end()) {
+					dbgi(logger_, "Not found target region index! index=[{}].", regionIndex);
+					return PARAM_NOT_EXISTS;
+				}
+				const Source::shared& source = region->second->getSource();
+
+				if (0 == cfg.maxDelayMs) {
+					source->setJitterBuffer(nullptr);
+					return 0;
+				}
+
+				JitterBuffer::shared jitter = JitterBuffer::Create("jitter", cfg);
+				if (!jitter) {
+					return EXTERNAL_PARAM_NOT_VAILD;
+				}
+				//缓冲与源互相引用会形成环，回调只持有源的弱引用
+				std::weak_ptr<Source> weak = source;
+				jitter->output([this, weak](NMediaFrame::Unique frame) {
+					Source::shared s = weak.lock();
+					if (s) {
+						decodePacket(s, static_cast<NVideoFrame*>(frame.get()), &frame);
+					}
+				});
+				source->setJitterBuffer(jitter);
+				dbgi(logger_, "jitter buffer enabled, source=[{}], delay=[{}, {}]ms, capacity=[{}].", source->id(), cfg.minDelayMs, cfg.maxDelayMs, cfg.capacity);
+				return 0;
+			}
+
+			//录制之后的调用
+			virtual void capture(const InputRecorder::shared& recorder) override {
+				recorder_ = recorder;
+				if (!recorder_ || !isOpened()) {
+					return;
+				}
+
+				//回放从这里开始，先记录当前状态
+				recorder_->recordConfig(cfg_);
+				if (!numbers_.empty()) {
+					std::vector<RegionConfig> regions;
+					for (auto& r : numbers_) {
+						regions.push_back(r.second->getRegionCfg());
+					}
+					recorder_->recordRegions(regions);
+				}
 			}
 
 			//转码并异步输出视频流
 			//转码的视频流参数由初始化转码器时传入的参数决定
 			//调用transcode将编码的帧通过回调函数输出
 			virtual int transcode(const AVFrame** frame) override {
+				if (recorder_) {
+					recorder_->recordTick();
+				}
+
 				if (!outPacaket_) {
 					return INTERNAL_PARAM_NOT_VAILD;
 				}
+
+				onTick();
+				BusyScope busy(busyNs_);
+				releaseJitterBuffers();
+
+				if (passthrough_) {
+					*frame = nullptr;
+					return 0;
+				}
 				
-				*frame = yuvMixer_->outputFrame();
+				{
+					BusyScope stage(stats_.composeNs);
+					*frame = yuvMixer_->outputFrame();
+				}
 				if (!*frame) {
 					return 0;
 				}
 
 				//编码
-				int ret = encode(*frame);
+				int ret = 0;
+				{
+					BusyScope stage(stats_.encodeNs);
+					ret = encode(*frame);
+				}
 				if (ret) {
 					if (ret < 0) {
 						return ret;
 					}
 					return 0;
 				}
+				int64_t encPts = AV_NOPTS_VALUE != outPacaket_->pts ? outPacaket_->pts : frameIndex_;
+				stampPacket(outPacaket_, av_rescale_q(encPts, imgCodecCtx_->time_base, OUT_TIMEBASE));
 
 				//输出
 				if (onEncodeFrame_) {
 					onEncodeFrame_(outPacaket_->data, outPacaket_->size);
 				}
 
+				//编码器输出的包本身是引用计数的，直接移交
+				if (onEncodePacket_) {
+					onEncodePacket_(std::make_shared<FFEncodedPacket>(outPacaket_, cfg_.outCodecType, OUT_TIMEBASE, (*frame)->reordered_opaque));
+				}
+
 				av_packet_unref(outPacaket_);
 				return 0;
 			}
 
+			//是否处于直通模式
+			virtual bool isPassthrough() const override {
+				return passthrough_;
+			}
+
+			//获取统计信息
+			virtual Transcoder::Stats getStats() const override {
+				Transcoder::Stats stats = stats_;
+				for (auto& s : sources_) {
+					Transcoder::SourceStats ss;
+					s.second->fillStats(&ss);
+					stats.sources.push_back(ss);
+				}
+				stats.pools = NPoolRegistry::Get().snapshot();
+				return stats;
+			}
+
 			//转码器是否开启
 			virtual bool isOpened() const override{
 				return nullptr != imgCodecCtx_;
@@ -532,6 +1028,7 @@ namespace nmedia {
 			virtual void close() override {
 				channels_.clear();
 				numbers_.clear();
+				sources_.clear();
 
 				if (outPacaket_) {
 					av_packet_unref(outPacaket_);
@@ -542,9 +1039,26 @@ namespace nmedia {
 					imgCodecCtx_ = nullptr;
 				}
 
+				if (encFrame_) {
+					av_frame_free(&encFrame_);
+				}
+
+				passthrough_ = false;
+				forceKeyframe_ = false;
+				lastPts_ = AV_NOPTS_VALUE;
+				ptsOffset_ = 0;
+				rebasePts_ = true;
+
 				if (onEncodeFrame_) {
 					onEncodeFrame_ = nullptr;
 				}
+
+				onEncodePacket_ = nullptr;
+				recorder_ = nullptr;
+
+				if (fwdPacket_) {
+					av_packet_free(&fwdPacket_);
+				}
 			}
 
 			//是否支持传入的编码类型
@@ -553,23 +1067,355 @@ namespace nmedia {
 					|| typ == NCodec::Type::VP8;
 			}
 		private:
+			//累计作用域内的处理耗时
+			struct BusyScope {
+				int64_t&			busyNs;
+				Clock::time_point	begin;
+
+				BusyScope(int64_t& ns) :busyNs(ns), begin(Clock::now()) {}
+
+				~BusyScope() {
+					busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+				}
+			};
+
+			//每次transcode()时更新输出时钟，判断是否过载
+			void onTick() {
+				Clock::time_point now = Clock::now();
+				const int64_t intervalNs = 1000000000LL / cfg_.framerate;
+
+				if (0 == stats_.ticks) {
+					tickBase_ = now;
+					ptsBase_ = now;
+					frameIndex_ = -1;
+				}
+				int64_t elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - ptsBase_).count();
+				frameIndex_ = std::max(frameIndex_ + 1, (elapsedNs + intervalNs / 2) / intervalNs);
+
+				int64_t lagNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - tickBase_).count()
+					- stats_.ticks * intervalNs;
+				double busy = (double)busyNs_ / intervalNs;
+				busyNs_ = 0;
+				++stats_.ticks;
+
+				bool late = lagNs > intervalNs;
+				if (late) {
+					++stats_.lateTicks;
+					if (busy < kBusyHigh) {
+						//调用方自身迟到而不是处理不过来，以当前时刻为新的时钟起点
+						tickBase_ = now - std::chrono::nanoseconds((stats_.ticks - 1) * intervalNs);
+						lagNs = 0;
+					}
+				}
+
+				stats_.lagUs = lagNs / 1000;
+				stats_.busy = busy;
+
+				if (late && busy >= kBusyHigh) {
+					idleTicks_ = 0;
+					if (++overloadTicks_ >= kDegradeTicks) {
+						overloadTicks_ = 0;
+						degrade();
+					}
+				}
+				else if (!late && busy < kBusyLow) {
+					overloadTicks_ = 0;
+					if (++idleTicks_ >= kRecoverTicks) {
+						idleTicks_ = 0;
+						recover();
+					}
+				}
+				else {
+					overloadTicks_ = 0;
+					idleTicks_ = 0;
+				}
+			}
+
+			//输入源按优先级从低到高排列：引用它的区域中最大的zOrder，其次最大的面积
+			std::vector<Source::shared> sourcesByPriority() const {
+				std::map<Source::shared, std::pair<int, int>> priority;
+				for (auto& r : channels_) {
+					const RegionConfig& c = r->getRegionCfg();
+					auto& p = priority[r->getSource()];
+					p = std::max(p, std::make_pair(c.zOrder, c.width * c.height));
+				}
+
+				std::vector<std::pair<std::pair<int, int>, Source::shared>> v;
+				for (auto& i : priority) {
+					v.push_back(std::make_pair(i.second, i.first));
+				}
+				std::stable_sort(v.begin(), v.end(), [](const std::pair<std::pair<int, int>, Source::shared>& a, const std::pair<std::pair<int, int>, Source::shared>& b) {
+					return a.first < b.first;
+				});
+
+				std::vector<Source::shared> sources;
+				for (auto& i : v) {
+					sources.push_back(i.second);
+				}
+				return sources;
+			}
+
+			//降一级：先把优先级最低的源降到NonRef，全部为NonRef后再从最低的开始降到KeyOnly
+			void degrade() {
+				std::vector<Source::shared> sources = sourcesByPriority();
+				for (auto level : { Transcoder::DecodeLevel::Full, Transcoder::DecodeLevel::NonRef }) {
+					for (auto& s : sources) {
+						if (s->getDecodeLevel() == level) {
+							Transcoder::DecodeLevel next = (Transcoder::DecodeLevel)((int)level + 1);
+							s->setDecodeLevel(next);
+							++stats_.degradeSteps;
+							dbgw(logger_, "overloaded, degrade source=[{}] to [{}], lag=[{}]us, busy=[{:.2f}].", s->id(), Transcoder::GetNameFor(next), stats_.lagUs, stats_.busy);
+							return;
+						}
+					}
+				}
+			}
+
+			//恢复一级，顺序与降级相反
+			void recover() {
+				std::vector<Source::shared> sources = sourcesByPriority();
+				for (auto level : { Transcoder::DecodeLevel::KeyOnly, Transcoder::DecodeLevel::NonRef }) {
+					for (auto it = sources.rbegin(); it != sources.rend(); ++it) {
+						if ((*it)->getDecodeLevel() == level) {
+							Transcoder::DecodeLevel prev = (Transcoder::DecodeLevel)((int)level - 1);
+							(*it)->setDecodeLevel(prev);
+							++stats_.recoverSteps;
+							dbgi(logger_, "caught up, recover source=[{}] to [{}], busy=[{:.2f}].", (*it)->id(), Transcoder::GetNameFor(prev), stats_.busy);
+							return;
+						}
+					}
+				}
+			}
+
+			//当前布局是否允许直通：只有一个区域且铺满画布
+			bool layoutAllowsPassthrough() const {
+				if (!cfg_.passthrough || channels_.size() != 1) {
+					return false;
+				}
+
+				const RegionConfig& r = channels_[0]->getRegionCfg();
+				return 0 == r.x
+					&& 0 == r.y
+					&& cfg_.width == r.width
+					&& cfg_.height == r.height;
+			}
+
+			//输入是否可以直接作为输出
+			//allowUnknownSize : 输入分辨率未知时是否视为匹配
+			bool canPassthrough(const Source::shared& source, NCodec::Type codec, const NVideoSize& size, bool allowUnknownSize) const {
+				if (!layoutAllowsPassthrough()
+					|| channels_[0]->getSource() != source
+					|| codec != cfg_.outCodecType) {
+					return false;
+				}
+
+				if (!size.valid()) {
+					return allowUnknownSize;
+				}
+
+				return size.width == cfg_.width
+					&& size.height == cfg_.height;
+			}
+
+			void enterPassthrough() {
+				passthrough_ = true;
+				rebasePts_ = true;
+				dbgi(logger_, "enter passthrough mode, region=[{}].", channels_[0]->getRegionCfg().index);
+			}
+
+			//退出直通，重新同步解码器并让编码器从关键帧开始输出
+			void leavePassthrough() {
+				passthrough_ = false;
+				forceKeyframe_ = true;
+				rebasePts_ = true;
+				for (auto& s : sources_) {
+					s.second->resync();
+				}
+				dbgi(logger_, "leave passthrough mode.");
+			}
+
+			//检查、解码输入包并分发给引用该源的区域，owner非空时零拷贝送入解码器
+			int inputPacket(int sourceId, NVideoFrame* pkt, NMediaFrame::Unique* owner) {
+				BusyScope busy(busyNs_);
+
+				if (!isSupportCodecType(pkt->getCodecType())) {
+					dbgi(logger_, "Unsupported codec type! source=[{}], Type=[{}].", sourceId, NCodec::GetNameFor(pkt->getCodecType()));
+					return NOT_SUPPORT_CODEC_TYPE;
+				}
+
+				auto search = sources_.find(sourceId);
+				if (search == sources_.end()) {
+					dbgi(logger_, "Not found target source! source=[{}].", sourceId);
+					return PARAM_NOT_EXISTS;
+				}
+				const Source::shared& source = search->second;
+
+				//启用了抖动缓冲时，在transcode()中按播放时间解码
+				if (source->jitterBuffer()) {
+					return source->bufferFrame(pkt, owner, Clock::now());
+				}
+
+				return decodePacket(source, pkt, owner);
+			}
+
+			//释放各输入源抖动缓冲中已到播放时间的帧，送入解码
+			void releaseJitterBuffers() {
+				Clock::time_point now = Clock::now();
+				for (auto& s : sources_) {
+					if (s.second->jitterBuffer()) {
+						s.second->jitterBuffer()->release(now);
+					}
+					s.second->trimPool();
+				}
+			}
+
+			int decodePacket(const Source::shared& source, NVideoFrame* pkt, NMediaFrame::Unique* owner) {
+				NVideoInfo info;
+				bool inspected = source->inspect(pkt, &info);
+
+				//直通模式下只检查输入是否仍然匹配，不解码
+				//输入帧未携带分辨率时无法在解码前确认，沿用进入直通时的判断
+				if (passthrough_) {
+					if (canPassthrough(source, pkt->getCodecType(), pkt->videoSize(), true)) {
+						return forward(pkt);
+					}
+					leavePassthrough();
+				}
+
+				//包头已说明是匹配输出的关键帧，不解码直接进入直通
+				//分辨率必须来自本包自带的参数集（H264的SPS/PPS、VP8关键帧头），
+				//沿用的分辨率或调用者设置的videoSize()不行：输出流此前是编码器的SPS/PPS，转发不带参数集的关键帧会无法解码
+				if (inspected && info.keyframe && info.size.valid()
+					&& canPassthrough(source, pkt->getCodecType(), info.size, false)) {
+					enterPassthrough();
+					return forward(pkt);
+				}
+
+				int ret = 0;
+				{
+					BusyScope stage(stats_.decodeNs);
+					ret = source->onInputFrame(pkt, info, owner);
+				}
+				if (ret) {
+					return ret;
+				}
+
+				if (!source->hasNewFrame()) {
+					return 0;
+				}
+
+				//包头未说明关键帧时，只在解码出关键帧后进入直通，保证输出流从关键帧开始可解码
+				//同样要求本包自带参数集；解码器为低延时配置，解码出的图像即对应当前输入包
+				const AVFrame* drawFrame = source->getDrawFrame();
+				if (drawFrame->key_frame && inspected && info.size.valid()
+					&& canPassthrough(source, pkt->getCodecType(), NVideoSize(drawFrame->width, drawFrame->height), false)) {
+					enterPassthrough();
+					return forward(pkt);
+				}
+
+				BusyScope stage(stats_.scaleNs);
+				for (auto& r : channels_) {
+					if (r->getSource() != source) {
+						continue;
+					}
+					ret = yuvMixer_->inputRegionFrame(r->getRegionCfg().index, drawFrame);
+					if (ret < 0) {
+						return ret;
+					}
+				}
+				return 0;
+			}
+
+			//直通模式下直接输出输入数据，拷贝一次
+			int forward(NVideoFrame* pkt) {
+				if (onEncodeFrame_) {
+					onEncodeFrame_(pkt->data(), pkt->size());
+				}
+
+				if (!onEncodePacket_) {
+					return 0;
+				}
+
+				if (!fwdPacket_) {
+					fwdPacket_ = av_packet_alloc();
+				}
+
+				//输出包可能被使用者保留或在其他线程释放（如OutputSink的写线程），不能引用输入帧：
+				//输入池不是线程安全的，帧必须在调用线程中归还，所以这里拷贝一次，池中的帧由调用者归还
+				if (av_new_packet(fwdPacket_, pkt->size()) < 0) {
+					return INTERNAL_PARAM_NOT_VAILD;
+				}
+				memcpy(fwdPacket_->data, pkt->data(), pkt->size());
+
+				//输入pts按OUT_TIMEBASE处理，没有时使用输出时钟经过的时间
+				int64_t pts = pkt->getPts();
+				if (pts < 0) {
+					pts = av_rescale(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - ptsBase_).count()
+						, OUT_TIMEBASE.den, 1000000000LL * OUT_TIMEBASE.num);
+				}
+				stampPacket(fwdPacket_, pts);
+				if (pkt->isKeyframe()) {
+					fwdPacket_->flags |= AV_PKT_FLAG_KEY;
+				}
+				onEncodePacket_(std::make_shared<FFEncodedPacket>(fwdPacket_, cfg_.outCodecType, OUT_TIMEBASE, pkt->getGts()));
+				return 0;
+			}
+
+			//设置输出包的pts/dts（没有B帧，dts等于pts）
+			//base为当前模式下的时间基准，切换模式后的第一个包接在上一个包之后一帧
+			void stampPacket(AVPacket* pkt, int64_t base) {
+				const int64_t frameDuration = av_rescale_q(1, AVRational{ 1, cfg_.framerate }, OUT_TIMEBASE);
+				if (rebasePts_) {
+					ptsOffset_ = (AV_NOPTS_VALUE == lastPts_ ? 0 : lastPts_ + frameDuration) - base;
+					rebasePts_ = false;
+				}
+
+				int64_t pts = base + ptsOffset_;
+				if (AV_NOPTS_VALUE != lastPts_ && pts <= lastPts_) {
+					pts = lastPts_ + 1;
+				}
+				pkt->pts = pts;
+				pkt->dts = pts;
+				pkt->duration = frameDuration;
+				lastPts_ = pts;
+			}
+
 			//编码一帧视频帧
 			int encode(const AVFrame* frame) {
-				if (!outPacaket_) {
+				if (!outPacaket_ || !encFrame_) {
 					dbge(logger_, "Error during encoding, NULL parameter!");
 					return INTERNAL_PARAM_NOT_VAILD;
 				}
 
-				int ret = avcodec_send_frame(imgCodecCtx_, frame);
+				//合成图像由混合器持有，这里只引用其数据；带上画布缓冲区的引用，编码器增加引用而不拷贝整幅图像
+				for (int i = 0; i < AV_NUM_DATA_POINTERS; ++i) {
+					encFrame_->data[i] = frame->data[i];
+					encFrame_->linesize[i] = frame->linesize[i];
+				}
+				if (frame->buf[0]) {
+					encFrame_->buf[0] = av_buffer_ref(frame->buf[0]);
+				}
+				encFrame_->width = frame->width;
+				encFrame_->height = frame->height;
+				encFrame_->format = frame->format;
+				encFrame_->pict_type = forceKeyframe_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+				forceKeyframe_ = false;
+				//编码器时间基为1/framerate，pts为输出时钟经过的帧数（见frameIndex_）
+				encFrame_->pts = frameIndex_;
+
+				int ret = avcodec_send_frame(imgCodecCtx_, encFrame_);
 				if (ret) {
 					if (AVERROR(EAGAIN) != ret) {
+						av_buffer_unref(&encFrame_->buf[0]);
 						dbge(logger_, "Error sending original frame to encoder!");
 						return ERROR_ENCODE_VIDEO;
 					}
 					avcodec_receive_packet(imgCodecCtx_, outPacaket_);
 					av_packet_unref(outPacaket_);
-					avcodec_send_frame(imgCodecCtx_, frame);
+					avcodec_send_frame(imgCodecCtx_, encFrame_);
 				}
+				//编码器已持有需要的引用
+				av_buffer_unref(&encFrame_->buf[0]);
 
 				ret = avcodec_receive_packet(imgCodecCtx_, outPacaket_);
 				if (ret) {
@@ -590,6 +1436,10 @@ namespace nmedia {
 					outPacaket_ = av_packet_alloc();
 				}
 
+				if (!encFrame_) {
+					encFrame_ = av_frame_alloc();
+				}
+
 				return initEncoder();
 			}
 
@@ -624,6 +1474,11 @@ namespace nmedia {
 					imgCodecCtx_->bit_rate = cfg_.bitrate;
 					imgCodecCtx_->gop_size = 12;
 					imgCodecCtx_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+					//时间基由输出帧率决定，每帧pts加1，码率控制据此计算每帧预算
+					imgCodecCtx_->time_base.num = 1;
+					imgCodecCtx_->time_base.den = cfg_.framerate;
+					imgCodecCtx_->framerate.num = cfg_.framerate;
+					imgCodecCtx_->framerate.den = 1;
 
 					if (NCodec::Type::H264 == cfg_.outCodecType) {
 						paddingH264Codec(&param);
@@ -646,8 +1501,6 @@ namespace nmedia {
 
 			//填充H264编码器
 			void paddingH264Codec(AVDictionary** param) {
-				imgCodecCtx_->time_base.num = 1;
-				imgCodecCtx_->time_base.den = 25;
 				//H264
 				//imgCodecCtx_->me_range = 16;
 				//imgCodecCtx_->max_qdiff = 4;
@@ -660,13 +1513,11 @@ namespace nmedia {
 
 				av_dict_set(param, "tune", "zerolatency", 0);      //zero delay
 				av_dict_set(param, "profile", "baseline", 0);
+				av_dict_set(param, "forced-idr", "1", 0);          //强制关键帧编码为IDR
 			}
 
 			//填充VP8编码器
 			void paddingVP8Codec(AVDictionary** param) {
-				imgCodecCtx_->time_base.num = 1;
-				imgCodecCtx_->time_base.den = 90000;
-
 				imgCodecCtx_->qmin = 4;
 				imgCodecCtx_->qmax = 63;
 			}
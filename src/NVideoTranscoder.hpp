@@ -8,6 +8,7 @@
 #include "NRegion.hpp"
 #include "NMediaBasic.hpp"
 #include "NMediaFrame.hpp"
+#include "NJitterBuffer.hpp"
 
 #include "fmt/fmt.h"
 
@@ -18,6 +19,42 @@ extern "C" {
 namespace nmedia {
 	namespace video {
 
+		class InputRecorder;
+
+		//编码输出的一个包，不可变，引用计数
+		//数据由内部的AVPacket引用持有，可以长期保存或同时分发给多个接收者而不拷贝
+		class EncodedPacket {
+		public:
+			using shared = std::shared_ptr<const EncodedPacket>;
+
+			virtual ~EncodedPacket() {}
+
+			virtual const uint8_t* data() const = 0;
+
+			virtual size_t size() const = 0;
+
+			virtual NCodec::Type codecType() const = 0;
+
+			virtual bool isKeyframe() const = 0;
+
+			//显示/解码时间戳与时长，单位为timebase()（1/90000），未知时为-1
+			//同一转码器输出的pts/dts单调递增：合成模式按输出时钟（OutputConfig::framerate）打时间戳，
+			//直通模式沿用输入帧的pts（按1/90000处理），模式切换时保持连续
+			virtual int64_t pts() const = 0;
+
+			virtual int64_t dts() const = 0;
+
+			virtual int64_t duration() const = 0;
+
+			//时间基 num/den 秒
+			virtual int timebaseNum() const = 0;
+
+			virtual int timebaseDen() const = 0;
+
+			//产生时间：输入帧的gts（合成时取最新的一路），输入未设置时为输出时刻（steady_clock，毫秒）
+			virtual int64_t gts() const = 0;
+		};
+
 		//TODO : 目前已知问题，在转换视频分辨率和关闭视频流时会丢失几帧视频帧
 		class Transcoder {
 		public:
@@ -29,6 +66,8 @@ namespace nmedia {
 				int framerate = -1;
 				int bitrate = -1;
 				NCodec::Type outCodecType = NCodec::Type::UNKNOWN;
+				//单区域铺满画布且输入编码、分辨率与输出一致时，直接转发输入数据，跳过解码和编码
+				bool passthrough = true;
 
 				bool vaild() const {
 					return (0 < width)
@@ -39,28 +78,119 @@ namespace nmedia {
 				}
 
 				const std::string dump() const {
-					return fmt::format("[width=[{}]\nheight=[{}]\nbackgroundColor=[{x:}]\nframerate=[{}]\nbitrate=[{}]\noutCodecType=[{}].]"
+					return fmt::format("[width=[{}]\nheight=[{}]\nbackgroundColor=[{x:}]\nframerate=[{}]\nbitrate=[{}]\noutCodecType=[{}]\npassthrough=[{}].]"
 						, width
 						, height
 						, backgroundColor
 						, framerate
 						, bitrate
-						, outCodecType);
+						, outCodecType
+						, passthrough);
+				}
+			};
+			//输入源的解码级别，过载时按优先级从低到高逐级降低
+			enum class DecodeLevel {
+				Full = 0,		//解码全部帧
+				NonRef,			//丢弃非参考帧，skip_frame = AVDISCARD_NONREF
+				KeyOnly			//只解码关键帧，skip_frame = AVDISCARD_NONKEY
+			};
+
+			static const char* GetNameFor(DecodeLevel level) {
+				switch (level) {
+				case DecodeLevel::Full:		return "full";
+				case DecodeLevel::NonRef:	return "nonref";
+				case DecodeLevel::KeyOnly:	return "keyonly";
+				default:					return "unknown";
+				}
+			}
+
+			//输入源统计
+			struct SourceStats {
+				int id = -1;
+				DecodeLevel level = DecodeLevel::Full;
+				int64_t packets = 0;		//输入包数
+				int64_t frames = 0;			//解码出的图像数
+				int64_t skipped = 0;		//解码前丢弃的包数
+				JitterBuffer::Stats jitter;	//未使用抖动缓冲时为0
+			};
+
+			//转码器统计
+			struct Stats {
+				int64_t ticks = 0;			//transcode()调用次数
+				int64_t lateTicks = 0;		//落后于输出时钟超过一帧的次数
+				int64_t degradeSteps = 0;	//降级次数
+				int64_t recoverSteps = 0;	//恢复次数
+				int64_t lagUs = 0;			//最近一次transcode()相对输出时钟的延迟
+				double busy = 0;			//最近一个输出周期内处理耗时占周期的比例
+				int64_t decodeNs = 0;		//各阶段累计耗时：解码
+				int64_t scaleNs = 0;		//缩放到各区域
+				int64_t composeNs = 0;		//合成
+				int64_t encodeNs = 0;		//编码
+				std::vector<SourceStats> sources;
+				std::vector<NPoolStats> pools;	//进程内所有对象池（NPoolRegistry的快照），不只是本转码器的
+
+				const std::string dump() const {
+					std::string str = fmt::format("[ticks={}, late={}, degrade={}, recover={}, lag={}us, busy={:.2f}, decode={}ms, scale={}ms, compose={}ms, encode={}ms"
+						, ticks
+						, lateTicks
+						, degradeSteps
+						, recoverSteps
+						, lagUs
+						, busy
+						, decodeNs / 1000000
+						, scaleNs / 1000000
+						, composeNs / 1000000
+						, encodeNs / 1000000);
+					for (auto& s : sources) {
+						str += fmt::format(", source{}=[level={}, packets={}, frames={}, skipped={}]"
+							, s.id
+							, GetNameFor(s.level)
+							, s.packets
+							, s.frames
+							, s.skipped);
+						if (s.jitter.frames > 0) {
+							str += fmt::format(", jitter{}={}", s.id, s.jitter.dump());
+						}
+					}
+					for (auto& p : pools) {
+						str += fmt::format(", pool[{}]=[hit={:.3f}, gets={}, puts={}, dropped={}, trimmed={}, orphaned={}, out={}, peak={}, idle={}, held={}KB{}]"
+							, p.name
+							, p.hitRate()
+							, p.gets
+							, p.puts
+							, p.dropped
+							, p.trimmed
+							, p.orphaned
+							, p.outstanding
+							, p.peakOutstanding
+							, p.idle
+							, p.bytesHeld / 1024
+							, p.closed ? ", closed" : "");
+					}
+					return str + "]";
 				}
 			};
+
 		public:
 			using shared = std::shared_ptr< Transcoder>;
 
 			using DataFunc = std::function<void(uint8_t * data, size_t size)>;
 
+			using PacketFunc = std::function<void(const EncodedPacket::shared& packet)>;
+
 		public:
 			Transcoder() {}
 
 			virtual ~Transcoder() {}
 
 			//设置转码器输出数据时的回调函数
+			//data只在回调期间有效，需要保留时必须拷贝
 			virtual void output(const DataFunc& func) = 0;
 
+			//设置输出编码包的回调函数，可以与output()同时设置
+			//回调得到的包可以保留或分发给多个接收者，不需要拷贝
+			virtual void outputPacket(const PacketFunc& func) = 0;
+
 			//初始化转码器
 			// 0 : 成功
 			// ALREADY_OPENED_TRANSCODER : 转码器已初始化
@@ -87,18 +217,56 @@ namespace nmedia {
 			// region.index : 成功
 			virtual int addRegion(const RegionConfig& channel) = 0;
 
-			// 当有数据时调用该方法输入数据
+			// 当有数据时调用该方法输入数据，数据送入该区域引用的输入源（RegionConfig::source）
 			// 0 : 成功
 			// NOT_SUPPORT_CODEC_TYPE : 不支持输入视频流的格式
 			// PARAM_NOT_EXISTS : index不存在
 			virtual int input(int regionIndex, NVideoFrame* pkt) = 0;
 
+			// 输入一路源的数据，只解码一次，解码图像分发给所有引用该源的区域
+			// 多个区域显示同一路流时（如主讲人大图加缩略图）应使用此方法，每个包只输入一次
+			// 0 : 成功
+			// NOT_SUPPORT_CODEC_TYPE : 不支持输入视频流的格式
+			// PARAM_NOT_EXISTS : 没有区域引用该源
+			virtual int inputSource(int sourceId, NVideoFrame* pkt) = 0;
+
+			// 零拷贝输入，pkt必须是NVideoFrame，通常来自NVideoFrame::Pool
+			// 帧数据以引用计数缓冲区交给解码器，不再拷贝，libavcodec释放最后一个引用时帧归还到池
+			// 解码器（单线程）在调用线程中释放引用；直通模式输出的包是拷贝，不引用输入帧
+			// 因此帧总是在调用本方法或transcode()的线程中归还，池不需要是线程安全的
+			// 0 : 成功
+			// EXTERNAL_PARAM_NOT_VAILD : pkt为空或不是视频帧
+			// 其他返回值同input(int, NVideoFrame*)
+			virtual int input(int regionIndex, NMediaFrame::Unique pkt) = 0;
+
+			virtual int inputSource(int sourceId, NMediaFrame::Unique pkt) = 0;
+
+			//为区域引用的输入源启用抖动缓冲，之后该源的输入按pts（cfg.key为Key::Pts）或到达顺序（Key::Sequence）缓存，
+			//在transcode()中按播放时间送入解码；Key::Pts时没有pts的输入被拒绝（EXTERNAL_PARAM_NOT_VAILD），不带pts的源应使用Key::Sequence
+			//池中的帧（Unique输入）直接缓存，其他输入拷贝一次到源自己的帧池
+			//cfg.maxDelayMs为0时关闭，缓存的帧立即送入解码；输入源被移除时缓存的帧被丢弃
+			// 0 : 成功
+			// PARAM_NOT_EXISTS : index不存在
+			// EXTERNAL_PARAM_NOT_VAILD : cfg参数不可用
+			virtual int setJitterBuffer(int regionIndex, const JitterBuffer::Config& cfg) = 0;
+
+			//录制之后的init/setRegions/addRegion/input/inputSource/transcode调用，用于离线回放（见NInputCapture.hpp）
+			//转码器已初始化时先记录当前的输出参数和区域，recorder为nullptr时停止录制
+			virtual void capture(const std::shared_ptr<InputRecorder>& recorder) = 0;
+
 			//转码并异步输出视频流
 			//转码的视频流参数由初始化转码器时传入的参数决定
 			//调用transcode将编码的帧通过回调函数输出
+			//直通模式下输入数据在input()中直接输出，这里不合成也不编码，*frame为nullptr
 			// 0 : 成功
 			virtual int transcode(const AVFrame** frame) = 0;
 
+			//是否处于直通模式
+			virtual bool isPassthrough() const = 0;
+
+			//获取统计信息
+			virtual Stats getStats() const = 0;
+
 			//转码器是否开启
 			virtual bool isOpened() const = 0;
 
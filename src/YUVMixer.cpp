@@ -6,6 +6,7 @@
 #include "NLogger.hpp"
 #include "YUVMixer.hpp"
 #include "NTErrorDefined.hpp"
+#include "NFrameBufferPool.hpp"
 
 #include "NMediaBasic.hpp"
 
@@ -38,8 +39,7 @@ namespace nmedia {
 
                 RegionConfig            region_;
                 ImgDrawParam            imgConfig_;
-                AVFrame*                swsFrame_ = nullptr;
-                uint8_t*                swsBuf_ = nullptr;
+                AVFrame*                swsFrame_ = nullptr;		//平面来自FrameBufferPool，由swsFrame_->buf[0]持有
                 SwsContext*             imgConvertCtx_ = nullptr;
                 
 			public:
@@ -49,11 +49,6 @@ namespace nmedia {
 						imgConvertCtx_ = nullptr;
 					}
 
-					if (swsBuf_) {
-						av_free(swsBuf_);
-						swsBuf_ = nullptr;
-					}
-
 					if (swsFrame_) {
 						av_frame_free(&swsFrame_);
 					}
@@ -72,6 +67,9 @@ namespace nmedia {
 						return INTERNAL_PARAM_NOT_VAILD;
 					}
 
+					//区域保存最近一帧图像的pts和gts（reordered_opaque）
+					swsFrame_->pts = input->pts;
+					swsFrame_->reordered_opaque = input->reordered_opaque;
 					return sws_scale(imgConvertCtx_, (const uint8_t* const*)input->data, input->linesize, 0, input->height,
 							swsFrame_->data, swsFrame_->linesize);
 				}
@@ -112,26 +110,19 @@ namespace nmedia {
 						swsFrame_ = av_frame_alloc();
 					}
 
-					if(swsBuf_) {
-						av_free(swsBuf_);
-					}
-					
-					swsBuf_ = (uint8_t*)av_malloc(
-						av_image_get_buffer_size((AVPixelFormat)OUT_FF_FMT, imgConfig_.dstImgSize.width, imgConfig_.dstImgSize.height, 1)
-					);
-
-					if (av_image_fill_arrays(swsFrame_->data, swsFrame_->linesize
-						, swsBuf_, (AVPixelFormat)OUT_FF_FMT
-						, imgConfig_.dstImgSize.width
-						, imgConfig_.dstImgSize.height, 1) < 0) {
-						//dbge(logger_, "Could not init swsFrame buffer! index=[{}].", bgConfig_.index);
-						return FAILED_FILL_BUFFER;
-					}
+					//旧的缓冲区回到池中，同样尺寸的区域或会话可以直接复用
+					av_buffer_unref(&swsFrame_->buf[0]);
 
 					swsFrame_->width = imgConfig_.dstImgSize.width;
 					swsFrame_->height = imgConfig_.dstImgSize.height;
 					swsFrame_->format = OUT_FF_FMT;
 
+					//按1字节对齐，绘制时假设linesize等于宽度
+					if (FrameBufferPool::Get().getFrameBuffer(swsFrame_, 1) < 0) {
+						//dbge(logger_, "Could not init swsFrame buffer! index=[{}].", bgConfig_.index);
+						return FAILED_FILL_BUFFER;
+					}
+
 					return 0;
 				}
 
@@ -264,13 +255,17 @@ namespace nmedia {
 			std::vector< RegionImpl::shared> regions_;
 			std::map<int, RegionImpl::shared> numbers_;
 			uint32_t					backgroundColor_ = 0x008080;		//YUV	黑
+			//画布，平面来自FrameBufferPool，挂在buf[0]上，编码器只增加引用而不拷贝
 			AVFrame*					outFrame_ = nullptr;
-			uint8_t*					outBuf_ = nullptr;
         public:
 
 			YUVMixerImpl(const std::string& name) :logger_(NLogger::Get(name)) { }
 
-            ~YUVMixerImpl(){}
+            ~YUVMixerImpl(){
+				if (outFrame_) {
+					av_frame_free(&outFrame_);
+				}
+			}
             
             // 设置输出图像尺寸
 			// bkground_color : RGB24
@@ -301,18 +296,10 @@ namespace nmedia {
 					backgroundColor_ = ((uint32_t)Y << 16) | ((uint32_t)U << 8) | ((uint32_t)V);
 				}
 
-				if (outBuf_) {
-					av_free(outBuf_);
-				}
-
-				outBuf_ = (uint8_t*)av_malloc(
-					av_image_get_buffer_size((AVPixelFormat)OUT_FF_FMT, outFrame_->width, outFrame_->height, 1)
-				);
+				av_buffer_unref(&outFrame_->buf[0]);
 
-				if (av_image_fill_arrays(outFrame_->data, outFrame_->linesize
-					, outBuf_, (AVPixelFormat)OUT_FF_FMT
-					, outFrame_->width
-					, outFrame_->height, 1) < 0) {
+				//按1字节对齐，绘制时假设linesize等于宽度
+				if (FrameBufferPool::Get().getFrameBuffer(outFrame_, 1) < 0) {
 					//dbge(logger_, "Could not init swsFrame buffer! index=[{}].", bgConfig_.index);
 					return FAILED_FILL_BUFFER;
 				}
@@ -422,14 +409,33 @@ namespace nmedia {
             
             // 输出1帧图像
             virtual const AVFrame * outputFrame() override{
+				//编码器仍持有上一帧画布的引用（编码延迟）时换一块池中的缓冲区，上一块在编码器释放后回到池中
+				//画布每帧整体重绘，不需要保留旧内容；稳态下在两三块缓冲区之间轮换
+				if (outFrame_ && outFrame_->buf[0] && !av_buffer_is_writable(outFrame_->buf[0])) {
+					av_buffer_unref(&outFrame_->buf[0]);
+					if (FrameBufferPool::Get().getFrameBuffer(outFrame_, 1) < 0) {
+						return nullptr;
+					}
+				}
+
 				if (resetBgByYuv420p( backgroundColor_) < 0) {
 					return nullptr;
 				}
 
+				//合成图像的pts和gts取各区域中最新的一路，无输入时为AV_NOPTS_VALUE/0
+				outFrame_->pts = AV_NOPTS_VALUE;
+				outFrame_->reordered_opaque = 0;
 				for (auto i : regions_) {
 					if (brushYUV420P(i->imgConfig_, i->swsFrame_) < 0) {
 						return nullptr;
 					}
+					if (i->swsFrame_ && AV_NOPTS_VALUE != i->swsFrame_->pts
+						&& (AV_NOPTS_VALUE == outFrame_->pts || i->swsFrame_->pts > outFrame_->pts)) {
+						outFrame_->pts = i->swsFrame_->pts;
+					}
+					if (i->swsFrame_ && i->swsFrame_->reordered_opaque > outFrame_->reordered_opaque) {
+						outFrame_->reordered_opaque = i->swsFrame_->reordered_opaque;
+					}
 				}
 
                 return outFrame_;
@@ -452,8 +458,8 @@ namespace nmedia {
 			//将多路区域画入画布中
 			int brushYUV420P(const ImgDrawParam& imgConfig, const AVFrame* src) {
 
-				if (!outBuf_ 
-				|| !outFrame_) {
+				if (!outFrame_
+				|| !outFrame_->buf[0]) {
 					dbge(logger_, "An error occurred while painting, the parameter is NULL!");
 					return INTERNAL_PARAM_NOT_VAILD;
 				} else if (!src 